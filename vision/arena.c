@@ -0,0 +1,190 @@
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libxml/xmlerror.h>
+#include <libxml/xmlmemory.h>
+
+#include "arena.h"
+#include "status.h"
+
+/// The size of a standard block in an arena. A larger allocation gets a block
+/// of its own.
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+/// The alignment of each allocation from an arena
+#define ARENA_ALIGN 16
+
+/// Round the @a size up to a multiple of @c ARENA_ALIGN
+#define ARENA_ROUND(size) \
+  (((size) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+
+/// A block of memory in an arena
+typedef struct arena_block_t {
+  /// The previous block in the arena or @c NULL
+  struct arena_block_t *prev;
+
+  /// The number of bytes in the block (after its header)
+  size_t size;
+
+  /// The number of bytes in the block that are allocated
+  size_t used;
+} arena_block_t;
+
+/// The header of each libxml2 allocation (from either an arena or the heap) so
+/// that it can be reallocated or freed without a search for its origin
+typedef struct arena_header_t {
+  /// The number of bytes requested
+  size_t size;
+
+  /// Whether the allocation is from an arena
+  size_t arena;
+} arena_header_t;
+
+/// The current (last) block in the calling thread's arena or @c NULL
+static __thread arena_block_t *arena_block = NULL;
+
+/// The number of arena scopes that the calling thread is in
+static __thread size_t arena_depth = 0;
+
+/// The number of bytes allocated in the calling thread's current scope
+static __thread size_t arena_used = 0;
+
+/// Allocate @a size bytes (a multiple of @c ARENA_ALIGN) from the calling
+/// thread's arena. On failure this will return @c NULL.
+static void *arena_take(size_t size);
+
+/// Allocate @a size bytes for libxml2 from the calling thread's arena if it's
+/// in a scope or from the heap otherwise. This is libxml2's @c xmlMalloc.
+static void *arena_malloc(size_t size);
+
+/// Reallocate the libxml2 allocation at @a pointer to @a size bytes. An
+/// allocation from an arena is copied. This is libxml2's @c xmlRealloc.
+static void *arena_realloc(void *pointer, size_t size);
+
+/// Free the libxml2 allocation at @a pointer unless it's from an arena. This is
+/// libxml2's @c xmlFree.
+static void arena_free(void *pointer);
+
+/// Duplicate the @a text with arena_malloc(). This is libxml2's
+/// @c xmlMemStrdup.
+static char *arena_strdup(const char *text) __attribute__((nonnull));
+
+int vs_arena_init(void) {
+  if (xmlMemSetup(arena_free, arena_malloc, arena_realloc, arena_strdup) != 0)
+    vs_return(-1, "Can't install the arena allocator in libxml2\n");
+  return 0;
+}
+
+void vs_arena_begin(void) {
+  arena_depth++;
+}
+
+size_t vs_arena_end(void) {
+  if (--arena_depth > 0)
+    return 0;
+
+  // libxml2 holds the last error of each thread (with strings that may be from
+  // the arena) until the next error so reset it before the arena is
+  xmlResetLastError();
+
+  // Keep the first standard block to serve the next scope and free the rest
+  arena_block_t *block = arena_block;
+  while (block != NULL
+      && (block->prev != NULL || block->size != ARENA_BLOCK_SIZE)) {
+    arena_block_t *prev = block->prev;
+    free(block);
+    block = prev;
+  }
+  if ((arena_block = block) != NULL)
+    arena_block->used = 0;
+
+  size_t used = arena_used;
+  arena_used = 0;
+  return used;
+}
+
+void *vs_arena_alloc(size_t size) {
+  void *pointer;
+  if ((pointer = arena_take(ARENA_ROUND(size))) == NULL)
+    vs_return(NULL, "Can't allocate %zu bytes from the arena\n", size);
+  return memset(pointer, 0, size);
+}
+
+void *arena_take(size_t size) {
+  arena_block_t *block = arena_block;
+
+  if (block == NULL || block->size - block->used < size) {
+    size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    block = malloc(ARENA_ROUND(sizeof(arena_block_t)) + block_size);
+    if (block == NULL)
+      return NULL;
+    block->prev = arena_block;
+    block->size = block_size;
+    block->used = 0;
+    arena_block = block;
+  }
+
+  void *pointer = (char *) block + ARENA_ROUND(sizeof(arena_block_t))
+    + block->used;
+  block->used += size;
+  arena_used += size;
+  return pointer;
+}
+
+void *arena_malloc(size_t size) {
+  arena_header_t *header;
+
+  if (arena_depth > 0) {
+    header = arena_take(ARENA_ROUND(sizeof(arena_header_t) + size));
+    if (header == NULL)
+      return NULL;
+    header->arena = 1;
+  } else {
+    if ((header = malloc(sizeof(arena_header_t) + size)) == NULL)
+      return NULL;
+    header->arena = 0;
+  }
+
+  header->size = size;
+  return header + 1;
+}
+
+void *arena_realloc(void *pointer, size_t size) {
+  if (pointer == NULL)
+    return arena_malloc(size);
+
+  arena_header_t *header = (arena_header_t *) pointer - 1;
+
+  if (!header->arena) {
+    if ((header = realloc(header, sizeof(arena_header_t) + size)) == NULL)
+      return NULL;
+    header->size = size;
+    return header + 1;
+  }
+
+  void *update;
+  if ((update = arena_malloc(size)) == NULL)
+    return NULL;
+  return memcpy(update, pointer, header->size < size ? header->size : size);
+}
+
+void arena_free(void *pointer) {
+  if (pointer == NULL)
+    return;
+
+  arena_header_t *header = (arena_header_t *) pointer - 1;
+  if (!header->arena)
+    free(header);
+}
+
+char *arena_strdup(const char *text) {
+  size_t size = strlen(text) + 1;
+
+  char *copy;
+  if ((copy = arena_malloc(size)) == NULL)
+    return NULL;
+  return memcpy(copy, text, size);
+}
@@ -0,0 +1,42 @@
+#ifndef VS_ARENA_H
+#define VS_ARENA_H
+
+#include <stddef.h>
+
+/**
+ * Install the arena allocator as the libxml2 allocator
+ *
+ * Each libxml2 allocation is then from the calling thread's arena while the
+ * thread is in an arena scope (from vs_arena_begin() to vs_arena_end()) and
+ * from the heap otherwise. An allocation from an arena is never freed on its
+ * own; it's released with the rest of the scope. A heap allocation is freed
+ * as usual.
+ *
+ * This must be called before libxml2 (or libvirt) is initialized. On failure
+ * this will log to @c stderr and return @c -1.
+ */
+int vs_arena_init(void);
+
+/// Start an arena scope on the calling thread. A scope may be nested in which
+/// case it ends with the outermost scope.
+void vs_arena_begin(void);
+
+/**
+ * End an arena scope on the calling thread
+ *
+ * If this is the outermost scope then each allocation in it is released at
+ * once and the thread's arena is reset. Return the number of bytes allocated
+ * in the scope (or @c 0 if it's nested).
+ */
+size_t vs_arena_end(void);
+
+/**
+ * Allocate @a size zeroed bytes from the calling thread's arena
+ *
+ * The allocation is released at the end of the thread's arena scope and must
+ * not be free()ed. If the thread isn't in an arena scope then the behavior is
+ * undefined. On failure this will log to @c stderr and return @c NULL.
+ */
+void *vs_arena_alloc(size_t size) __attribute__((malloc));
+
+#endif /* VS_ARENA_H */
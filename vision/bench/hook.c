@@ -0,0 +1,154 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "status.h"
+#include "trace.h"
+
+/// The number of times that the hook is invoked for each domain description
+#define HOOK_ROUND_COUNT 200
+
+/// The number of bytes that a domain description has room for
+#define HOOK_TEXT_SIZE 16384
+
+/// A hostdev element of a PCI device at the address in the format's arguments
+#define HOOK_HOSTDEV_FORMAT \
+  "<hostdev mode='subsystem' type='pci' managed='yes'><source>" \
+  "<address domain='0x%04x' bus='0x%02x' slot='0x%02x' function='0x%x'/>" \
+  "</source></hostdev>"
+
+/// Write a domain description with a hostdev of @a length absent PCI devices
+/// and of each PCI device in the @a name_list to @a text
+static void describe(char *text, size_t length, char **name_list)
+  __attribute__((nonnull));
+
+/// Invoke the hook at @a path for the prepare phase with the @a text on its
+/// @c stdin and return the wall-clock nanoseconds to its exit. On failure this
+/// will log to @c stderr and return @c 0.
+static uint64_t invoke(const char *path, const char *text)
+  __attribute__((nonnull));
+
+/// Compare the durations at @a a and @a b for qsort()
+static int compare(const void *a, const void *b) __attribute__((nonnull));
+
+/**
+ * Measure the latency of the qemu hook's prepare phase
+ *
+ * This is run as <tt>bench_hook [HOOK [PCI_SLOT_NAME...]]</tt>. The hook at
+ * @c HOOK (the vision-qemu-hook in the build tree by default) is invoked as
+ * libvirt does it for <tt>prepare begin</tt> with a description of a domain
+ * with 0, 4, and 16 absent PCI host devices. Each @c PCI_SLOT_NAME (such as
+ * @c 0000:01:00.0) is a host device in each description too. Such a device is
+ * bound to vfio-pci on the first invocation (which needs root) so the rest
+ * measure a device that's already bound, as on the start of a domain.
+ *
+ * The time of each invocation is from the fork() to the hook's exit so it
+ * includes the exec() and the dynamic link, as on a domain's start.
+ */
+int main(int argc, char *argv[]) {
+  const char *path = argc > 1 ? argv[1] : VS_HOOK_PATH;
+  char **name_list = argc > 2 ? argv + 2 : argv + argc;
+
+  static const size_t length_list[] = { 0, 4, 16 };
+  static uint64_t duration_list[HOOK_ROUND_COUNT];
+  static char text[HOOK_TEXT_SIZE];
+
+  printf("%-8s %10s %10s %10s %10s\n",
+      "absent", "mean (us)", "p50 (us)", "p99 (us)", "max (us)");
+  for (size_t i = 0; i < sizeof(length_list) / sizeof(*length_list); i++) {
+    describe(text, length_list[i], name_list);
+
+    uint64_t total = 0;
+    for (size_t round = 0; round < HOOK_ROUND_COUNT; round++) {
+      if ((duration_list[round] = invoke(path, text)) == 0)
+        return EXIT_FAILURE;
+      total += duration_list[round];
+    }
+
+    qsort(duration_list, HOOK_ROUND_COUNT, sizeof(*duration_list), compare);
+    printf("%-8zu %10.1f %10.1f %10.1f %10.1f\n", length_list[i],
+        total / 1e3 / HOOK_ROUND_COUNT,
+        duration_list[HOOK_ROUND_COUNT / 2] / 1e3,
+        duration_list[HOOK_ROUND_COUNT * 99 / 100] / 1e3,
+        duration_list[HOOK_ROUND_COUNT - 1] / 1e3);
+  }
+
+  return EXIT_SUCCESS;
+}
+
+void describe(char *text, size_t length, char **name_list) {
+  char *cursor = text;
+  char *end = text + HOOK_TEXT_SIZE;
+  cursor += snprintf(cursor, end - cursor, "<domain type='kvm'>"
+      "<name>bench</name><memory>8192</memory><devices>");
+
+  // A device in the last PCI domain is absent on any host
+  for (size_t i = 0; i < length; i++) {
+    cursor += snprintf(cursor, end - cursor, HOOK_HOSTDEV_FORMAT,
+        0xffff, 0xff, (unsigned) i % 32, (unsigned) i / 32 % 8);
+  }
+
+  for (char **name = name_list; *name != NULL; name++) {
+    unsigned domain, bus, slot, function;
+    if (sscanf(*name, "%4x:%2x:%2x.%1x", &domain, &bus, &slot, &function) != 4)
+      continue;
+    cursor += snprintf(cursor, end - cursor, HOOK_HOSTDEV_FORMAT,
+        domain, bus, slot, function);
+  }
+
+  snprintf(cursor, end - cursor, "</devices></domain>");
+}
+
+uint64_t invoke(const char *path, const char *text) {
+  int fd[2];
+  if (pipe(fd) == -1)
+    vs_return(0, "pipe(): %s\n", strerror(errno));
+
+  uint64_t start = vs_monotonic_ns();
+
+  pid_t pid;
+  if ((pid = fork()) == -1) {
+    close(fd[0]);
+    close(fd[1]);
+    vs_return(0, "fork(): %s\n", strerror(errno));
+  }
+
+  // The hook's own log (of each absent device) is discarded
+  if (pid == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    dup2(fd[0], STDIN_FILENO);
+    dup2(null, STDERR_FILENO);
+    close(fd[0]);
+    close(fd[1]);
+    execl(path, "qemu", "bench", "prepare", "begin", "-", (char *) NULL);
+    _exit(127);
+  }
+
+  close(fd[0]);
+  size_t length = strlen(text);
+  ssize_t size = write(fd[1], text, length);
+  close(fd[1]);
+
+  int status;
+  if (waitpid(pid, &status, 0) == -1)
+    vs_return(0, "waitpid(): %s\n", strerror(errno));
+  uint64_t duration = vs_monotonic_ns() - start;
+
+  if (size != (ssize_t) length)
+    vs_return(0, "Can't write domain description to hook %s\n", path);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+    vs_return(0, "Hook %s failed in the prepare phase\n", path);
+  return duration;
+}
+
+int compare(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
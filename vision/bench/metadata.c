@@ -0,0 +1,82 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "device.h"
+#include "metadata.h"
+#include "metadata_dom.h"
+#include "trace.h"
+
+/// The number of times that the metadata is parsed and serialized in each
+/// measurement
+#define METADATA_PASS_COUNT 1000
+
+/// Parse the metadata @a text and serialize it with the codec of @a load and
+/// @a dump @c METADATA_PASS_COUNT times and return the microseconds per pass.
+/// On failure this will return a negative number.
+static double measure(const char *text,
+    vs_metadata_t *(*load)(const char *, const char *),
+    char *(*dump)(const vs_metadata_t *))
+  __attribute__((nonnull));
+
+/**
+ * Measure the time to parse and serialize vision metadata with 1, 16, and 256
+ * attachments against the tree and XPath codec that it replaced
+ *
+ * A pass is a load (which serializes the canonical text) and a dump. The
+ * per-attachment log is written to @c /dev/null rather than a terminal.
+ */
+int main(void) {
+  if (freopen("/dev/null", "w", stderr) == NULL)
+    return EXIT_FAILURE;
+
+  static const size_t length_list[] = { 1, 16, 256 };
+
+  printf("%-12s %14s %14s\n", "attachments", "us/pass", "us/pass (dom)");
+  for (size_t i = 0; i < sizeof(length_list) / sizeof(*length_list); i++) {
+    vs_symbol_t attachment_list[length_list[i]];
+    for (size_t j = 0; j < length_list[i]; j++) {
+      attachment_list[j] = (vs_symbol_t) {
+        .subsystem = VS_SUBSYSTEM_PCI,
+        .pci = { .domain = 0, .bus = j, .slot = j % 32, .function = j % 8 },
+      };
+    }
+    vs_metadata_t metadata = {
+      .view = "Bench",
+      .attachment_list = attachment_list,
+      .attachment_list_length = length_list[i],
+    };
+
+    char *text;
+    if ((text = vs_metadata_dump(&metadata)) == NULL)
+      return EXIT_FAILURE;
+
+    double duration = measure(text, vs_metadata_load, vs_metadata_dump);
+    double duration_dom = measure(text, metadata_dom_load, metadata_dom_dump);
+    free(text);
+    if (duration < 0 || duration_dom < 0)
+      return EXIT_FAILURE;
+
+    printf("%-12zu %14.1f %14.1f\n", length_list[i], duration, duration_dom);
+  }
+
+  return EXIT_SUCCESS;
+}
+
+double measure(const char *text,
+    vs_metadata_t *(*load)(const char *, const char *),
+    char *(*dump)(const vs_metadata_t *)) {
+  uint64_t start = vs_monotonic_ns();
+  for (size_t i = 0; i < METADATA_PASS_COUNT; i++) {
+    vs_metadata_t *metadata;
+    if ((metadata = load(text, "bench")) == NULL)
+      return -1;
+    char *update = dump(metadata);
+    vs_metadata_free(metadata);
+    if (update == NULL)
+      return -1;
+    free(update);
+  }
+  return (vs_monotonic_ns() - start) / 1e3 / METADATA_PASS_COUNT;
+}
@@ -0,0 +1,263 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libudev.h>
+#include <libvirt/libvirt.h>
+#include <libxml/parser.h>
+
+#include "arena.h"
+#include "device.h"
+#include "domain.h"
+#include "layout.h"
+#include "metadata.h"
+#include "pool.h"
+#include "status.h"
+#include "trace.h"
+#include "view.h"
+
+/// The URI of the libvirt driver that the benchmark runs against. Each
+/// connection to it in a process shares the same state so the pool's workers
+/// see the domains that are defined here.
+#define POOL_URI "test:///default"
+
+/// The number of workers in the pool (the vision daemon's default)
+#define POOL_WORKER_COUNT 4
+
+/// The number of hot-plug and hot-unplug events in each measurement
+#define POOL_ROUND_COUNT 20
+
+/// The layout of the benchmark: one device in the view of each domain
+static const char layout[] = "[BENCH]\nview = Bench\nprebind = no\n";
+
+/// The domain definition of each benchmark domain
+static const char domain_format[] = "<domain type='test'>"
+  "<name>bench-%zu</name><memory>8192</memory><os><type>hvm</type></os>"
+  "</domain>";
+
+/// Whether a pass of reconciliation is in progress
+static bool reconciling = false;
+
+/// Clear @c reconciling when a pass is done
+static void on_reconcile(void);
+
+/// Run a pass of reconciliation of each pending domain to completion and
+/// return the wall-clock nanoseconds that it took. On failure this will return
+/// @c 0.
+static uint64_t run_pass(void);
+
+/// Define @a length domains in the view of the benchmark device on @a virt
+/// and add each to @c vs_domain_list. On failure this will log to @c stderr and
+/// return @c -1.
+static int define_domain_list(virConnectPtr virt, size_t length)
+  __attribute__((nonnull));
+
+/// Undefine each domain in @c vs_domain_list and clear it
+static void undefine_domain_list(void);
+
+/// Return the first PCI device in udev or @c NULL if there's none
+static struct udev_device *find_actual(struct udev *udev)
+  __attribute__((nonnull));
+
+/**
+ * Measure the wall-clock time from a hot-plug (and hot-unplug) event of a
+ * vision device to the convergence of each domain in its view with 1, 8, and
+ * 32 domains
+ *
+ * This runs against libvirt's @c test:///default driver so no libvirtd is
+ * needed. The event is simulated as on_detect() and on_remove() do it: the
+ * first PCI device in udev is assigned to (or unassigned from) the device and
+ * each domain in its view is marked. The time is to the end of the pass.
+ */
+int main(void) {
+  if (vs_arena_init() == -1)
+    return EXIT_FAILURE;
+  if (virEventRegisterDefaultImpl() == -1)
+    return EXIT_FAILURE;
+  xmlInitParser();
+
+  char layout_path[] = "/tmp/vision-bench-XXXXXX";
+  int fd;
+  if ((fd = mkstemp(layout_path)) == -1)
+    vs_return(EXIT_FAILURE, "mkstemp(): %s\n", strerror(errno));
+  ssize_t size = write(fd, layout, sizeof(layout) - 1);
+  close(fd);
+  if (size != sizeof(layout) - 1)
+    vs_except(layout, "write(): %s\n", strerror(errno));
+
+  if ((vs_device_list = vs_layout_load(layout_path)) == NULL)
+    goto except_layout;
+  if (vs_device_index() == -1)
+    goto except_device_index;
+  if (vs_view_index() == -1)
+    goto except_view_index;
+
+  struct udev *udev;
+  if ((udev = udev_new()) == NULL)
+    vs_except(udev_new, "udev_new(): %s\n", strerror(errno));
+
+  struct udev_device *actual;
+  if ((actual = find_actual(udev)) == NULL)
+    vs_except(actual, "No PCI device to plug\n");
+
+  virConnectPtr virt;
+  if ((virt = virConnectOpen(POOL_URI)) == NULL)
+    goto except_open;
+
+  if (vs_pool_init(POOL_WORKER_COUNT, POOL_URI) == -1)
+    goto except_pool;
+
+  vs_device_t *device = vs_device_list[0];
+  static const size_t length_list[] = { 1, 8, 32 };
+
+  printf("%-8s %14s %14s\n", "domains", "plug (ms)", "unplug (ms)");
+  for (size_t i = 0; i < sizeof(length_list) / sizeof(*length_list); i++) {
+    if (define_domain_list(virt, length_list[i]) == -1)
+      goto except_domain_list;
+
+    // Converge each domain before the first event
+    run_pass();
+
+    uint64_t plug = 0;
+    uint64_t unplug = 0;
+    for (size_t round = 0; round < POOL_ROUND_COUNT; round++) {
+      uint64_t start = vs_monotonic_ns();
+      pthread_rwlock_wrlock(&vs_device_lock);
+      int e = vs_device_assign(device, actual);
+      pthread_rwlock_unlock(&vs_device_lock);
+      if (e == -1)
+        goto except_domain_list;
+      vs_view_mark(device);
+      if (run_pass() == 0)
+        goto except_domain_list;
+      plug += vs_monotonic_ns() - start;
+
+      start = vs_monotonic_ns();
+      pthread_rwlock_wrlock(&vs_device_lock);
+      vs_device_unassign(device);
+      pthread_rwlock_unlock(&vs_device_lock);
+      vs_view_mark(device);
+      if (run_pass() == 0)
+        goto except_domain_list;
+      unplug += vs_monotonic_ns() - start;
+
+      vs_device_reap();
+    }
+
+    printf("%-8zu %14.3f %14.3f\n", length_list[i],
+        plug / 1e6 / POOL_ROUND_COUNT, unplug / 1e6 / POOL_ROUND_COUNT);
+    undefine_domain_list();
+  }
+
+  vs_pool_raze();
+  virConnectClose(virt);
+  udev_device_unref(actual);
+  udev_unref(udev);
+  vs_device_reap();
+  vs_view_raze();
+  vs_device_raze();
+  vs_layout_free(vs_device_list);
+  unlink(layout_path);
+  return EXIT_SUCCESS;
+
+except_domain_list:
+  vs_pool_raze();
+  undefine_domain_list();
+
+except_pool:
+  virConnectClose(virt);
+
+except_open:
+  if (vs_device_list[0]->actual != NULL)
+    vs_device_unassign(vs_device_list[0]);
+  vs_device_reap();
+  udev_device_unref(actual);
+
+except_actual:
+  udev_unref(udev);
+
+except_udev_new:
+  vs_view_raze();
+
+except_view_index:
+  vs_device_raze();
+
+except_device_index:
+  vs_layout_free(vs_device_list);
+
+except_layout:
+  unlink(layout_path);
+  return EXIT_FAILURE;
+}
+
+void on_reconcile(void) {
+  reconciling = false;
+}
+
+uint64_t run_pass(void) {
+  uint64_t start = vs_monotonic_ns();
+  if (vs_domain_reconcile(false, on_reconcile) == 0)
+    return 0;
+
+  reconciling = true;
+  while (reconciling) {
+    if (virEventRunDefaultImpl() == -1)
+      return 0;
+  }
+  return vs_monotonic_ns() - start;
+}
+
+int define_domain_list(virConnectPtr virt, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    char xml[sizeof(domain_format) + 20];
+    snprintf(xml, sizeof(xml), domain_format, i);
+
+    virDomainPtr handle;
+    if ((handle = virDomainDefineXML(virt, xml)) == NULL)
+      vs_return(-1, "Can't define domain \"bench-%zu\"\n", i);
+
+    int e = virDomainSetMetadata(handle, VIR_DOMAIN_METADATA_ELEMENT,
+        "<vision view=\"Bench\"/>", VS_METADATA_KEY, VS_METADATA_URI,
+        VIR_DOMAIN_AFFECT_CONFIG);
+    vs_domain_t *domain = e == -1 ? NULL : vs_domain_add(handle);
+    if (domain == NULL) {
+      virDomainUndefine(handle);
+      virDomainFree(handle);
+      vs_return(-1, "Can't add domain \"bench-%zu\"\n", i);
+    }
+    domain->pending = true;
+    virDomainFree(handle);
+  }
+  return 0;
+}
+
+void undefine_domain_list(void) {
+  for (vs_domain_t *domain = vs_domain_list; domain; domain = domain->next)
+    virDomainUndefine(domain->domain);
+  vs_domain_clear();
+}
+
+struct udev_device *find_actual(struct udev *udev) {
+  struct udev_enumerate *enumerate;
+  if ((enumerate = udev_enumerate_new(udev)) == NULL)
+    return NULL;
+
+  struct udev_device *actual = NULL;
+  if (udev_enumerate_add_match_subsystem(enumerate, "pci") == 0
+      && udev_enumerate_scan_devices(enumerate) == 0) {
+    struct udev_list_entry *entry = udev_enumerate_get_list_entry(enumerate);
+    if (entry != NULL) {
+      actual = udev_device_new_from_syspath(udev,
+          udev_list_entry_get_name(entry));
+    }
+  }
+
+  udev_enumerate_unref(enumerate);
+  return actual;
+}
@@ -0,0 +1,131 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "device.h"
+#include "trace.h"
+#include "symbol_regexp.h"
+
+/// The number of symbols in the benchmark's symbol set
+#define SYMBOL_COUNT 4096
+
+/// The number of passes over the symbol set in each measurement
+#define SYMBOL_PASS_COUNT 256
+
+/// The symbol set (a mix of PCI and USB symbols)
+static vs_symbol_t symbol_list[SYMBOL_COUNT];
+
+/// The serialization of each symbol in the symbol set
+static char text_list[SYMBOL_COUNT][VS_SYMBOL_BUFFER_SIZE];
+
+/// Print the nanoseconds per operation of a measurement from @a start with
+/// @a name and @a checksum
+static void report(const char *name, uint64_t start, uint64_t checksum)
+  __attribute__((nonnull));
+
+/**
+ * Measure the throughput of vs_symbol_load(), vs_symbol_dump(), and
+ * vs_symbol_eq() against the regular expression codec that they replaced
+ *
+ * Each measurement runs @c SYMBOL_PASS_COUNT passes over a fixed set of
+ * @c SYMBOL_COUNT symbols and prints the nanoseconds per operation. A checksum
+ * of the results is printed too so that no pass is optimized away.
+ */
+int main(void) {
+  if (symbol_regexp_init() == -1)
+    return EXIT_FAILURE;
+
+  uint64_t state = 0x9e3779b97f4a7c15;
+  for (size_t i = 0; i < SYMBOL_COUNT; i++) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    if (i % 2 == 0) {
+      symbol_list[i].subsystem = VS_SUBSYSTEM_PCI;
+      symbol_list[i].pci.domain = state >> 48;
+      symbol_list[i].pci.bus = state >> 40;
+      symbol_list[i].pci.slot = state >> 32;
+      symbol_list[i].pci.function = state >> 24;
+    } else {
+      symbol_list[i].subsystem = VS_SUBSYSTEM_USB;
+      symbol_list[i].usb.busnum = state >> 48;
+      symbol_list[i].usb.devnum = state >> 40;
+    }
+    vs_symbol_dump(&symbol_list[i], text_list[i]);
+  }
+
+  uint64_t start;
+  uint64_t checksum;
+  vs_symbol_t symbol;
+  char buffer[VS_SYMBOL_BUFFER_SIZE];
+
+  start = vs_monotonic_ns(), checksum = 0;
+  for (size_t pass = 0; pass < SYMBOL_PASS_COUNT; pass++) {
+    for (size_t i = 0; i < SYMBOL_COUNT; i++) {
+      if (vs_symbol_load(&symbol, text_list[i]) == -1)
+        return EXIT_FAILURE;
+      checksum += vs_symbol_key(&symbol);
+    }
+  }
+  report("load", start, checksum);
+
+  start = vs_monotonic_ns(), checksum = 0;
+  for (size_t pass = 0; pass < SYMBOL_PASS_COUNT; pass++) {
+    for (size_t i = 0; i < SYMBOL_COUNT; i++) {
+      if (symbol_regexp_load(&symbol, text_list[i]) == -1)
+        return EXIT_FAILURE;
+      checksum += vs_symbol_key(&symbol);
+    }
+  }
+  report("load (regexp)", start, checksum);
+
+  start = vs_monotonic_ns(), checksum = 0;
+  for (size_t pass = 0; pass < SYMBOL_PASS_COUNT; pass++) {
+    for (size_t i = 0; i < SYMBOL_COUNT; i++) {
+      vs_symbol_dump(&symbol_list[i], buffer);
+      checksum += buffer[4];
+    }
+  }
+  report("dump", start, checksum);
+
+  start = vs_monotonic_ns(), checksum = 0;
+  for (size_t pass = 0; pass < SYMBOL_PASS_COUNT; pass++) {
+    for (size_t i = 0; i < SYMBOL_COUNT; i++) {
+      symbol_regexp_dump(&symbol_list[i], buffer);
+      checksum += buffer[4];
+    }
+  }
+  report("dump (sprintf)", start, checksum);
+
+  // Compare each symbol to its neighbor so that the result isn't known
+  start = vs_monotonic_ns(), checksum = 0;
+  for (size_t pass = 0; pass < SYMBOL_PASS_COUNT; pass++) {
+    for (size_t i = 0; i < SYMBOL_COUNT; i++) {
+      const vs_symbol_t *a = &symbol_list[i];
+      const vs_symbol_t *b = &symbol_list[(i + pass) % SYMBOL_COUNT];
+      checksum += vs_symbol_eq(a, b);
+    }
+  }
+  report("eq", start, checksum);
+
+  start = vs_monotonic_ns(), checksum = 0;
+  for (size_t pass = 0; pass < SYMBOL_PASS_COUNT; pass++) {
+    for (size_t i = 0; i < SYMBOL_COUNT; i++) {
+      const vs_symbol_t *a = &symbol_list[i];
+      const vs_symbol_t *b = &symbol_list[(i + pass) % SYMBOL_COUNT];
+      checksum += symbol_regexp_eq(a, b);
+    }
+  }
+  report("eq (fieldwise)", start, checksum);
+
+  symbol_regexp_raze();
+  return EXIT_SUCCESS;
+}
+
+void report(const char *name, uint64_t start, uint64_t checksum) {
+  uint64_t duration = vs_monotonic_ns() - start;
+  printf("%-16s %8.1f ns/op (checksum %016" PRIx64 ")\n", name,
+      (double) duration / (SYMBOL_COUNT * SYMBOL_PASS_COUNT), checksum);
+}
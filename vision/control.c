@@ -0,0 +1,551 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <libudev.h>
+#include <libvirt/libvirt.h>
+
+#include "control.h"
+#include "device.h"
+#include "domain.h"
+#include "metadata.h"
+#include "socket.h"
+#include "status.h"
+#include "trace.h"
+#include "view.h"
+
+/// The size of the buffer of a client's command line
+#define CONTROL_LINE_SIZE 1024
+
+/// A client of the control socket
+typedef struct control_client_t {
+  /// The previous client in @c client_list
+  struct control_client_t *prev;
+
+  /// The next client in @c client_list
+  struct control_client_t *next;
+
+  /// The client's connected socket
+  int fd;
+
+  /// The libvirt event loop handle on the @a fd
+  int watch;
+
+  /// The received part of the client's next command line
+  char line[CONTROL_LINE_SIZE];
+
+  /// The number of bytes in the @a line
+  size_t line_length;
+
+  /// Whether the rest of the current line is discarded since it's too long
+  bool discard;
+
+  /// Whether the client closed its side of the socket
+  bool closed;
+
+  /// The replies that aren't sent yet
+  char *output;
+
+  /// The number of bytes in the @a output
+  size_t output_length;
+
+  /// The number of bytes of the @a output that were sent
+  size_t sent;
+
+  /// Whether the client's command is waiting on a pass
+  bool waiting;
+
+  /// Whether the waiting command is on each domain rather than on one
+  bool all;
+
+  /// The UUID of the domain of the waiting command
+  unsigned char uuid[VIR_UUID_BUFLEN];
+
+  /// The view to set on the domain once it isn't busy or @c NULL if it's set
+  char *view;
+
+  /// The time (from vs_monotonic_ms()) when the waiting command was received
+  long start;
+} control_client_t;
+
+/// The first client of the control socket
+static control_client_t *client_list = NULL;
+
+/// The listening socket or @c -1 if the control API isn't served
+static int control_fd = -1;
+
+/// The libvirt event loop handle on @c control_fd
+static int control_watch = -1;
+
+/// The path of the listening socket
+static char *control_path = NULL;
+
+/// The function that starts a pass without the settle window
+static void (*control_reconcile)(void) = NULL;
+
+/// Accept each pending client on the listening socket @a fd. This is a libvirt
+/// event loop handle callback.
+static void on_accept(int watch, int fd, int events, void *opaque);
+
+/// Read the commands of the client in @a opaque and send it the replies. This
+/// is a libvirt event loop handle callback on the client's socket.
+static void on_client(int watch, int fd, int events, void *opaque);
+
+/// Remove the @a client from @c client_list and its handle from the event loop.
+/// It's freed by client_free().
+static void client_drop(control_client_t *client) __attribute__((nonnull));
+
+/// Close the client in @a opaque and free it. This is the libvirt event loop
+/// free callback of a client's handle.
+static void client_free(void *opaque);
+
+/// Run each complete command line that the @a client sent unless a command is
+/// waiting and then update the events that the @a client's handle waits for.
+/// Return whether a pass should be started.
+static bool client_process(control_client_t *client) __attribute__((nonnull));
+
+/// Run the command in the @a line (with no newline) from the @a client. Return
+/// whether a pass should be started.
+static bool client_run(control_client_t *client, char *line)
+  __attribute__((nonnull));
+
+/// Advance the @a client's waiting command. A deferred view is applied once its
+/// domain isn't busy, and the command is answered once the domain (or each
+/// domain) isn't pending or busy. Return whether a pass should be started.
+static bool client_advance(control_client_t *client) __attribute__((nonnull));
+
+/// Append a line from the @a format to the @a client's replies
+static void client_reply(control_client_t *client, const char *format, ...)
+  __attribute__((nonnull, format(printf, 2, 3)));
+
+/// Return the domain in @c vs_domain_list with the @a name or @c NULL if
+/// there's no such domain
+static vs_domain_t *control_domain(const char *name) __attribute__((nonnull));
+
+/**
+ * Set the view of the @a domain to the @a view in its cached metadata and mark
+ * it as pending
+ *
+ * The view is then written to the domain's metadata by its next pass (since
+ * its canonical serialization is changed). The @a domain must not be busy.
+ */
+static void control_view(vs_domain_t *domain, const char *view)
+  __attribute__((nonnull));
+
+int vs_control_open(const char *path, void (*reconcile)(void)) {
+  if ((control_path = strdup(path)) == NULL)
+    vs_return(-1, "strdup(): %s\n", strerror(errno));
+
+  if ((control_fd = vs_socket_listen(path)) == -1)
+    goto except_listen;
+
+  control_watch = virEventAddHandle(control_fd,
+      VIR_EVENT_HANDLE_READABLE, on_accept, NULL, NULL);
+  if (control_watch == -1)
+    vs_except(watch, "Can't watch control socket \"%s\"\n", path);
+
+  control_reconcile = reconcile;
+  return 0;
+
+except_watch:
+  unlink(path);
+  close(control_fd);
+  control_fd = -1;
+
+except_listen:
+  free(control_path);
+  control_path = NULL;
+  return -1;
+}
+
+void vs_control_notify(void) {
+  bool reconcile = false;
+
+  control_client_t *next;
+  for (control_client_t *client = client_list; client; client = next) {
+    next = client->next;
+    if (client->waiting)
+      reconcile |= client_advance(client);
+    reconcile |= client_process(client);
+  }
+
+  if (reconcile)
+    control_reconcile();
+}
+
+void vs_control_close(void) {
+  if (control_fd == -1)
+    return;
+
+  while (client_list != NULL)
+    client_drop(client_list);
+
+  virEventRemoveHandle(control_watch);
+  control_watch = -1;
+  close(control_fd);
+  control_fd = -1;
+
+  unlink(control_path);
+  free(control_path);
+  control_path = NULL;
+}
+
+void on_accept(
+    int watch __attribute__((unused)), int fd,
+    int events __attribute__((unused)), void *opaque __attribute__((unused))) {
+  int client_fd;
+  while ((client_fd = accept4(fd, NULL, NULL,
+          SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+    control_client_t *client;
+    if ((client = calloc(1, sizeof(control_client_t))) == NULL) {
+      fprintf(stderr, "calloc(): %s\n", strerror(errno));
+      close(client_fd);
+      continue;
+    }
+    client->fd = client_fd;
+
+    client->watch = virEventAddHandle(client_fd,
+        VIR_EVENT_HANDLE_READABLE, on_client, client, client_free);
+    if (client->watch == -1) {
+      fprintf(stderr, "Can't watch control client\n");
+      client_free(client);
+      continue;
+    }
+
+    if ((client->next = client_list) != NULL)
+      client_list->prev = client;
+    client_list = client;
+  }
+
+  if (errno != EAGAIN && errno != EWOULDBLOCK)
+    fprintf(stderr, "accept4(): %s\n", strerror(errno));
+}
+
+void on_client(
+    int watch __attribute__((unused)), int fd, int events, void *opaque) {
+  control_client_t *client = opaque;
+
+  // A client that hung up can't be answered
+  if (events & (VIR_EVENT_HANDLE_ERROR | VIR_EVENT_HANDLE_HANGUP)) {
+    client_drop(client);
+    return;
+  }
+
+  // Send as much of the replies as the socket takes and wait for the rest
+  while (client->sent < client->output_length) {
+    ssize_t size = send(fd, client->output + client->sent,
+        client->output_length - client->sent, MSG_NOSIGNAL);
+    if (size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return;
+    if (size == -1) {
+      client_drop(client);
+      return;
+    }
+    client->sent += size;
+  }
+  client->output_length = client->sent = 0;
+
+  while (!client->closed && client->line_length < CONTROL_LINE_SIZE) {
+    ssize_t size = read(fd, client->line + client->line_length,
+        CONTROL_LINE_SIZE - client->line_length);
+    if (size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+    if (size == -1) {
+      client_drop(client);
+      return;
+    }
+    client->closed = size == 0;
+    client->line_length += size;
+  }
+
+  if (client_process(client))
+    control_reconcile();
+}
+
+void client_drop(control_client_t *client) {
+  if (client->prev != NULL)
+    client->prev->next = client->next;
+  else
+    client_list = client->next;
+  if (client->next != NULL)
+    client->next->prev = client->prev;
+  client->prev = client->next = NULL;
+
+  virEventRemoveHandle(client->watch);
+}
+
+void client_free(void *opaque) {
+  control_client_t *client = opaque;
+  close(client->fd);
+  free(client->output);
+  free(client->view);
+  free(client);
+}
+
+bool client_process(control_client_t *client) {
+  bool reconcile = false;
+
+  while (!client->waiting) {
+    char *end = memchr(client->line, '\n', client->line_length);
+
+    // The rest of a line that's too long is discarded
+    if (end == NULL && client->line_length == CONTROL_LINE_SIZE) {
+      if (!client->discard)
+        client_reply(client, "error Command is too long");
+      client->discard = true;
+      client->line_length = 0;
+      continue;
+    }
+    if (end == NULL)
+      break;
+
+    *end = '\0';
+    if (!client->discard)
+      reconcile |= client_run(client, client->line);
+    client->discard = false;
+
+    size_t used = end + 1 - client->line;
+    memmove(client->line, end + 1, client->line_length - used);
+    client->line_length -= used;
+  }
+
+  // A client that's closed is dropped once each of its commands is answered.
+  // No more is read from a client while its command is waiting.
+  if (client->output_length > 0)
+    virEventUpdateHandle(client->watch, VIR_EVENT_HANDLE_WRITABLE);
+  else if (client->closed && !client->waiting)
+    client_drop(client);
+  else if (client->closed || client->waiting)
+    virEventUpdateHandle(client->watch, 0);
+  else
+    virEventUpdateHandle(client->watch, VIR_EVENT_HANDLE_READABLE);
+
+  return reconcile;
+}
+
+bool client_run(control_client_t *client, char *line) {
+  char *save;
+  const char *command = strtok_r(line, " \t\r", &save);
+  const char *argument = strtok_r(NULL, " \t\r", &save);
+  const char *option = strtok_r(NULL, " \t\r", &save);
+  const char *extra = strtok_r(NULL, " \t\r", &save);
+
+  // An empty line is ignored
+  if (command == NULL)
+    return false;
+
+  fprintf(stderr, "Control command \"%s\"\n", command);
+
+  vs_domain_t *domain = NULL;
+
+  if (!strcmp(command, "set-view")) {
+    if (argument == NULL || option == NULL || extra != NULL) {
+      client_reply(client, "error Usage: set-view DOMAIN VIEW");
+      return false;
+    }
+    if ((domain = control_domain(argument)) == NULL) {
+      client_reply(client, "error No domain \"%s\"", argument);
+      return false;
+    }
+    if (domain->current == NULL) {
+      client_reply(client, "error Domain \"%s\" isn't vision managed",
+          argument);
+      return false;
+    }
+    if (vs_view_find(option) == NULL) {
+      client_reply(client, "error No view \"%s\"", option);
+      return false;
+    }
+    if ((client->view = strdup(option)) == NULL) {
+      client_reply(client, "error strdup(): %s", strerror(errno));
+      return false;
+    }
+  } else if (!strcmp(command, "reconcile-now")) {
+    if (option != NULL) {
+      client_reply(client, "error Usage: reconcile-now [DOMAIN]");
+      return false;
+    }
+    if (argument != NULL && (domain = control_domain(argument)) == NULL) {
+      client_reply(client, "error No domain \"%s\"", argument);
+      return false;
+    }
+
+    // A domain that's busy is marked for the next pass
+    for (vs_domain_t *each = vs_domain_list; each; each = each->next) {
+      if (domain == NULL || domain == each)
+        each->pending = true;
+    }
+  } else if (!strcmp(command, "get-state")) {
+    if (option != NULL) {
+      client_reply(client, "error Usage: get-state [DOMAIN]");
+      return false;
+    }
+    if (argument != NULL && (domain = control_domain(argument)) == NULL) {
+      client_reply(client, "error No domain \"%s\"", argument);
+      return false;
+    }
+
+    size_t domain_count = 0;
+    for (vs_domain_t *each = vs_domain_list; each; each = each->next) {
+      if (domain != NULL && domain != each)
+        continue;
+      const char *view = each->current != NULL ? each->current->view : NULL;
+      client_reply(client, "domain \"%s\" managed=%s view=\"%s\" active=%s "
+          "pending=%s busy=%s failed=%s converged=%s",
+          virDomainGetName(each->domain),
+          each->current != NULL ? "yes" : "no", view != NULL ? view : "",
+          each->active ? "yes" : "no", each->pending ? "yes" : "no",
+          each->busy ? "yes" : "no", each->failed ? "yes" : "no",
+          each->digest != 0 ? "yes" : "no");
+      domain_count++;
+    }
+
+    size_t device_count = 0;
+    for (size_t i = 0; domain == NULL && vs_device_list[i] != NULL; i++) {
+      vs_device_t *device = vs_device_list[i];
+      if (device->actual == NULL) {
+        client_reply(client, "device \"%s\" assigned=no", device->name);
+      } else {
+        char symbol_text[VS_SYMBOL_BUFFER_SIZE];
+        vs_symbol_dump(&device->symbol, symbol_text);
+        client_reply(client,
+            "device \"%s\" assigned=yes symbol=\"%s\" syspath=\"%s\"",
+            device->name, symbol_text, udev_device_get_syspath(device->actual));
+      }
+      device_count++;
+    }
+
+    client_reply(client, "ok %zu domain(s) and %zu device(s)",
+        domain_count, device_count);
+    return false;
+  } else {
+    client_reply(client, "error Unknown command \"%s\"", command);
+    return false;
+  }
+
+  // Wait on the pass of the domain (or of each domain)
+  client->waiting = true;
+  client->all = domain == NULL;
+  if (domain != NULL)
+    memcpy(client->uuid, domain->uuid, VIR_UUID_BUFLEN);
+  client->start = vs_monotonic_ms();
+
+  client_advance(client);
+  return client->waiting;
+}
+
+bool client_advance(control_client_t *client) {
+  long elapsed = vs_monotonic_ms() - client->start;
+
+  if (client->all) {
+    size_t failed = 0;
+    for (vs_domain_t *domain = vs_domain_list; domain; domain = domain->next) {
+      if (domain->pending || domain->busy)
+        return false;
+      failed += domain->failed;
+    }
+
+    client->waiting = false;
+    if (failed > 0)
+      client_reply(client, "error %zu domain(s) failed after %ld ms",
+          failed, elapsed);
+    else
+      client_reply(client, "ok Converged after %ld ms", elapsed);
+    return false;
+  }
+
+  vs_domain_t *domain;
+  if ((domain = vs_domain_find(client->uuid)) == NULL) {
+    client->waiting = false;
+    free(client->view);
+    client->view = NULL;
+    client_reply(client, "error Domain was removed after %ld ms", elapsed);
+    return false;
+  }
+
+  // The domain's cached metadata is owned by a worker while it's busy
+  if (client->view != NULL) {
+    if (domain->busy)
+      return false;
+    control_view(domain, client->view);
+    free(client->view);
+    client->view = NULL;
+    return true;
+  }
+
+  if (domain->pending || domain->busy)
+    return false;
+
+  client->waiting = false;
+  if (domain->failed)
+    client_reply(client, "error Domain \"%s\" failed after %ld ms",
+        virDomainGetName(domain->domain), elapsed);
+  else
+    client_reply(client, "ok Domain \"%s\" converged after %ld ms",
+        virDomainGetName(domain->domain), elapsed);
+  return false;
+}
+
+void client_reply(control_client_t *client, const char *format, ...) {
+  va_list list;
+
+  va_start(list, format);
+  char *line;
+  int length = vasprintf(&line, format, list);
+  va_end(list);
+  if (length == -1) {
+    fprintf(stderr, "vasprintf(): %s\n", strerror(errno));
+    return;
+  }
+
+  char *output;
+  if ((output = realloc(client->output,
+          client->output_length + length + 2)) == NULL) {
+    fprintf(stderr, "realloc(): %s\n", strerror(errno));
+    free(line);
+    return;
+  }
+  client->output = output;
+
+  memcpy(output + client->output_length, line, length);
+  output[client->output_length + length] = '\n';
+  client->output_length += length + 1;
+  free(line);
+}
+
+vs_domain_t *control_domain(const char *name) {
+  for (vs_domain_t *domain = vs_domain_list; domain; domain = domain->next) {
+    if (!strcmp(virDomainGetName(domain->domain), name))
+      return domain;
+  }
+  return NULL;
+}
+
+void control_view(vs_domain_t *domain, const char *view) {
+  vs_metadata_t *metadata_list[] = { domain->current, domain->config };
+  for (size_t i = 0; i < 2; i++) {
+    vs_metadata_t *metadata = metadata_list[i];
+    if (metadata == NULL)
+      continue;
+
+    char *copy;
+    if ((copy = strdup(view)) == NULL)
+      vs_continue("strdup(): %s\n", strerror(errno));
+    free(metadata->view);
+    metadata->view = copy;
+  }
+
+  fprintf(stderr, "Domain \"%s\" will be set to view \"%s\"\n",
+      virDomainGetName(domain->domain), view);
+
+  vs_view_set(domain, view);
+  domain->pending = true;
+}
@@ -0,0 +1,45 @@
+#ifndef VS_CONTROL_H
+#define VS_CONTROL_H
+
+/// The path of the control socket
+#define VS_CONTROL_PATH "/run/vision/control"
+
+/**
+ * Serve the control API on a Unix socket at @a path from the libvirt event
+ * loop
+ *
+ * A client sends one command per line and each command is answered in order
+ * with a line of @c "ok" or @c "error" and a message (after any data lines):
+ *
+ * - @c "set-view DOMAIN VIEW" sets the view of the domain with the name
+ *   @c DOMAIN to @c VIEW in its cached metadata and reconciles it at once. The
+ *   view is written to the domain's metadata in the same pass that attaches its
+ *   devices and the command is answered when the pass is done.
+ * - @c "get-state [DOMAIN]" lists each domain (or the domain with the name
+ *   @c DOMAIN) with its view and status and each vision device with its
+ *   assignment.
+ * - @c "reconcile-now [DOMAIN]" marks each domain (or the domain with the name
+ *   @c DOMAIN) as pending and reconciles it at once. The command is answered
+ *   when no domain is pending or in a pass.
+ *
+ * The @a reconcile function is called to start a pass without the settle
+ * window. Each client is served without blocking. On failure this will log to
+ * @c stderr and return @c -1.
+ */
+int vs_control_open(const char *path, void (*reconcile)(void))
+  __attribute__((nonnull));
+
+/**
+ * Advance each command that's waiting on a pass
+ *
+ * This must be called when a pass is done (before the next pass is started) so
+ * that each waiting command sees its domain's outcome. A deferred view change
+ * on a domain that's no longer busy is applied.
+ */
+void vs_control_notify(void);
+
+/// Stop serving the control API and remove the socket. Each client that's
+/// still connected (or waiting on a pass) is disconnected.
+void vs_control_close(void);
+
+#endif /* VS_CONTROL_H */
@@ -11,47 +11,65 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include <regex.h>
+#include <pthread.h>
 
 #include <libudev.h>
 
 #include "device.h"
+#include "metrics.h"
 #include "status.h"
+#include "table.h"
+#include "view.h"
 
 /**
- * The POSIX extended regular expression used to deserialize a PCI symbol
+ * Parse the PCI @a symbol from the null terminated @a text
  *
- * The PCI symbol serialization is @c "PCI-" followed by the @c PCI_SLOT_NAME.
- * Thus this is also used to generate a symbol from a udev device's
- * @c PCI_SLOT_NAME by extracting the domain, bus, slot, and function numbers.
+ * The PCI symbol serialization is @c "PCI-" followed by the @c PCI_SLOT_NAME
+ * and the @a text must not include the @c "PCI-" prefix. Thus this is also used
+ * to generate a symbol from a udev device's @c PCI_SLOT_NAME.
  *
  * Each bus can host up to 32 devices, and a PCI device can have up to eight
  * functions. In more technical terms, a device's location is specified by a
  * 16-bit domain number, an 8-bit bus number, a 5-bit device number and a 3-bit
- * function number.
+ * function number. So the @a text must be exactly four hex digits of the
+ * domain number (0000 - ffff), a @c ':', two hex digits of the bus number
+ * (00 - ff), a @c ':', two hex digits of the slot number (00 - 1f), a @c '.',
+ * and one digit of the function number (0 - 7). Either case of hex digit is
+ * accepted. If the @a text is invalid this will return @c -1 (with no log).
  */
-#define PCI_SYMBOL_REGEXP "^" \
-  "([[:xdigit:]]{4}):"    /* PCI domain number (0000 - ffff) */ \
-  "([[:xdigit:]]{2}):"    /* PCI bus number (00 - ff) */ \
-  "([01][[:xdigit:]])\\." /* PCI slot number (00 - 1f) */ \
-  "([0-7])" "$"           /* PCI function number (0 - 7) */
+static int symbol_parse_pci(vs_symbol_t *symbol, const char *text)
+  __attribute__((nonnull));
 
-// The number of parenthesized subexpressions in PCI_SYMBOL_REGEXP
-#define PCI_SYMBOL_NSUB 4
+/**
+ * Parse the USB @a symbol from the null terminated @a text
+ *
+ * The @a text must not include the @c "USB-" prefix. It must be exactly three
+ * decimal digits of the bus number (000 - 255), a @c ':', and three decimal
+ * digits of the device number (000 - 255). If the @a text is invalid this will
+ * return @c -1 (with no log).
+ */
+static int symbol_parse_usb(vs_symbol_t *symbol, const char *text)
+  __attribute__((nonnull));
 
-/// A POSIX regular expression object initialized from @c PCI_SYMBOL_REGEXP
-static regex_t pci_symbol_regexp;
+/// Read the @a count hex digits at the @a text into the @a number. If any of
+/// them isn't a hex digit then return @c -1.
+static int parse_hex(const char *text, size_t count, unsigned int *number)
+  __attribute__((nonnull));
 
-/// The POSIX extended regular expression used to deserialize a USB symbol
-#define USB_SYMBOL_REGEXP "^" \
-  "([01][[:digit:]]{2}|2[0-4][[:digit:]]|25[0-5]):" /* USB busnum (0 - 255) */ \
-  "([01][[:digit:]]{2}|2[0-4][[:digit:]]|25[0-5])$" /* USB devnum (0 - 255) */
+/// Read the @a count decimal digits at the @a text into the @a number. If any
+/// of them isn't a decimal digit then return @c -1.
+static int parse_dec(const char *text, size_t count, unsigned int *number)
+  __attribute__((nonnull));
 
-// The number of parenthesized subexpressions in USB_SYMBOL_REGEXP
-#define USB_SYMBOL_NSUB 2
+/// Write the @a number as @a count lower case hex digits (zero padded) to the
+/// @a buffer and return the position after the last digit
+static char *format_hex(char *buffer, size_t count, unsigned int number)
+  __attribute__((nonnull));
 
-/// A POSIX regular expression object initialized from @c USB_SYMBOL_REGEXP
-static regex_t usb_symbol_regexp;
+/// Write the @a number as @a count decimal digits (zero padded) to the
+/// @a buffer and return the position after the last digit
+static char *format_dec(char *buffer, size_t count, unsigned int number)
+  __attribute__((nonnull));
 
 /**
  * Generate the @a symbol from the actual udev @a device. On failure this will
@@ -139,25 +157,76 @@ int symbol_load_pci(vs_symbol_t *symbol, const char *text)
 int symbol_load_usb(vs_symbol_t *symbol, const char *text)
   __attribute__((nonnull));
 
-/// Initialize @c pci_symboL_regexp and @c usb_symbol_regexp. On failure this
-/// will exit().
-static void regexp_init(void) __attribute__((constructor));
+/// Retire the @a manifest (if it isn't @c NULL) to free it in vs_device_reap()
+static void device_retire(char *manifest);
+
+vs_device_t **vs_device_list = NULL;
+
+/// The index of each device in @c vs_device_list by its name
+static vs_table_t name_table;
+
+/// The index of each assigned device by the syspath of its actual udev device
+static vs_table_t syspath_table;
 
-/// Free @a pci_symbol_regexp and @c usb_symbol_regexp
-static void regexp_raze(void) __attribute__((destructor));
+/// The index of each assigned device by its symbol's key
+static vs_table_t symbol_table;
+
+/// Each manifest retired by vs_device_unassign() to free in vs_device_reap()
+static char **retire_list = NULL;
+
+/// The number of manifests in the @c retire_list
+static size_t retire_list_length = 0;
+
+pthread_rwlock_t vs_device_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+int vs_device_index(void) {
+  vs_table_raze(&name_table);
+
+  for (size_t i = 0; vs_device_list[i] != NULL; i++) {
+    vs_device_t *device = vs_device_list[i];
+    device->index = i;
+
+    const char *name = device->name;
+    if (vs_table_get(&name_table, name, strlen(name)) != NULL)
+      vs_except(put, "Device name \"%s\" isn't unique\n", name);
+    if (vs_table_put(&name_table, name, strlen(name), device) == -1)
+      goto except_put;
+  }
+
+  return 0;
+
+except_put:
+  vs_table_raze(&name_table);
+  return -1;
+}
+
+void vs_device_raze(void) {
+  vs_table_raze(&name_table);
+  vs_table_raze(&syspath_table);
+  vs_table_raze(&symbol_table);
+}
+
+vs_device_t *vs_device_find(const char *name) {
+  return vs_table_get(&name_table, name, strlen(name));
+}
+
+vs_device_t *vs_device_find_syspath(const char *syspath) {
+  return vs_table_get(&syspath_table, syspath, strlen(syspath));
+}
+
+vs_device_t *vs_device_find_symbol(const vs_symbol_t *symbol) {
+  vs_symbol_key_t key = vs_symbol_key(symbol);
+  return vs_table_get(&symbol_table, &key, sizeof(key));
+}
 
 int vs_device_assign(vs_device_t *device, struct udev_device *actual) {
   if (device->actual != NULL) {
     fprintf(stderr,
         "Assignment to device \"%s\" with assigned udev device \"%s\"\n",
         device->name, udev_device_get_syspath(actual));
-    device->actual = udev_device_unref(device->actual);
+    vs_device_unassign(device);
   }
 
-  const char *name = udev_device_get_property_value(actual, "VISION_NAME");
-  assert(name != NULL);
-  assert(!strcmp(device->name, name));
-
   const char *subsystem;
 
   if ((subsystem = udev_device_get_subsystem(actual)) == NULL)
@@ -166,18 +235,46 @@ int vs_device_assign(vs_device_t *device, struct udev_device *actual) {
 
   if (!strcmp(subsystem, "pci")) {
     if (device_to_symbol_pci(actual, &device->symbol) == -1)
-      return -1;
+      goto except_subsystem;
   } else if (!strcmp(subsystem, "usb")) {
     if (device_to_symbol_usb(actual, &device->symbol) == -1)
-      return -1;
+      goto except_subsystem;
   } else
     vs_except(subsystem, "Can't handle subsystem \"%s\"\n", subsystem);
 
+  const char *syspath = udev_device_get_syspath(actual);
+  if (vs_table_put(&syspath_table, syspath, strlen(syspath), device) == -1)
+    goto except_subsystem;
+
+  vs_symbol_key_t key = vs_symbol_key(&device->symbol);
+  if (vs_table_put(&symbol_table, &key, sizeof(key), device) == -1)
+    vs_except(symbol, "Can't index device \"%s\" by its symbol\n",
+        device->name);
+
+  // Each manifest depends only on the symbol and the xtra so build it once
+  // here rather than in each plan
   device->actual = udev_device_ref(actual);
+  device->attach_manifest = vs_device_manifest(device);
+  device->detach_manifest = vs_symbol_manifest(&device->symbol);
+  if (device->attach_manifest == NULL || device->detach_manifest == NULL)
+    goto except_manifest;
 
+  vs_view_update(device);
+  vs_metrics.assign_count++;
   return 0;
 
+except_manifest:
+  free(device->attach_manifest);
+  free(device->detach_manifest);
+  device->attach_manifest = device->detach_manifest = NULL;
+  device->actual = udev_device_unref(device->actual);
+  vs_table_pop(&symbol_table, &key, sizeof(key));
+
+except_symbol:
+  vs_table_pop(&syspath_table, syspath, strlen(syspath));
+
 except_subsystem:
+  vs_metrics.assign_failure_count++;
   return -1;
 }
 
@@ -188,7 +285,32 @@ void vs_device_unassign(vs_device_t *device) {
         device->name);
     return;
   }
+
+  // Only remove an entry that's still this device's. Another device may have
+  // been assigned the same udev device (or symbol) since.
+  const char *syspath = udev_device_get_syspath(device->actual);
+  if (vs_table_get(&syspath_table, syspath, strlen(syspath)) == device)
+    vs_table_pop(&syspath_table, syspath, strlen(syspath));
+
+  vs_symbol_key_t key = vs_symbol_key(&device->symbol);
+  if (vs_table_get(&symbol_table, &key, sizeof(key)) == device)
+    vs_table_pop(&symbol_table, &key, sizeof(key));
+
+  device_retire(device->attach_manifest);
+  device_retire(device->detach_manifest);
+  device->attach_manifest = device->detach_manifest = NULL;
+
   device->actual = udev_device_unref(device->actual);
+  vs_view_update(device);
+  vs_metrics.unassign_count++;
+}
+
+void vs_device_reap(void) {
+  for (size_t i = 0; i < retire_list_length; i++)
+    free(retire_list[i]);
+  free(retire_list);
+  retire_list = NULL;
+  retire_list_length = 0;
 }
 
 int vs_device_update(vs_device_t *device, struct udev_device *actual) {
@@ -237,25 +359,33 @@ char *vs_symbol_manifest(const vs_symbol_t *symbol) {
 }
 
 bool vs_symbol_eq(const vs_symbol_t *a, const vs_symbol_t *b) {
-  if (a->subsystem != b->subsystem)
-    return false;
+  return vs_symbol_key(a) == vs_symbol_key(b);
+}
 
-  if (a->subsystem == VS_SUBSYSTEM_PCI) {
-    if (a->pci.domain != b->pci.domain)
-      return false;
-    if (a->pci.bus != b->pci.bus)
-      return false;
-    if (a->pci.slot != b->pci.slot)
-      return false;
-    return a->pci.function == b->pci.function;
-  }
+vs_symbol_key_t vs_symbol_key(const vs_symbol_t *symbol) {
+  vs_symbol_key_t key = (vs_symbol_key_t) (symbol->subsystem + 1) << 56;
 
-  if (a->subsystem == VS_SUBSYSTEM_USB)
-    return a->usb.busnum == b->usb.busnum && a->usb.devnum == b->usb.devnum;
+  if (symbol->subsystem == VS_SUBSYSTEM_PCI)
+    return key
+      | (vs_symbol_key_t) symbol->pci.domain << 16
+      | (vs_symbol_key_t) symbol->pci.bus << 8
+      | (vs_symbol_key_t) symbol->pci.slot << 3
+      | (vs_symbol_key_t) symbol->pci.function;
+
+  if (symbol->subsystem == VS_SUBSYSTEM_USB)
+    return key
+      | (vs_symbol_key_t) symbol->usb.busnum << 8
+      | (vs_symbol_key_t) symbol->usb.devnum;
 
   abort(); // Unreachable
 }
 
+int vs_symbol_key_cmp(const void *a, const void *b) {
+  vs_symbol_key_t x = *(const vs_symbol_key_t *) a;
+  vs_symbol_key_t y = *(const vs_symbol_key_t *) b;
+  return (x > y) - (x < y);
+}
+
 void vs_symbol_dump(const vs_symbol_t *symbol, char *buffer) {
   if (symbol->subsystem == VS_SUBSYSTEM_PCI)
     symbol_dump_pci(symbol, buffer);
@@ -289,29 +419,13 @@ int device_to_symbol_pci(struct udev_device *device, vs_symbol_t *symbol) {
         "udev_device_get_property_value(\"%s\", \"PCI_SLOT_NAME\"): %s\n",
         udev_device_get_syspath(device), strerror(errno));
 
-  // Execute the regular expression against the slot name
-  regmatch_t result[PCI_SYMBOL_NSUB + 1];
-  int e;
-  e = regexec(&pci_symbol_regexp, slot_name, PCI_SYMBOL_NSUB + 1, result, 0);
-  if (e != 0) {
-    size_t length = regerror(e, &pci_symbol_regexp, NULL, 0);
-    char buffer[length];
-    regerror(e, &pci_symbol_regexp, buffer, length);
-    vs_except(regexec, "regexec(&pci_symbol_regexp, \"%s\"): %s\n",
-        slot_name, buffer);
-  }
-
-  // We've already validated each number in the slot name through the regular
-  // expression. Each number in the slot name is followed by either a NUL or a
-  // nondigit delimiter.
-  symbol->pci.domain = strtoul(slot_name + result[1].rm_so, NULL, 16);
-  symbol->pci.bus = strtoul(slot_name + result[2].rm_so, NULL, 16);
-  symbol->pci.slot = strtoul(slot_name + result[3].rm_so, NULL, 16);
-  symbol->pci.function = strtoul(slot_name + result[4].rm_so, NULL, 16);
+  // The PCI symbol serialization (without its prefix) is the slot name
+  if (symbol_parse_pci(symbol, slot_name) == -1)
+    vs_except(slot_name, "Can't parse PCI_SLOT_NAME \"%s\" of \"%s\"\n",
+        slot_name, udev_device_get_syspath(device));
 
   return 0;
 
-except_regexec:
 except_slot_name:
   return -1;
 }
@@ -372,6 +486,20 @@ except_number:
   return -1;
 }
 
+void device_retire(char *manifest) {
+  if (manifest == NULL)
+    return;
+
+  char **list = realloc(retire_list, (retire_list_length + 1) * sizeof(char *));
+  if (list == NULL) {
+    // A plan may still borrow the manifest so it can't be freed here
+    fprintf(stderr, "realloc(): %s\n", strerror(errno));
+    return;
+  }
+  retire_list = list;
+  retire_list[retire_list_length++] = manifest;
+}
+
 char *device_manifest_pci(const vs_device_t *device) {
   assert(device->actual != NULL);
   assert(device->symbol.subsystem == VS_SUBSYSTEM_PCI);
@@ -468,89 +596,115 @@ char *symbol_manifest_usb(const vs_symbol_t *symbol) {
 
 void symbol_dump_pci(const vs_symbol_t *symbol, char *buffer) {
   assert(symbol->subsystem == VS_SUBSYSTEM_PCI);
-  sprintf(buffer, "PCI-%04x:%02x:%02x.%d",
-      symbol->pci.domain,
-      symbol->pci.bus,
-      symbol->pci.slot,
-      symbol->pci.function);
+  memcpy(buffer, "PCI-", strlen("PCI-"));
+  buffer = format_hex(buffer + strlen("PCI-"), 4, symbol->pci.domain);
+  *buffer++ = ':';
+  buffer = format_hex(buffer, 2, symbol->pci.bus);
+  *buffer++ = ':';
+  buffer = format_hex(buffer, 2, symbol->pci.slot);
+  *buffer++ = '.';
+  buffer = format_hex(buffer, 1, symbol->pci.function);
+  *buffer = '\0';
 }
 
 void symbol_dump_usb(const vs_symbol_t *symbol, char *buffer) {
   assert(symbol->subsystem == VS_SUBSYSTEM_USB);
-  sprintf(buffer, "USB-%03d:%03d", symbol->usb.busnum, symbol->usb.devnum);
+  memcpy(buffer, "USB-", strlen("USB-"));
+  buffer = format_dec(buffer + strlen("USB-"), 3, symbol->usb.busnum);
+  *buffer++ = ':';
+  buffer = format_dec(buffer, 3, symbol->usb.devnum);
+  *buffer = '\0';
 }
 
 int symbol_load_pci(vs_symbol_t *symbol, const char *text) {
-  symbol->subsystem = VS_SUBSYSTEM_PCI;
+  if (symbol_parse_pci(symbol, text) == -1)
+    vs_return(-1, "Can't load PCI symbol from text \"%s\"\n", text);
+  return 0;
+}
 
-  // Execute the regular expression against the text
-  regmatch_t result[PCI_SYMBOL_NSUB + 1];
-  int e = regexec(&pci_symbol_regexp, text, PCI_SYMBOL_NSUB + 1, result, 0);
-  if (e != 0) {
-    size_t length = regerror(e, &pci_symbol_regexp, NULL, 0);
-    char buffer[length];
-    regerror(e, &pci_symbol_regexp, buffer, length);
-    vs_return(-1, "regexec(&pci_symbol_regexp, \"%s\"): %s\n", text, buffer);
-  }
+int symbol_load_usb(vs_symbol_t *symbol, const char *text) {
+  if (symbol_parse_usb(symbol, text) == -1)
+    vs_return(-1, "Can't load USB symbol from text \"%s\"\n", text);
+  return 0;
+}
+
+int symbol_parse_pci(vs_symbol_t *symbol, const char *text) {
+  unsigned int domain, bus, slot, function;
+
+  // The text is exactly "dddd:bb:ss.f". Each character is checked in order and
+  // a NUL is neither a digit nor a delimiter so a short text is rejected at its
+  // NUL before anything after it is read.
+  if (parse_hex(text, 4, &domain) == -1 || text[4] != ':')
+    return -1;
+  if (parse_hex(text + 5, 2, &bus) == -1 || text[7] != ':')
+    return -1;
+  if (parse_hex(text + 8, 2, &slot) == -1 || text[10] != '.')
+    return -1;
+  if (parse_dec(text + 11, 1, &function) == -1 || text[12] != '\0')
+    return -1;
+  if (slot > 0x1f || function > 7)
+    return -1;
 
-  // We've already validated each number through the regular expression. Each
-  // number in the text is followed by either a NUL or a nondigit delimiter.
-  symbol->pci.domain = strtoul(text + result[1].rm_so, NULL, 16);
-  symbol->pci.bus = strtoul(text + result[2].rm_so, NULL, 16);
-  symbol->pci.slot = strtoul(text + result[3].rm_so, NULL, 16);
-  symbol->pci.function = strtoul(text + result[4].rm_so, NULL, 16);
+  symbol->subsystem = VS_SUBSYSTEM_PCI;
+  symbol->pci.domain = domain;
+  symbol->pci.bus = bus;
+  symbol->pci.slot = slot;
+  symbol->pci.function = function;
 
   return 0;
 }
 
-int symbol_load_usb(vs_symbol_t *symbol, const char *text) {
-  symbol->subsystem = VS_SUBSYSTEM_USB;
+int symbol_parse_usb(vs_symbol_t *symbol, const char *text) {
+  unsigned int busnum, devnum;
 
-  // Execute the regular expression against the text
-  regmatch_t result[USB_SYMBOL_NSUB + 1];
-  int e = regexec(&usb_symbol_regexp, text, USB_SYMBOL_NSUB + 1, result, 0);
-  if (e != 0) {
-    size_t length = regerror(e, &usb_symbol_regexp, NULL, 0);
-    char buffer[length];
-    regerror(e, &usb_symbol_regexp, buffer, length);
-    vs_return(-1, "regexec(&usb_symbol_regexp, \"%s\"): %s\n", text, buffer);
-  }
+  if (parse_dec(text, 3, &busnum) == -1 || text[3] != ':')
+    return -1;
+  if (parse_dec(text + 4, 3, &devnum) == -1 || text[7] != '\0')
+    return -1;
+  if (busnum > UCHAR_MAX || devnum > UCHAR_MAX)
+    return -1;
 
-  // We've already validated each number through the regular expression. Each
-  // number in the text is followed by either a NUL or a nondigit delimiter.
-  symbol->usb.busnum = strtoul(text + result[1].rm_so, NULL, 10);
-  symbol->usb.devnum = strtoul(text + result[2].rm_so, NULL, 10);
+  symbol->subsystem = VS_SUBSYSTEM_USB;
+  symbol->usb.busnum = busnum;
+  symbol->usb.devnum = devnum;
 
   return 0;
 }
 
-static void regexp_init() {
-  int e;
-
-  // Compile PCI_SYMBOL_REGEXP as a POSIX extended regular expression
-  e = regcomp(&pci_symbol_regexp, PCI_SYMBOL_REGEXP, REG_EXTENDED);
-  if (e != 0) {
-    size_t length = regerror(e, &pci_symbol_regexp, NULL, 0);
-    char buffer[length];
-    regerror(e, &pci_symbol_regexp, buffer, length);
-    fprintf(stderr, "regcomp(PCI_SYMBOL_REGEXP): %s\n", buffer);
-    exit(1);
+int parse_hex(const char *text, size_t count, unsigned int *number) {
+  *number = 0;
+  for (size_t i = 0; i < count; i++) {
+    char c = text[i];
+    if (c >= '0' && c <= '9')
+      *number = *number << 4 | (c - '0');
+    else if (c >= 'a' && c <= 'f')
+      *number = *number << 4 | (c - 'a' + 10);
+    else if (c >= 'A' && c <= 'F')
+      *number = *number << 4 | (c - 'A' + 10);
+    else
+      return -1;
   }
-  assert(pci_symbol_regexp.re_nsub == PCI_SYMBOL_NSUB);
-
-  // Compile USB_SYMBOL_REGEXP as a POSIX extended regular expression
-  e = regcomp(&usb_symbol_regexp, USB_SYMBOL_REGEXP, REG_EXTENDED);
-  if (e != 0) {
-    size_t length = regerror(e, &usb_symbol_regexp, NULL, 0);
-    char buffer[length];
-    regerror(e, &usb_symbol_regexp, buffer, length);
-    fprintf(stderr, "regcomp(USB_SYMBOL_REGEXP): %s\n", buffer);
-    exit(1);
+  return 0;
+}
+
+int parse_dec(const char *text, size_t count, unsigned int *number) {
+  *number = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (text[i] < '0' || text[i] > '9')
+      return -1;
+    *number = *number * 10 + (text[i] - '0');
   }
-  assert(usb_symbol_regexp.re_nsub == USB_SYMBOL_NSUB);
+  return 0;
+}
+
+char *format_hex(char *buffer, size_t count, unsigned int number) {
+  for (size_t i = count; i > 0; i--, number >>= 4)
+    buffer[i - 1] = "0123456789abcdef"[number & 0xf];
+  return buffer + count;
 }
 
-static void regexp_raze() {
-  regfree(&pci_symbol_regexp);
-  regfree(&usb_symbol_regexp);
+char *format_dec(char *buffer, size_t count, unsigned int number) {
+  for (size_t i = count; i > 0; i--, number /= 10)
+    buffer[i - 1] = '0' + number % 10;
+  return buffer + count;
 }
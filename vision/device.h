@@ -2,8 +2,14 @@
 #define VS_DEVICE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include <pthread.h>
+
+struct vs_job_t;
+struct vs_view_t;
+
 #define VS_SYMBOL_BUFFER_SIZE sizeof("PCI-0000:00:00.0")
 
 /**
@@ -38,6 +44,33 @@ typedef struct vs_symbol_t {
   };
 } vs_symbol_t;
 
+/**
+ * A canonical packed integer form of a symbol
+ *
+ * The subsystem (plus one) is in the most significant byte and the address is
+ * packed below it: the PCI domain, bus, slot, and function in the low 32 bits
+ * or the USB bus and device number in the low 16 bits. So two symbols are
+ * equivalent iff their keys are equal, a key is never @c 0, and the order of
+ * keys groups each subsystem with its addresses in numeric order.
+ */
+typedef uint64_t vs_symbol_key_t;
+
+/**
+ * The position of a USB device relative to an anchor hub
+ *
+ * A USB device without a serial number can't be told apart from another of its
+ * kind in isolation. So it's identified by the port path from a hub with a
+ * distinct vendor and product instead.
+ */
+typedef struct vs_topology_t {
+  unsigned short vendor;      ///< The @c idVendor of the anchor hub
+  unsigned short product;     ///< The @c idProduct of the anchor hub
+
+  /// The port number on each hub from the anchor hub to the device (separated
+  /// by @c ".") or @c NULL if the device isn't matched by its topology
+  char *port;
+} vs_topology_t;
+
 /**
  * A device defined in the vision system
  *
@@ -56,6 +89,23 @@ typedef struct vs_device_t {
    */
   const char *xtra;
 
+  /// The topology that a USB device is matched by (from udev) in addition to
+  /// its @c VISION_NAME
+  vs_topology_t topology;
+
+  /// Whether the device is bound to vfio-pci as soon as it's assigned (if it's
+  /// a PCI device) rather than when it's first attached to a domain
+  bool prebind;
+
+  /// The duration (in nanoseconds) of the device's last binding to vfio-pci
+  /// with vs_vfio_bind() when it was assigned or @c 0 if it wasn't bound
+  uint64_t prebind_duration;
+
+  /// The job that binds the device to vfio-pci on a worker after it's assigned
+  /// or @c NULL if there's none. While this is set the device isn't in the
+  /// active list of any of its views.
+  struct vs_job_t *prebind_job;
+
   /// The actual udev device assigned to the vision device. If this is @c NULL
   /// the no actual device is assigned to the vision device.
   struct udev_device *actual;
@@ -64,36 +114,97 @@ typedef struct vs_device_t {
   /// unless an actual udev device is assigned to the vision device.
   vs_symbol_t symbol;
 
-  /// The action scheduled on the device for a domain (in initialize_domain())
-  enum {
-    VS_DEVICE_NONE,
-    VS_DEVICE_DETACH,
-    VS_DEVICE_KEEP,
-    VS_DEVICE_ATTACH,
-  } action;
+  /// The manifest (from vs_device_manifest()) to attach the device to a libvirt
+  /// domain. This is built when an actual udev device is assigned and is
+  /// @c NULL otherwise. A plan may borrow it until vs_device_reap().
+  char *attach_manifest;
+
+  /// The manifest (from vs_symbol_manifest()) to detach the device's symbol
+  /// from a libvirt domain. This is built and borrowed like the
+  /// @a attach_manifest.
+  char *detach_manifest;
+
+  /// The view in @c vs_view_list of each name in the @a view_list (terminated
+  /// by @c NULL). This is set by vs_view_index().
+  struct vs_view_t **view_index;
+
+  /// The index of the device in @c vs_device_list. This is set by
+  /// vs_device_index().
+  size_t index;
 
   const char *view_list[];
 } vs_device_t;
 
-/// The global device list
-extern vs_device_t *vs_device_list[];
+/// The global device list (terminated by @c NULL) as loaded from the layout
+/// file with vs_layout_load()
+extern vs_device_t **vs_device_list;
+
+/**
+ * The lock on the actual udev device and symbol of each device in
+ * @c vs_device_list
+ *
+ * The main thread must hold this for writing to assign or unassign a device. A
+ * worker must hold this for reading to read a device's actual udev device or
+ * symbol.
+ */
+extern pthread_rwlock_t vs_device_lock;
+
+/**
+ * Index each device in @c vs_device_list by its name
+ *
+ * A device is also indexed by the syspath of its actual udev device and by its
+ * symbol when it's assigned (and unindexed when it's unassigned) so each of
+ * vs_device_find(), vs_device_find_syspath(), and vs_device_find_symbol() is
+ * O(1). This must be called before any device is assigned. When the
+ * @c vs_device_list is replaced this must be called again to rebuild the name
+ * index. On failure this will log to @c stderr and return @c -1.
+ */
+int vs_device_index(void);
+
+/// Release each index built by vs_device_index(). Each device must already be
+/// unassigned.
+void vs_device_raze(void);
+
+/// Return the device in @c vs_device_list with the @a name or @c NULL if
+/// there's no such device
+vs_device_t *vs_device_find(const char *name) __attribute__((nonnull));
+
+/// Return the device in @c vs_device_list with an assigned udev device with the
+/// @a syspath or @c NULL if there's no such device
+vs_device_t *vs_device_find_syspath(const char *syspath)
+  __attribute__((nonnull));
+
+/**
+ * Return the device in @c vs_device_list with an assigned udev device with the
+ * @a symbol or @c NULL if there's no such device
+ *
+ * A worker must hold @c vs_device_lock for reading to call this.
+ */
+vs_device_t *vs_device_find_symbol(const vs_symbol_t *symbol)
+  __attribute__((nonnull));
 
 /**
  * Assign the @a actual udev device to the vision @a device
  *
- * This will also generate and set the @a device's symbol; if that fails then
- * this will log to @c stderr and return @c -1. If the @a device's name is
- * different from the @a actual udev device's @c VISION_NAME attribute then the
- * behavior is undefined.
+ * This will also generate and set the @a device's symbol and build its
+ * manifests; if that fails then this will log to @c stderr and return @c -1.
+ * The @a actual udev device is matched to the @a device by the caller (by its
+ * @c VISION_NAME or its topology) so it's not checked here.
  *
  * On success this will call udev_device_ref() on @a actual.
  */
 int vs_device_assign(vs_device_t *device, struct udev_device *actual)
   __attribute__((nonnull));
 
-/// Unassign the @a device's udev device
+/// Unassign the @a device's udev device and remove it from the syspath and
+/// symbol indexes. Its manifests are retired until vs_device_reap().
 void vs_device_unassign(vs_device_t *device);
 
+/// Free each manifest retired by vs_device_unassign(). A plan may still borrow
+/// a retired manifest so this must only be called on the main thread when no
+/// pass is in progress.
+void vs_device_reap(void);
+
 /**
  * Change the @a device's actual device to @a actual. This does (in effect) a
  * vs_device_unassign() with a vs_device_assign(). On failure the @a device's
@@ -131,7 +242,16 @@ char *vs_symbol_manifest(const vs_symbol_t *symbol)
 
 /// Return whether the symbols @a a and @a b represent the same host device
 bool vs_symbol_eq(const vs_symbol_t *a, const vs_symbol_t *b)
-  __attribute__((nonnull));
+  __attribute__((nonnull, pure));
+
+/// Return the packed key of the @a symbol
+vs_symbol_key_t vs_symbol_key(const vs_symbol_t *symbol)
+  __attribute__((nonnull, pure));
+
+/// Compare the symbol keys at @a a and @a b. This is suitable for qsort() and
+/// bsearch() on an array of @c vs_symbol_key_t.
+int vs_symbol_key_cmp(const void *a, const void *b)
+  __attribute__((nonnull, pure));
 
 /// Serialize the @a symbol to the @a buffer as a null terminated string. The
 /// @a buffer's size must be at least @c VS_SYMBOL_BUFFER_SIZE.
@@ -0,0 +1,1421 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <libvirt/libvirt.h>
+#include <libxml/tree.h>
+#include <libxml/xpath.h>
+
+#include "arena.h"
+#include "device.h"
+#include "domain.h"
+#include "metadata.h"
+#include "metrics.h"
+#include "pool.h"
+#include "status.h"
+#include "table.h"
+#include "trace.h"
+#include "view.h"
+
+vs_domain_t *vs_domain_list = NULL;
+
+/// The index of each domain in @c vs_domain_list by its UUID
+static vs_table_t domain_table;
+
+/// The first domain in the current pass. Each domain in the pass is linked
+/// through its @a pass_next.
+static vs_domain_t *pass_list = NULL;
+
+/// The number of domains in the current pass or @c 0 if there's no pass
+static size_t pass_length = 0;
+
+/// The number of jobs in the current stage of the pass that aren't done
+static size_t pass_busy = 0;
+
+/// Whether the current stage of the pass is the acquire stage
+static bool pass_acquire = false;
+
+/// The span of the current pass
+static vs_span_t pass_span;
+
+/// The time (from vs_monotonic_ms()) when the current stage was started
+static long stage_start = 0;
+
+/// The number of bytes allocated from the workers' arenas in the current pass
+static size_t pass_arena_size = 0;
+
+/// The function called when the current pass is done
+static void (*pass_done)(void) = NULL;
+
+/// Release the @a domain's libvirt domain, cached metadata, and view
+static void domain_raze(vs_domain_t *domain) __attribute__((nonnull));
+
+/**
+ * Fetch and load the vision metadata of the @a domain with the libvirt
+ * @a option (either @c VIR_DOMAIN_AFFECT_CURRENT or
+ * @c VIR_DOMAIN_AFFECT_CONFIG)
+ *
+ * If the domain isn't vision managed, or its metadata can't be loaded, then
+ * this will return @c NULL.
+ */
+static vs_metadata_t *domain_fetch(vs_domain_t *domain, unsigned int option)
+  __attribute__((nonnull));
+
+/**
+ * Fetch the XML description of the libvirt domain @a handle with the libvirt
+ * @a option
+ *
+ * If @a option is @c VIR_DOMAIN_AFFECT_CONFIG then this is the description of
+ * the domain's persistent config. The returned description should be
+ * free()ed. On failure this will log to @c stderr and return @c NULL.
+ */
+static char *domain_describe(virDomainPtr handle, unsigned int option)
+  __attribute__((nonnull));
+
+/**
+ * Parse the XML description @a text of the domain with the @a name
+ *
+ * This must be called in an arena scope that ends before the next libvirt
+ * call. The returned document should be released with xmlFreeDoc(). On
+ * failure this will log to @c stderr and return @c NULL.
+ */
+static xmlDocPtr domain_parse(const char *text, const char *name)
+  __attribute__((nonnull));
+
+/**
+ * Read the symbol key of each host device in the XML description @a document
+ * of the domain with the @a name
+ *
+ * This reads each subsystem @c hostdev element with a PCI or USB address. The
+ * returned @a hostdev_list is sorted and is allocated from the worker's arena.
+ * Return the number of keys in the @a hostdev_list or on failure log to
+ * @c stderr and return @c -1.
+ */
+static ssize_t domain_hostdev(xmlDocPtr document, const char *name,
+    vs_symbol_key_t **hostdev_list)
+  __attribute__((nonnull));
+
+/// Read the symbol key of the @c hostdev element @a hostdev into @a key. This
+/// is vs_hostdev_symbol() followed by vs_symbol_key().
+static int hostdev_key(xmlNodePtr hostdev, vs_symbol_key_t *key)
+  __attribute__((nonnull));
+
+/**
+ * Read the unsigned number in the @a name attribute of the @a node. The number
+ * may be in any base accepted by strtoul(). On failure (or if the number is
+ * greater than @a limit) this will return @c -1.
+ */
+static int address_number(xmlNodePtr node, const char *name,
+    unsigned long limit, unsigned long *number)
+  __attribute__((nonnull));
+
+/**
+ * Return whether the @a symbol is in the sorted @a hostdev_list with @a length
+ * keys. If @a length is @c -1 then the actual host devices are unknown and
+ * this will return @a unknown. This is O(log n).
+ */
+static bool hostdev_has(const vs_symbol_key_t *hostdev_list, ssize_t length,
+    const vs_symbol_t *symbol, bool unknown)
+  __attribute__((nonnull(3)));
+
+/**
+ * The libvirt calls planned to reconcile a domain with a libvirt option
+ *
+ * A plan is built while the device lock is held and then applied without it so
+ * that a slow libvirt call doesn't block the main thread. Its detachments are
+ * done in the release stage of a pass and its update and attachments are done
+ * in the acquire stage.
+ */
+typedef struct vs_plan_t {
+  /// The libvirt option of each call in the plan
+  unsigned int option;
+
+  /// The metadata that the plan was built against
+  vs_metadata_t *metadata;
+
+  /// The manifest of each device to detach from the domain. Each is borrowed
+  /// from its device or is in the @a scratch_list.
+  const char **detach_list;
+
+  /// The symbol of each device in the @a detach_list (in the same order)
+  vs_symbol_t *detach_symbol_list;
+
+  /// Whether each detachment in the @a detach_list failed (in the same order)
+  bool *detach_failed_list;
+
+  /// The number of manifests in the @a detach_list
+  size_t detach_list_length;
+
+  /// The metadata to set on the domain or @c NULL if it's unchanged
+  char *update;
+
+  /// The manifest of each device to attach to the domain. Each is borrowed
+  /// from its device.
+  const char **attach_list;
+
+  /// The symbol of each device in the @a attach_list (in the same order)
+  vs_symbol_t *attach_symbol_list;
+
+  /// The number of manifests in the @a attach_list
+  size_t attach_list_length;
+
+  /// Each manifest built by the plan itself to detach a symbol that no device
+  /// is assigned
+  char **scratch_list;
+
+  /// The number of manifests in the @a scratch_list
+  size_t scratch_list_length;
+
+  /// The plan that this plan was merged into or @c NULL. The libvirt calls of a
+  /// merged plan are made by the plan that it was merged into.
+  const struct vs_plan_t *merge;
+} vs_plan_t;
+
+/**
+ * Plan the reconciliation of the devices attached to the domain with the
+ * @a name with the libvirt @a option against the @a metadata
+ *
+ * The @a document is the domain's XML description (from domain_parse()) with
+ * the same @a option or @c NULL if it couldn't be fetched.
+ *
+ * Each attachment in the @a metadata that isn't a device in its view is
+ * removed and the @a metadata is dumped to the @a plan's update if its
+ * canonical serialization was changed. The devices in the view are read from
+ * the view's active list so no plan scans @c vs_device_list. A device in the
+ * view that's being prebound isn't in the active list, so its attachment is
+ * kept but it isn't attached. An attachment whose detachment fails is appended
+ * back to the @a metadata by plan_release().
+ *
+ * Both detachment and attachment are diffed against the host devices actually
+ * attached to the domain. An attachment is detached only if it's actually
+ * attached and a device in the view is attached only if it isn't already.
+ *
+ * This must be called in the arena scope of the @a document. The @a plan
+ * should be released with plan_raze(). On failure this will log to @c stderr
+ * and return @c -1.
+ */
+static int domain_plan(const char *name, xmlDocPtr document,
+    vs_metadata_t *metadata, unsigned int option, vs_plan_t *plan)
+  __attribute__((nonnull(1, 3, 5)));
+
+/**
+ * Merge the plan @a b of an active domain's persistent config into the plan
+ * @a a of its live definition if they're the same
+ *
+ * Then the calls of @a a are made with both @c VIR_DOMAIN_AFFECT_LIVE and
+ * @c VIR_DOMAIN_AFFECT_CONFIG and no call of @a b is made. Either plan may
+ * have failed (and been razed) in which case nothing is merged.
+ */
+static void plan_merge(vs_plan_t *a, vs_plan_t *b) __attribute__((nonnull));
+
+/**
+ * Apply the @a plan to the XML description @a document of an inactive domain
+ * with the @a name and set @a text to the description to redefine it from
+ *
+ * Each detached host device is removed from the @a document, each attached
+ * host device is appended to it, and the metadata update replaces its vision
+ * metadata element. So the whole plan is a single libvirt call. If the @a plan
+ * is empty then @a text is set to @c NULL. The @a text is copied from the
+ * arena and should be free()ed. This must be called in the arena scope of the
+ * @a document. On failure this will log to @c stderr and return @c -1.
+ */
+static int plan_rewrite(xmlDocPtr document, const char *name,
+    vs_plan_t *plan, char **text)
+  __attribute__((nonnull));
+
+/**
+ * Redefine the inactive domain with the @a name from the description @a text
+ * (from plan_rewrite()) with the libvirt connection @a virt
+ *
+ * If the domain is redefined then the canonical serialization of the @a plan's
+ * metadata is updated. The @a text is freed and the @a plan is razed either
+ * way. Return whether the redefinition failed.
+ */
+static bool plan_redefine(virConnectPtr virt, const char *name, char *text,
+    vs_plan_t *plan)
+  __attribute__((nonnull));
+
+/**
+ * Do each detachment in the @a plan on the libvirt domain @a handle unless the
+ * @a plan was merged
+ *
+ * The attachment of each failed detachment (in the plan that the @a plan was
+ * merged into if it was merged) is kept with plan_keep(). Return whether any
+ * detachment failed.
+ */
+static bool plan_release(virDomainPtr handle, vs_plan_t *plan)
+  __attribute__((nonnull));
+
+/**
+ * Append the attachment of each failed detachment in the @a failed_list back
+ * to the @a plan's metadata and dump it to the @a plan's update again
+ *
+ * The device is still attached to the domain so the metadata that's set in the
+ * acquire stage must keep its attachment. The failed detachment is retried in
+ * the next pass.
+ */
+static void plan_keep(vs_plan_t *plan, const bool *failed_list)
+  __attribute__((nonnull));
+
+/**
+ * Set the metadata and then do each attachment in the @a plan on the libvirt
+ * domain @a handle
+ *
+ * If the metadata is set then the canonical serialization of the plan's
+ * metadata is updated. If the @a plan was merged then no call is made and its
+ * metadata's canonical serialization is updated along with the plan that it
+ * was merged into. Return whether any libvirt call failed.
+ */
+static bool plan_acquire(virDomainPtr handle, vs_plan_t *plan)
+  __attribute__((nonnull));
+
+/// Free each list, each manifest built by the @a plan, and the update in the
+/// @a plan
+static void plan_raze(vs_plan_t *plan) __attribute__((nonnull));
+
+/// Return the @a domain's handle from the @a worker's own libvirt connection
+/// @a virt or @c NULL if it can't be looked up
+static virDomainPtr domain_handle(
+    vs_domain_t *domain, virConnectPtr virt, size_t worker)
+  __attribute__((nonnull));
+
+/**
+ * Plan the reconciliation of the domain of the @a job and do each detachment
+ * in its plans. This is the @a run function of the release stage.
+ *
+ * An active domain's live definition and persistent config are planned
+ * separately and merged if they're the same. An inactive domain's plan is
+ * applied whole (with plan_redefine()) in this stage since its persistent
+ * config can't contend for a device with another domain.
+ */
+static void domain_release(vs_job_t *job, virConnectPtr virt, size_t worker)
+  __attribute__((nonnull));
+
+/// Set the metadata and do each attachment in the plans of the domain of the
+/// @a job. This is the @a run function of the acquire stage.
+static void domain_acquire(vs_job_t *job, virConnectPtr virt, size_t worker)
+  __attribute__((nonnull));
+
+/// Count the job as done on the main thread. When each job in the stage is
+/// done this advances the pass. This is the @a done function of a domain's job.
+static void domain_done(vs_job_t *job) __attribute__((nonnull));
+
+/// Complete the current pass: release each domain in it, reload each stale
+/// domain, free each dropped domain, and call the pass's done function
+static void pass_complete(void);
+
+/// Mix the FNV-1a hash of the @a size bytes at @a data into the @a digest
+static uint64_t digest_mix(uint64_t digest, const void *data, size_t size);
+
+vs_domain_t *vs_domain_add(virDomainPtr handle) {
+  unsigned char uuid[VIR_UUID_BUFLEN];
+  if (virDomainGetUUID(handle, uuid) == -1)
+    vs_return(NULL, "virDomainGetUUID(\"%s\"): %s\n",
+        virDomainGetName(handle), strerror(errno));
+
+  vs_domain_t *domain;
+  if ((domain = vs_domain_find(uuid)) != NULL)
+    return domain;
+
+  if ((domain = calloc(1, sizeof(vs_domain_t))) == NULL)
+    vs_return(NULL, "calloc(): %s\n", strerror(errno));
+  memcpy(domain->uuid, uuid, VIR_UUID_BUFLEN);
+
+  if (virDomainRef(handle) == -1)
+    vs_except(ref, "virDomainRef(\"%s\"): %s\n",
+        virDomainGetName(handle), strerror(errno));
+  domain->domain = handle;
+
+  if (vs_domain_load(domain) == -1)
+    goto except_load;
+
+  if (vs_table_put(&domain_table, uuid, VIR_UUID_BUFLEN, domain) == -1)
+    goto except_load;
+
+  domain->next = vs_domain_list;
+  if (vs_domain_list != NULL)
+    vs_domain_list->prev = domain;
+  vs_domain_list = domain;
+
+  return domain;
+
+except_load:
+  domain_raze(domain);
+
+except_ref:
+  free(domain);
+  return NULL;
+}
+
+vs_domain_t *vs_domain_find(const unsigned char uuid[VIR_UUID_BUFLEN]) {
+  return vs_table_get(&domain_table, uuid, VIR_UUID_BUFLEN);
+}
+
+vs_domain_t *vs_domain_find_handle(virDomainPtr handle) {
+  unsigned char uuid[VIR_UUID_BUFLEN];
+  if (virDomainGetUUID(handle, uuid) == -1)
+    return NULL;
+  return vs_domain_find(uuid);
+}
+
+void vs_domain_drop(vs_domain_t *domain) {
+  vs_table_pop(&domain_table, domain->uuid, VIR_UUID_BUFLEN);
+
+  if (domain->prev != NULL)
+    domain->prev->next = domain->next;
+  else
+    vs_domain_list = domain->next;
+  if (domain->next != NULL)
+    domain->next->prev = domain->prev;
+  domain->prev = domain->next = NULL;
+
+  vs_view_set(domain, NULL);
+
+  // A worker is using the domain so it's freed when its job is done
+  if (domain->busy) {
+    domain->dropped = true;
+    return;
+  }
+
+  domain_raze(domain);
+  free(domain);
+}
+
+void vs_domain_clear(void) {
+  while (vs_domain_list != NULL)
+    vs_domain_drop(vs_domain_list);
+  vs_table_raze(&domain_table);
+}
+
+int vs_domain_load(vs_domain_t *domain) {
+  if (domain->busy) {
+    domain->stale = true;
+    return 0;
+  }
+
+  int e;
+  if ((e = virDomainIsActive(domain->domain)) == -1)
+    vs_return(-1, "virDomainIsActive(\"%s\"): %s\n",
+        virDomainGetName(domain->domain), strerror(errno));
+  bool active = e == 1;
+
+  // The autostart mark only orders the first reconciliation so a failure here
+  // isn't fatal
+  int autostart;
+  if (virDomainGetAutostart(domain->domain, &autostart) == -1)
+    autostart = 0;
+  domain->autostart = autostart != 0;
+
+  vs_metadata_t *current = domain_fetch(domain, VIR_DOMAIN_AFFECT_CURRENT);
+  vs_metadata_t *config = NULL;
+  if (active)
+    config = domain_fetch(domain, VIR_DOMAIN_AFFECT_CONFIG);
+
+  bool change = active != domain->active
+    || !vs_metadata_eq(current, domain->current)
+    || !vs_metadata_eq(config, domain->config);
+
+  vs_metadata_free(domain->current);
+  vs_metadata_free(domain->config);
+  domain->current = current;
+  domain->config = config;
+  domain->active = active;
+
+  if (current != NULL && current->view != NULL)
+    fprintf(stderr, "Domain \"%s\" is configured with view \"%s\"\n",
+        virDomainGetName(domain->domain), current->view);
+  else if (current != NULL)
+    fprintf(stderr, "Domain \"%s\" is configured with no view \n",
+        virDomainGetName(domain->domain));
+
+  // Track the domain in its view so that a change to a vision device in the
+  // view will trigger its reconciliation
+  vs_view_set(domain, current != NULL ? current->view : NULL);
+
+  return change;
+}
+
+ssize_t vs_domain_reconcile(bool priority, void (*done)(void)) {
+  // Each pending domain is reconciled in the next pass
+  if (pass_length > 0)
+    return 0;
+
+  // No plan borrows a manifest between passes
+  vs_device_reap();
+
+  vs_domain_t **tail = &pass_list;
+  for (vs_domain_t *domain = vs_domain_list; domain; domain = domain->next) {
+    if (!domain->pending)
+      continue;
+    if (priority && !domain->autostart && !domain->active)
+      continue;
+    domain->pending = false;
+    domain->failed = false;
+    domain->digest = 0;
+
+    if (domain->handle_list == NULL) {
+      domain->handle_list = calloc(vs_pool_size, sizeof(virDomainPtr));
+      if (domain->handle_list == NULL)
+        vs_continue("calloc(): %s\n", strerror(errno));
+    }
+
+    if (domain->plan_list == NULL) {
+      if ((domain->plan_list = calloc(2, sizeof(vs_plan_t))) == NULL)
+        vs_continue("calloc(): %s\n", strerror(errno));
+    }
+
+    fprintf(stderr, "Reconciliation of domain \"%s\"\n",
+        virDomainGetName(domain->domain));
+
+    domain->busy = true;
+    domain->pass_next = NULL;
+    *tail = domain;
+    tail = &domain->pass_next;
+    pass_length++;
+  }
+
+  if (pass_length == 0)
+    return 0;
+
+  pass_done = done;
+  pass_acquire = false;
+  pass_span = vs_span_begin(VS_STAGE_RECONCILE, NULL, NULL);
+  stage_start = vs_monotonic_ms();
+  pass_arena_size = 0;
+
+  // Release stage: plan each domain and do each detachment
+  for (vs_domain_t *domain = pass_list; domain; domain = domain->pass_next) {
+    domain->job.run = domain_release;
+    domain->job.done = domain_done;
+    pass_busy++;
+    vs_pool_submit(&domain->job);
+  }
+
+  return pass_length;
+}
+
+void domain_raze(vs_domain_t *domain) {
+  vs_view_set(domain, NULL);
+  vs_metadata_free(domain->current);
+  vs_metadata_free(domain->config);
+  domain->current = domain->config = NULL;
+  if (domain->domain != NULL)
+    virDomainFree(domain->domain);
+  domain->domain = NULL;
+
+  for (size_t i = 0; domain->handle_list != NULL && i < vs_pool_size; i++) {
+    if (domain->handle_list[i] != NULL)
+      virDomainFree(domain->handle_list[i]);
+  }
+  free(domain->handle_list);
+  domain->handle_list = NULL;
+
+  if (domain->plan_list != NULL) {
+    plan_raze(&domain->plan_list[0]);
+    plan_raze(&domain->plan_list[1]);
+  }
+  free(domain->plan_list);
+  domain->plan_list = NULL;
+}
+
+vs_metadata_t *domain_fetch(vs_domain_t *domain, unsigned int option) {
+  const char *name = virDomainGetName(domain->domain);
+
+  vs_span_t span = vs_span_begin(VS_STAGE_METADATA_FETCH, name, NULL);
+  char *text = virDomainGetMetadata(domain->domain,
+      VIR_DOMAIN_METADATA_ELEMENT, VS_METADATA_URI, option);
+  vs_span_end(&span);
+
+  // The absence of vision metadata isn't a failure
+  vs_metrics_call(VS_CALL_GET_METADATA,
+      text != NULL || virGetLastErrorCode() == VIR_ERR_NO_DOMAIN_METADATA);
+
+  // This isn't a vision managed domain
+  if (text == NULL)
+    return NULL;
+
+  // The metadata is copied out of each XML object so they're all released
+  // with the arena scope
+  span = vs_span_begin(VS_STAGE_METADATA_PARSE, name, NULL);
+  vs_arena_begin();
+  vs_metadata_t *metadata = vs_metadata_load(text, name);
+  vs_arena_end();
+  vs_span_end(&span);
+  free(text);
+
+  return metadata;
+}
+
+int domain_plan(const char *name, xmlDocPtr document,
+    vs_metadata_t *metadata, unsigned int option, vs_plan_t *plan) {
+  const char *view = metadata->view;
+
+  vs_span_t span = vs_span_begin(VS_STAGE_PLAN, name, NULL);
+
+  memset(plan, 0, sizeof(vs_plan_t));
+  plan->option = option;
+  plan->metadata = metadata;
+
+  // Should the domain's metadata be updated?
+  bool update_metadata = metadata->canonical == NULL;
+
+  // If the actual host devices are unknown then fall back to a detachment of
+  // each removed attachment and an attachment of each device in the view
+  vs_symbol_key_t *hostdev_list = NULL;
+  ssize_t hostdev_list_length = -1;
+  if (document != NULL)
+    hostdev_list_length = domain_hostdev(document, name, &hostdev_list);
+
+  pthread_rwlock_rdlock(&vs_device_lock);
+
+  // The assigned devices in the view are the target of the plan whatever view
+  // the domain was set to before. A domain with no view (or with a view that
+  // no device is in) has no target.
+  vs_view_t *target = vs_view_find(view);
+  vs_device_t *const *active_list = NULL;
+  size_t active_list_length = 0;
+  if (target != NULL) {
+    active_list = target->active_list;
+    active_list_length = target->active_list_length;
+  }
+
+  // Whether each device in the active list is kept (from detachment)
+  bool *kept;
+  if ((kept = vs_arena_alloc((active_list_length + 1) * sizeof(bool))) == NULL)
+    goto except_list;
+
+  plan->detach_list = calloc(
+      metadata->attachment_list_length + 1, sizeof(char *));
+  plan->detach_symbol_list = calloc(
+      metadata->attachment_list_length + 1, sizeof(vs_symbol_t));
+  plan->detach_failed_list = calloc(
+      metadata->attachment_list_length + 1, sizeof(bool));
+  plan->scratch_list = calloc(
+      metadata->attachment_list_length + 1, sizeof(char *));
+  plan->attach_list = calloc(active_list_length + 1, sizeof(char *));
+  plan->attach_symbol_list = calloc(
+      active_list_length + 1, sizeof(vs_symbol_t));
+  if (plan->detach_list == NULL || plan->detach_symbol_list == NULL
+      || plan->detach_failed_list == NULL || plan->scratch_list == NULL
+      || plan->attach_list == NULL || plan->attach_symbol_list == NULL)
+    vs_except(list, "calloc(): %s\n", strerror(errno));
+
+  // Loop through each vision managed device in the domain's metadata. Each
+  // attachment that's kept is compacted to the front of the attachment list.
+  size_t keep = 0;
+  for (size_t i = 0; i < metadata->attachment_list_length; i++) {
+    vs_symbol_t *symbol = &metadata->attachment_list[i];
+
+    char symbol_text[VS_SYMBOL_BUFFER_SIZE];
+    vs_symbol_dump(symbol, symbol_text);
+
+    bool detach = true;
+
+    // Determine if this device should be detached from the domain from the
+    // vision device (if any) that's assigned the symbol
+    vs_device_t *device = vs_device_find_symbol(symbol);
+    if (device != NULL) {
+      fprintf(stderr, "Attachment \"%s\" is device \"%s\"\n",
+          symbol_text, device->name);
+
+      // Don't detach this device if a vision device is active in the view
+      for (size_t j = 0; detach && j < active_list_length; j++) {
+        if (active_list[j] == device) {
+          kept[j] = true;
+          detach = false;
+        }
+      }
+
+      // A device that's being prebound is out of the active list until it's
+      // bound. If it's in the view then its attachment is kept (but it isn't
+      // attached anywhere new).
+      for (size_t j = 0; detach && device->prebind_job != NULL
+          && target != NULL && j < target->member_list_length; j++) {
+        if (target->member_list[j] == device) {
+          fprintf(stderr, "Device \"%s\" is being prebound in view \"%s\"\n",
+              device->name, view);
+          detach = false;
+        }
+      }
+
+      if (!detach) {
+        fprintf(stderr, "Device \"%s\" is active in view \"%s\"\n",
+            device->name, view);
+      } else {
+        fprintf(stderr, "Device \"%s\" is inactive in view \"%s\"\n",
+            device->name, view);
+      }
+    }
+
+    // This device shouldn't be detached. Move on to the next symbol.
+    if (!detach) {
+      metadata->attachment_list[keep++] = *symbol;
+      continue;
+    }
+
+    update_metadata = true;
+
+    // The attachment was already detached from the domain (by someone else)
+    // so just remove it from the domain's vision metadata
+    if (!hostdev_has(hostdev_list, hostdev_list_length, symbol, true)) {
+      fprintf(stderr, "Attachment \"%s\" is absent from domain \"%s\"\n",
+          symbol_text, name);
+      continue;
+    }
+
+    fprintf(stderr, "Attachment \"%s\" will be detached from domain \"%s\"\n",
+        symbol_text, name);
+
+    // Detach the device. Do a detach-device in libvirt and then remove it
+    // from the domain's vision metadata. The manifest is borrowed from the
+    // device that's assigned the symbol if there is one.
+    const char *manifest = device != NULL ? device->detach_manifest : NULL;
+    if (manifest == NULL && (manifest = vs_symbol_manifest(symbol)) != NULL)
+      plan->scratch_list[plan->scratch_list_length++] = (char *) manifest;
+    if (manifest != NULL) {
+      plan->detach_symbol_list[plan->detach_list_length] = *symbol;
+      plan->detach_list[plan->detach_list_length++] = manifest;
+    }
+  }
+  metadata->attachment_list_length = keep;
+
+  // Loop through each assigned device in the view to determine if this device
+  // should be attached to the domain
+  for (size_t i = 0; i < active_list_length; i++) {
+    vs_device_t *device = active_list[i];
+
+    // If this device is kept (from detachment) then don't append a duplicate
+    // attachment to the vision metadata
+    if (!kept[i]) {
+      fprintf(stderr, "Device \"%s\" will be attached to domain \"%s\"\n",
+          device->name, name);
+
+      if (vs_metadata_attach(metadata, &device->symbol) == -1)
+        continue;
+      update_metadata = true;
+    }
+
+    // Do an attach-device on each kept or attached device unless it's already
+    // attached to the domain
+    if (hostdev_has(hostdev_list, hostdev_list_length, &device->symbol, false))
+      continue;
+
+    plan->attach_symbol_list[plan->attach_list_length] = device->symbol;
+    plan->attach_list[plan->attach_list_length++] = device->attach_manifest;
+  }
+
+  pthread_rwlock_unlock(&vs_device_lock);
+
+  // The metadata may have changed (from either detachment or attachment). It's
+  // only updated on the domain if its canonical serialization was changed.
+  if (update_metadata && (plan->update = vs_metadata_dump(metadata)) != NULL) {
+    if (metadata->canonical != NULL
+        && !strcmp(plan->update, metadata->canonical)) {
+      free(plan->update);
+      plan->update = NULL;
+    }
+  }
+
+  vs_span_end(&span);
+  return 0;
+
+except_list:
+  pthread_rwlock_unlock(&vs_device_lock);
+  plan_raze(plan);
+  vs_span_end(&span);
+  return -1;
+}
+
+void plan_merge(vs_plan_t *a, vs_plan_t *b) {
+  if (a->metadata == NULL || b->metadata == NULL)
+    return;
+
+  if (a->detach_list_length != b->detach_list_length
+      || a->attach_list_length != b->attach_list_length)
+    return;
+  if ((a->update == NULL) != (b->update == NULL))
+    return;
+  if (a->update != NULL && strcmp(a->update, b->update))
+    return;
+
+  for (size_t i = 0; i < a->detach_list_length; i++) {
+    if (strcmp(a->detach_list[i], b->detach_list[i]))
+      return;
+  }
+  for (size_t i = 0; i < a->attach_list_length; i++) {
+    if (strcmp(a->attach_list[i], b->attach_list[i]))
+      return;
+  }
+
+  a->option = VIR_DOMAIN_AFFECT_LIVE | VIR_DOMAIN_AFFECT_CONFIG;
+  b->merge = a;
+}
+
+int plan_rewrite(xmlDocPtr document, const char *name,
+    vs_plan_t *plan, char **text) {
+  *text = NULL;
+
+  // The domain is already reconciled
+  if (plan->detach_list_length == 0 && plan->attach_list_length == 0
+      && plan->update == NULL)
+    return 0;
+
+  xmlNodePtr root = xmlDocGetRootElement(document);
+  xmlNodePtr devices = NULL;
+  xmlNodePtr metadata = NULL;
+  for (xmlNodePtr node = root != NULL ? root->children : NULL; node;
+      node = node->next) {
+    if (node->type != XML_ELEMENT_NODE)
+      continue;
+    if (xmlStrEqual(node->name, BAD_CAST "devices"))
+      devices = node;
+    else if (xmlStrEqual(node->name, BAD_CAST "metadata"))
+      metadata = node;
+  }
+  if (devices == NULL)
+    vs_except(rewrite, "No <devices> element in domain \"%s\"\n", name);
+
+  // Remove each detached host device
+  vs_symbol_key_t *detach_key_list;
+  detach_key_list = vs_arena_alloc(
+      (plan->detach_list_length + 1) * sizeof(vs_symbol_key_t));
+  if (detach_key_list == NULL)
+    goto except_rewrite;
+  for (size_t i = 0; i < plan->detach_list_length; i++)
+    detach_key_list[i] = vs_symbol_key(&plan->detach_symbol_list[i]);
+  qsort(detach_key_list, plan->detach_list_length,
+      sizeof(vs_symbol_key_t), vs_symbol_key_cmp);
+  xmlNodePtr next;
+  for (xmlNodePtr node = devices->children; node; node = next) {
+    next = node->next;
+
+    vs_symbol_key_t key;
+    if (node->type != XML_ELEMENT_NODE
+        || !xmlStrEqual(node->name, BAD_CAST "hostdev")
+        || hostdev_key(node, &key) == -1)
+      continue;
+
+    if (bsearch(&key, detach_key_list, plan->detach_list_length,
+          sizeof(vs_symbol_key_t), vs_symbol_key_cmp) != NULL) {
+      xmlUnlinkNode(node);
+      xmlFreeNode(node);
+    }
+  }
+
+  // Append each attached host device
+  for (size_t i = 0; i < plan->attach_list_length; i++) {
+    xmlDocPtr manifest = xmlReadDoc(BAD_CAST plan->attach_list[i], name,
+        NULL, XML_PARSE_NOBLANKS | XML_PARSE_NOCDATA);
+    if (manifest == NULL)
+      vs_except(rewrite, "Can't load manifest \"%s\"\n", plan->attach_list[i]);
+
+    xmlNodePtr hostdev = xmlDocCopyNode(
+        xmlDocGetRootElement(manifest), document, 1);
+    xmlFreeDoc(manifest);
+    if (hostdev == NULL || xmlAddChild(devices, hostdev) == NULL)
+      vs_except(rewrite, "Can't append host device to domain \"%s\"\n", name);
+  }
+
+  // Replace the vision metadata element. As in virDomainSetMetadata() the
+  // namespace is set on just the element itself.
+  if (plan->update != NULL) {
+    if (metadata == NULL && (metadata = xmlNewChild(
+            root, NULL, BAD_CAST "metadata", NULL)) == NULL)
+      vs_except(rewrite, "Can't create <metadata> in domain \"%s\"\n", name);
+
+    for (xmlNodePtr node = metadata->children; node; node = next) {
+      next = node->next;
+      if (node->ns != NULL
+          && xmlStrEqual(node->ns->href, BAD_CAST VS_METADATA_URI)) {
+        xmlUnlinkNode(node);
+        xmlFreeNode(node);
+      }
+    }
+
+    xmlDocPtr update = xmlReadDoc(BAD_CAST plan->update, name,
+        NULL, XML_PARSE_NOBLANKS | XML_PARSE_NOCDATA);
+    if (update == NULL)
+      vs_except(rewrite, "Can't load vision metadata update\n");
+
+    xmlNodePtr vision = xmlDocCopyNode(
+        xmlDocGetRootElement(update), document, 1);
+    xmlFreeDoc(update);
+    if (vision == NULL || xmlAddChild(metadata, vision) == NULL)
+      vs_except(rewrite, "Can't set vision metadata in domain \"%s\"\n", name);
+
+    xmlNsPtr ns;
+    if ((ns = xmlNewNs(vision,
+            BAD_CAST VS_METADATA_URI, BAD_CAST VS_METADATA_KEY)) == NULL)
+      vs_except(rewrite, "Can't set vision namespace in domain \"%s\"\n", name);
+    xmlSetNs(vision, ns);
+  }
+
+  // The dump is from the arena so it's copied out of it
+  xmlChar *dump;
+  int size;
+  xmlDocDumpMemory(document, &dump, &size);
+  if (dump == NULL)
+    vs_except(rewrite, "Can't dump XML description of domain \"%s\"\n", name);
+  if ((*text = strdup((const char *) dump)) == NULL)
+    vs_except(rewrite, "strdup(): %s\n", strerror(errno));
+  xmlFree(dump);
+  return 0;
+
+except_rewrite:
+  return -1;
+}
+
+bool plan_redefine(virConnectPtr virt, const char *name, char *text,
+    vs_plan_t *plan) {
+  fprintf(stderr, "Domain \"%s\" will be redefined with %zu detachment(s) "
+      "and %zu attachment(s)\n",
+      name, plan->detach_list_length, plan->attach_list_length);
+
+  vs_span_t span = vs_span_begin(VS_STAGE_REDEFINE, name, NULL);
+  virDomainPtr handle = virDomainDefineXML(virt, text);
+  vs_span_end(&span);
+  vs_metrics_call(VS_CALL_DEFINE, handle != NULL);
+  free(text);
+  if (handle == NULL) {
+    fprintf(stderr, "Can't redefine domain \"%s\"\n", name);
+    plan_raze(plan);
+    return true;
+  }
+  virDomainFree(handle);
+
+  if (plan->update != NULL) {
+    free(plan->metadata->canonical);
+    plan->metadata->canonical = plan->update;
+    plan->update = NULL;
+  }
+
+  plan_raze(plan);
+  return false;
+}
+
+bool plan_release(virDomainPtr handle, vs_plan_t *plan) {
+  // The plan that this was merged into made each call (and already kept its
+  // own attachments) but this plan's metadata must keep them too
+  if (plan->merge != NULL) {
+    plan_keep(plan, plan->merge->detach_failed_list);
+    return false;
+  }
+
+  const char *name = virDomainGetName(handle);
+
+  bool failed = false;
+  for (size_t i = 0; i < plan->detach_list_length; i++) {
+    char symbol_text[VS_SYMBOL_BUFFER_SIZE];
+    vs_symbol_dump(&plan->detach_symbol_list[i], symbol_text);
+
+    vs_span_t span = vs_span_begin(VS_STAGE_DETACH, name, symbol_text);
+    int e = virDomainDetachDeviceFlags(
+        handle, plan->detach_list[i], plan->option);
+    vs_span_end(&span);
+    vs_metrics_call(VS_CALL_DETACH, e == 0);
+    if (e == -1) {
+      plan->detach_failed_list[i] = true;
+      failed = true;
+    }
+  }
+
+  if (failed)
+    plan_keep(plan, plan->detach_failed_list);
+  return failed;
+}
+
+void plan_keep(vs_plan_t *plan, const bool *failed_list) {
+  bool keep = false;
+  for (size_t i = 0; i < plan->detach_list_length; i++) {
+    if (!failed_list[i])
+      continue;
+
+    char symbol_text[VS_SYMBOL_BUFFER_SIZE];
+    vs_symbol_dump(&plan->detach_symbol_list[i], symbol_text);
+    fprintf(stderr, "Attachment \"%s\" is kept after its detachment failed\n",
+        symbol_text);
+
+    if (vs_metadata_attach(plan->metadata, &plan->detach_symbol_list[i]) == 0)
+      keep = true;
+  }
+  if (!keep)
+    return;
+
+  // The metadata is only updated on the domain if its canonical serialization
+  // is still changed
+  free(plan->update);
+  plan->update = vs_metadata_dump(plan->metadata);
+  if (plan->update != NULL && plan->metadata->canonical != NULL
+      && !strcmp(plan->update, plan->metadata->canonical)) {
+    free(plan->update);
+    plan->update = NULL;
+  }
+}
+
+bool plan_acquire(virDomainPtr handle, vs_plan_t *plan) {
+  // The metadata was set if the update of the plan that this was merged into
+  // was consumed
+  if (plan->merge != NULL) {
+    if (plan->update != NULL && plan->merge->update == NULL) {
+      free(plan->metadata->canonical);
+      plan->metadata->canonical = plan->update;
+      plan->update = NULL;
+    }
+    return false;
+  }
+
+  const char *name = virDomainGetName(handle);
+  bool failed = false;
+
+  // Update the metadata on the domain *after* all detachments (in each domain)
+  // and *before* all attachments
+  if (plan->update != NULL) {
+    fprintf(stderr, "Metadata in domain \"%s\" will be updated to:\n%s",
+        name, plan->update);
+
+    free(plan->metadata->canonical);
+    plan->metadata->canonical = NULL;
+
+    vs_span_t span = vs_span_begin(VS_STAGE_METADATA_WRITE, name, NULL);
+    int e = virDomainSetMetadata(handle, VIR_DOMAIN_METADATA_ELEMENT,
+        plan->update, VS_METADATA_KEY, VS_METADATA_URI, plan->option);
+    vs_span_end(&span);
+    vs_metrics_call(VS_CALL_SET_METADATA, e == 0);
+
+    if (e == 0) {
+      plan->metadata->canonical = plan->update;
+      plan->update = NULL;
+    } else {
+      failed = true;
+    }
+  }
+
+  for (size_t i = 0; i < plan->attach_list_length; i++) {
+    char symbol_text[VS_SYMBOL_BUFFER_SIZE];
+    vs_symbol_dump(&plan->attach_symbol_list[i], symbol_text);
+
+    vs_span_t span = vs_span_begin(VS_STAGE_ATTACH, name, symbol_text);
+    int e = virDomainAttachDeviceFlags(
+        handle, plan->attach_list[i], plan->option);
+    vs_span_end(&span);
+    vs_metrics_call(VS_CALL_ATTACH, e == 0);
+    if (e == -1)
+      failed = true;
+  }
+
+  return failed;
+}
+
+void plan_raze(vs_plan_t *plan) {
+  free(plan->detach_list);
+  free(plan->detach_symbol_list);
+  free(plan->detach_failed_list);
+  for (size_t i = 0; i < plan->scratch_list_length; i++)
+    free(plan->scratch_list[i]);
+  free(plan->scratch_list);
+  free(plan->attach_list);
+  free(plan->attach_symbol_list);
+  free(plan->update);
+  memset(plan, 0, sizeof(vs_plan_t));
+}
+
+virDomainPtr domain_handle(
+    vs_domain_t *domain, virConnectPtr virt, size_t worker) {
+  // Each worker has its own handle on the domain from its own connection
+  if (domain->handle_list[worker] == NULL) {
+    domain->handle_list[worker] = virDomainLookupByUUID(virt, domain->uuid);
+    vs_metrics_call(VS_CALL_LOOKUP, domain->handle_list[worker] != NULL);
+  }
+  return domain->handle_list[worker];
+}
+
+void domain_release(vs_job_t *job, virConnectPtr virt, size_t worker) {
+  vs_domain_t *domain;
+  domain = (vs_domain_t *) ((char *) job - offsetof(vs_domain_t, job));
+
+  virDomainPtr handle;
+  if ((handle = domain_handle(domain, virt, worker)) == NULL) {
+    domain->failed = true;
+    return;
+  }
+
+  vs_plan_t *plan = domain->plan_list;
+  const char *name = virDomainGetName(handle);
+  char *text;
+  xmlDocPtr document;
+
+  if (domain->current == NULL && domain->config == NULL)
+    return;
+
+  // Each description is parsed and planned in an arena scope. No libvirt call
+  // is made in a scope since libvirt's own libxml2 allocations (such as the
+  // metadata node of a domain in the test driver) outlive it.
+
+  // An inactive domain is reconciled with a single redefinition
+  if (!domain->active) {
+    if ((text = domain_describe(handle, VIR_DOMAIN_AFFECT_CONFIG)) == NULL) {
+      domain->failed = true;
+      return;
+    }
+
+    char *definition = NULL;
+    vs_arena_begin();
+    if ((document = domain_parse(text, name)) == NULL
+        || domain_plan(name, document,
+          domain->current, VIR_DOMAIN_AFFECT_CONFIG, &plan[0]) == -1
+        || plan_rewrite(document, name, &plan[0], &definition) == -1)
+      domain->failed = true;
+    xmlFreeDoc(document);
+    job->arena_size += vs_arena_end();
+    free(text);
+
+    if (definition != NULL && plan_redefine(virt, name, definition, &plan[0]))
+      domain->failed = true;
+    plan_raze(&plan[0]);
+    return;
+  }
+
+  if (domain->current != NULL) {
+    text = domain_describe(handle, VIR_DOMAIN_AFFECT_CURRENT);
+    vs_arena_begin();
+    document = text != NULL ? domain_parse(text, name) : NULL;
+    if (domain_plan(name, document,
+          domain->current, VIR_DOMAIN_AFFECT_CURRENT, &plan[0]) == -1)
+      domain->failed = true;
+    xmlFreeDoc(document);
+    job->arena_size += vs_arena_end();
+    free(text);
+  }
+
+  if (domain->config != NULL) {
+    text = domain_describe(handle, VIR_DOMAIN_AFFECT_CONFIG);
+    vs_arena_begin();
+    document = text != NULL ? domain_parse(text, name) : NULL;
+    if (domain_plan(name, document,
+          domain->config, VIR_DOMAIN_AFFECT_CONFIG, &plan[1]) == -1)
+      domain->failed = true;
+    xmlFreeDoc(document);
+    job->arena_size += vs_arena_end();
+    free(text);
+  }
+
+  // If the live definition and the persistent config have the same plan then
+  // do each call once with both flags
+  plan_merge(&plan[0], &plan[1]);
+
+  if (plan_release(handle, &plan[0]))
+    domain->failed = true;
+  if (plan_release(handle, &plan[1]))
+    domain->failed = true;
+}
+
+void domain_acquire(vs_job_t *job, virConnectPtr virt, size_t worker) {
+  vs_domain_t *domain;
+  domain = (vs_domain_t *) ((char *) job - offsetof(vs_domain_t, job));
+
+  virDomainPtr handle;
+  if ((handle = domain_handle(domain, virt, worker)) == NULL) {
+    domain->failed = true;
+    return;
+  }
+
+  if (plan_acquire(handle, &domain->plan_list[0]))
+    domain->failed = true;
+  if (plan_acquire(handle, &domain->plan_list[1]))
+    domain->failed = true;
+}
+
+void domain_done(vs_job_t *job) {
+  pass_arena_size += job->arena_size;
+  if (--pass_busy > 0)
+    return;
+
+  long now = vs_monotonic_ms();
+
+  if (pass_acquire) {
+    fprintf(stderr, "Acquire stage took %ld ms\n", now - stage_start);
+    pass_complete();
+    return;
+  }
+
+  fprintf(stderr, "Release stage took %ld ms\n", now - stage_start);
+
+  // Acquire stage: each detachment (in each domain) is done so set the
+  // metadata and do each attachment. A dropped domain is skipped.
+  pass_acquire = true;
+  stage_start = now;
+  for (vs_domain_t *domain = pass_list; domain; domain = domain->pass_next) {
+    if (domain->dropped)
+      continue;
+    domain->job.run = domain_acquire;
+    pass_busy++;
+    vs_pool_submit(&domain->job);
+  }
+
+  if (pass_busy == 0)
+    pass_complete();
+}
+
+void pass_complete(void) {
+  fprintf(stderr, "Reconciliation of %zu domain(s) took %" PRIu64 " ms and %zu "
+      "bytes of arena\n", pass_length, vs_span_end(&pass_span) / 1000000,
+      pass_arena_size);
+
+  vs_domain_t *next;
+  for (vs_domain_t *domain = pass_list; domain; domain = next) {
+    next = domain->pass_next;
+    domain->pass_next = NULL;
+    domain->busy = false;
+
+    plan_raze(&domain->plan_list[0]);
+    plan_raze(&domain->plan_list[1]);
+
+    vs_metrics.failure_count += domain->failed;
+
+    // The domain was dropped while it was busy
+    if (domain->dropped) {
+      domain_raze(domain);
+      free(domain);
+      continue;
+    }
+
+    // The domain's metadata was changed while it was busy. If a call failed
+    // then the cached metadata may be ahead of the domain's own so it's
+    // reloaded too.
+    if (domain->stale || domain->failed) {
+      domain->stale = false;
+      if (vs_domain_load(domain) == 1)
+        domain->pending = true;
+    }
+
+    // A failed domain is retried once in the next pass. If the retry fails too
+    // then it waits for the next change in its view or its metadata so that a
+    // lasting failure doesn't hold each pass (or convergence) forever.
+    domain->retry = domain->failed && !domain->retry;
+    if (domain->retry)
+      domain->pending = true;
+
+    // Remember the domain as converged unless it must be reconciled again
+    if (!domain->failed && !domain->pending)
+      domain->digest = vs_domain_digest(domain);
+  }
+
+  pass_list = NULL;
+  pass_length = 0;
+  pass_acquire = false;
+  vs_device_reap();
+
+  // This may start the next pass
+  void (*done)(void) = pass_done;
+  pass_done = NULL;
+  if (done != NULL)
+    done();
+}
+
+uint64_t vs_domain_digest(const vs_domain_t *domain) {
+  // The device list is only changed on the main thread so this doesn't need
+  // the device lock
+  uint64_t digest = 0xcbf29ce484222325;
+
+  unsigned int id = virDomainGetID(domain->domain);
+  digest = digest_mix(digest, &id, sizeof(id));
+  digest = digest_mix(digest, &domain->active, sizeof(domain->active));
+
+  const vs_metadata_t *metadata_list[] = { domain->current, domain->config };
+  for (size_t i = 0; i < 2; i++) {
+    const vs_metadata_t *metadata = metadata_list[i];
+    if (metadata == NULL) {
+      digest = digest_mix(digest, "-", 1);
+      continue;
+    }
+    if (metadata->canonical == NULL)
+      return 0;
+    digest = digest_mix(
+        digest, metadata->canonical, strlen(metadata->canonical) + 1);
+  }
+
+  // The assigned devices in the view are in the order of vs_device_list
+  const vs_view_t *view = vs_view_find(
+      domain->current != NULL ? domain->current->view : NULL);
+  for (size_t i = 0; view != NULL && i < view->active_list_length; i++) {
+    const vs_device_t *device = view->active_list[i];
+
+    vs_symbol_key_t key = vs_symbol_key(&device->symbol);
+    digest = digest_mix(digest, device->name, strlen(device->name) + 1);
+    digest = digest_mix(digest, &key, sizeof(key));
+    if (device->xtra != NULL)
+      digest = digest_mix(digest, device->xtra, strlen(device->xtra) + 1);
+  }
+
+  // Zero is reserved for an unknown digest
+  return digest != 0 ? digest : 1;
+}
+
+uint64_t digest_mix(uint64_t digest, const void *data, size_t size) {
+  return (digest ^ vs_table_hash(data, size)) * 0x100000001b3;
+}
+
+char *domain_describe(virDomainPtr handle, unsigned int option) {
+  const char *name = virDomainGetName(handle);
+  unsigned int flags = 0;
+
+  // The persistent config may be redefined from its description so it must
+  // include each secret
+  if (option == VIR_DOMAIN_AFFECT_CONFIG)
+    flags |= VIR_DOMAIN_XML_INACTIVE | VIR_DOMAIN_XML_SECURE;
+
+  vs_span_t span = vs_span_begin(VS_STAGE_DESCRIBE, name, NULL);
+
+  char *text = virDomainGetXMLDesc(handle, flags);
+  vs_metrics_call(VS_CALL_GET_XML_DESC, text != NULL);
+  if (text == NULL) {
+    vs_span_end(&span);
+    vs_return(NULL, "Can't get XML description of domain \"%s\"\n", name);
+  }
+
+  vs_span_end(&span);
+  return text;
+}
+
+xmlDocPtr domain_parse(const char *text, const char *name) {
+  xmlDocPtr document = xmlReadDoc(BAD_CAST text, name,
+      NULL, XML_PARSE_NOBLANKS | XML_PARSE_NOCDATA);
+  if (document == NULL)
+    vs_return(NULL, "Can't load XML description of domain \"%s\"\n", name);
+  return document;
+}
+
+ssize_t domain_hostdev(xmlDocPtr document, const char *name,
+    vs_symbol_key_t **hostdev_list) {
+  xmlXPathContextPtr ctxt = xmlXPathNewContext(document);
+  xmlXPathObjectPtr result = xmlXPathEval(
+      BAD_CAST "/domain/devices/hostdev", ctxt);
+  if (result == NULL || result->type != XPATH_NODESET)
+    vs_except(result, "Can't read host device list of domain \"%s\"\n", name);
+
+  int length = xmlXPathNodeSetGetLength(result->nodesetval);
+  *hostdev_list = vs_arena_alloc((length + 1) * sizeof(vs_symbol_key_t));
+  if (*hostdev_list == NULL)
+    goto except_result;
+
+  ssize_t count = 0;
+  for (int i = 0; i < length; i++) {
+    xmlNodePtr hostdev = xmlXPathNodeSetItem(result->nodesetval, i);
+    if (hostdev_key(hostdev, &(*hostdev_list)[count]) == 0)
+      count++;
+  }
+
+  xmlXPathFreeObject(result);
+  xmlXPathFreeContext(ctxt);
+
+  qsort(*hostdev_list, count, sizeof(vs_symbol_key_t), vs_symbol_key_cmp);
+
+  return count;
+
+except_result:
+  if (result != NULL)
+    xmlXPathFreeObject(result);
+  xmlXPathFreeContext(ctxt);
+  return -1;
+}
+
+int hostdev_key(xmlNodePtr hostdev, vs_symbol_key_t *key) {
+  vs_symbol_t symbol;
+  if (vs_hostdev_symbol(hostdev, &symbol) == -1)
+    return -1;
+  *key = vs_symbol_key(&symbol);
+  return 0;
+}
+
+int vs_hostdev_symbol(xmlNodePtr hostdev, vs_symbol_t *symbol) {
+  char *mode;
+  if ((mode = (char *) xmlGetProp(hostdev, BAD_CAST "mode")) == NULL)
+    return -1;
+  bool subsystem = !strcmp(mode, "subsystem");
+  xmlFree(mode);
+  if (!subsystem)
+    return -1;
+
+  // Find the <address> in the <source> of the host device
+  xmlNodePtr address = NULL;
+  for (xmlNodePtr source = hostdev->children; source; source = source->next) {
+    if (source->type != XML_ELEMENT_NODE
+        || !xmlStrEqual(source->name, BAD_CAST "source"))
+      continue;
+    for (xmlNodePtr node = source->children; node; node = node->next) {
+      if (node->type == XML_ELEMENT_NODE
+          && xmlStrEqual(node->name, BAD_CAST "address"))
+        address = node;
+    }
+  }
+  if (address == NULL)
+    return -1;
+
+  unsigned long number[4];
+  int e = -1;
+
+  char *type;
+  if ((type = (char *) xmlGetProp(hostdev, BAD_CAST "type")) == NULL)
+    return -1;
+
+  if (!strcmp(type, "pci")) {
+    if (address_number(address, "domain", 0xffff, &number[0]) == -1
+        || address_number(address, "bus", 0xff, &number[1]) == -1
+        || address_number(address, "slot", 0x1f, &number[2]) == -1
+        || address_number(address, "function", 0x7, &number[3]) == -1)
+      goto skip;
+    symbol->subsystem = VS_SUBSYSTEM_PCI;
+    symbol->pci.domain = number[0];
+    symbol->pci.bus = number[1];
+    symbol->pci.slot = number[2];
+    symbol->pci.function = number[3];
+    e = 0;
+  } else if (!strcmp(type, "usb")) {
+    if (address_number(address, "bus", UCHAR_MAX, &number[0]) == -1
+        || address_number(address, "device", UCHAR_MAX, &number[1]) == -1)
+      goto skip;
+    symbol->subsystem = VS_SUBSYSTEM_USB;
+    symbol->usb.busnum = number[0];
+    symbol->usb.devnum = number[1];
+    e = 0;
+  }
+
+skip:
+  xmlFree(type);
+  return e;
+}
+
+int address_number(xmlNodePtr node, const char *name,
+    unsigned long limit, unsigned long *number) {
+  char *text;
+  if ((text = (char *) xmlGetProp(node, BAD_CAST name)) == NULL)
+    return -1;
+
+  char *string_left;
+  errno = 0;
+  *number = strtoul(text, &string_left, 0);
+  bool valid = *text != '\0' && *string_left == '\0' && errno == 0;
+  xmlFree(text);
+
+  return valid && *number <= limit ? 0 : -1;
+}
+
+bool hostdev_has(const vs_symbol_key_t *hostdev_list, ssize_t length,
+    const vs_symbol_t *symbol, bool unknown) {
+  if (length == -1)
+    return unknown;
+  if (length == 0)
+    return false;
+
+  vs_symbol_key_t key = vs_symbol_key(symbol);
+  return bsearch(&key, hostdev_list, length,
+      sizeof(vs_symbol_key_t), vs_symbol_key_cmp) != NULL;
+}
@@ -0,0 +1,195 @@
+#ifndef VS_DOMAIN_H
+#define VS_DOMAIN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+
+#include <libvirt/libvirt.h>
+#include <libxml/tree.h>
+
+#include "metadata.h"
+#include "pool.h"
+
+struct vs_plan_t;
+struct vs_view_t;
+
+/// A libvirt domain managed by the vision daemon
+typedef struct vs_domain_t {
+  /// The previous domain in @c vs_domain_list
+  struct vs_domain_t *prev;
+
+  /// The next domain in @c vs_domain_list
+  struct vs_domain_t *next;
+
+  /// The libvirt domain itself
+  virDomainPtr domain;
+
+  /// The UUID of the domain
+  unsigned char uuid[VIR_UUID_BUFLEN];
+
+  /// The view that the domain is set to. This is @c NULL if the domain has no
+  /// view or if its view isn't in any vision device's view list.
+  struct vs_view_t *view;
+
+  /// Whether the domain must be reconciled due to a change in a vision device
+  /// in its view or in its vision metadata
+  bool pending;
+
+  /// Whether the domain is in the current pass of reconciliation. While the
+  /// domain is busy a worker owns its cached metadata so the main thread must
+  /// not change or reload it.
+  bool busy;
+
+  /// Whether the domain's metadata must be reloaded when its job is done
+  bool stale;
+
+  /// Whether the domain was dropped while it was busy. In this case it's freed
+  /// when the pass is done.
+  bool dropped;
+
+  /// Whether a libvirt call (or a plan) for the domain failed in the current
+  /// pass. This is set by a worker and read when the pass is done.
+  bool failed;
+
+  /// Whether the domain is pending to retry a pass in which it failed
+  bool retry;
+
+  /// The digest (from vs_domain_digest()) of the domain when it was last
+  /// converged or @c 0 if it isn't known to be converged
+  uint64_t digest;
+
+  /// The job to run the domain's current stage of the pass on a worker
+  vs_job_t job;
+
+  /// The next domain in the current pass of reconciliation
+  struct vs_domain_t *pass_next;
+
+  /// The plan of the domain's current definition and of its persistent config
+  /// in the current pass
+  struct vs_plan_t *plan_list;
+
+  /// The handle on the domain from each worker's own libvirt connection. This
+  /// has @c vs_pool_size entries and each is looked up when it's first used.
+  virDomainPtr *handle_list;
+
+  /// Whether the domain was active when its metadata was loaded
+  bool active;
+
+  /// Whether the domain was marked to be autostarted when its metadata was
+  /// loaded
+  bool autostart;
+
+  /// The cached vision metadata of the domain's current definition (the live
+  /// definition if the domain is active). This is @c NULL if the domain isn't
+  /// vision managed.
+  vs_metadata_t *current;
+
+  /// The cached vision metadata of the domain's persistent config if the domain
+  /// is active. If the domain is inactive or if its persistent config isn't
+  /// vision managed then this is @c NULL.
+  vs_metadata_t *config;
+} vs_domain_t;
+
+/// The first domain in the global domain list. Each domain known to the vision
+/// daemon is in this list.
+extern vs_domain_t *vs_domain_list;
+
+/**
+ * Create a domain from the libvirt domain @a handle, load its vision metadata,
+ * and add it to @c vs_domain_list
+ *
+ * The domain holds its own reference to the @a handle. If a domain with the
+ * same UUID is already in the list then this will return it. On failure this
+ * will log to @c stderr and return @c NULL.
+ */
+vs_domain_t *vs_domain_add(virDomainPtr handle) __attribute__((nonnull));
+
+/// Return the domain in @c vs_domain_list with the @a uuid or @c NULL if
+/// there's no such domain. This is O(1).
+vs_domain_t *vs_domain_find(const unsigned char uuid[VIR_UUID_BUFLEN])
+  __attribute__((nonnull));
+
+/// Return the domain in @c vs_domain_list with the same UUID as the libvirt
+/// domain @a handle or @c NULL if there's no such domain
+vs_domain_t *vs_domain_find_handle(virDomainPtr handle)
+  __attribute__((nonnull));
+
+/// Remove the @a domain from @c vs_domain_list and its view and free it. If
+/// the @a domain is busy then it's freed when the pass is done.
+void vs_domain_drop(vs_domain_t *domain) __attribute__((nonnull));
+
+/// Drop each domain in @c vs_domain_list
+void vs_domain_clear(void);
+
+/**
+ * Reload the @a domain's cached vision metadata from libvirt
+ *
+ * This also moves the @a domain to the view in its current metadata with
+ * vs_view_set(). Return @c 1 if the metadata was changed, @c 0 if it wasn't,
+ * or @c -1 (after a log to @c stderr) on failure.
+ *
+ * If the @a domain is busy then it's marked as stale and this will return
+ * @c 0. Its metadata is then reloaded when the pass is done and if it was
+ * changed then the @a domain is marked as pending.
+ */
+int vs_domain_load(vs_domain_t *domain) __attribute__((nonnull));
+
+/**
+ * Start a pass to reconcile the devices attached to each pending domain in
+ * @c vs_domain_list with its view and clear its pending mark
+ *
+ * This works from each domain's cached metadata. If a domain is active then
+ * both its live definition and its persistent config are reconciled.
+ *
+ * A pass is planned across each domain in it and runs in two stages on the
+ * pool. In the release stage each domain is planned and each detachment is
+ * done. Once each domain's release stage is done then in the acquire stage the
+ * metadata of each domain is set and each attachment is done. So when a device
+ * is moved from one domain's view to another's it's always detached before it
+ * is attached. The latency of each stage is logged to @c stderr.
+ *
+ * An active domain's live definition and persistent config are changed with
+ * one call each if their plans are the same. An inactive domain is instead
+ * changed whole with a single redefinition in the release stage.
+ *
+ * If @a priority then only each pending domain that's autostarted or active is
+ * in the pass. An autostarted domain is one that should be usable as soon as
+ * possible and a device can only be contended between domains' live
+ * definitions, so this pass is safe to run before the rest.
+ *
+ * When the pass is done then @a done (if it isn't @c NULL) is called on the
+ * main thread. Return the number of domains in the pass. If there's no pending
+ * domain, or a pass is already in progress, then this will return @c 0 and no
+ * pass is started; a domain that's pending during a pass must be reconciled
+ * in a later pass.
+ */
+ssize_t vs_domain_reconcile(bool priority, void (*done)(void));
+
+/**
+ * Return a digest of the @a domain's cached metadata and of each assigned
+ * vision device in its view
+ *
+ * This hashes the @a domain's ID, whether it's active, the canonical
+ * serialization of its current and config metadata, and the name, symbol, and
+ * xtra of each device that's attached to it when it's converged. So if the
+ * digest is unchanged since the @a domain was converged then it's still
+ * converged (unless its devices were changed outside of the vision system). If
+ * the @a domain's metadata must be rewritten then this will return @c 0.
+ *
+ * This must only be called on the main thread.
+ */
+uint64_t vs_domain_digest(const vs_domain_t *domain) __attribute__((nonnull));
+
+/**
+ * Read the symbol of the @c hostdev element @a hostdev of a libvirt domain's
+ * description into @a symbol
+ *
+ * If the @a hostdev isn't a subsystem host device with a PCI or USB address
+ * then this will return @c -1.
+ */
+int vs_hostdev_symbol(xmlNodePtr hostdev, vs_symbol_t *symbol)
+  __attribute__((nonnull));
+
+#endif /* VS_DOMAIN_H */
@@ -0,0 +1,103 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include <libudev.h>
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+
+#include "device.h"
+#include "domain.h"
+#include "status.h"
+#include "trace.h"
+#include "vfio.h"
+
+/**
+ * Bind each PCI host device of the domain described on @c stdin to vfio-pci
+ *
+ * This is the libvirt qemu hook. It's invoked as
+ * <tt>qemu OBJECT OPERATION SUBOPERATION EXTRA</tt> with the domain's XML
+ * description on @c stdin and only acts on the @c prepare @c begin operation.
+ * If this exits with a failure then libvirt won't start the domain.
+ */
+int main(int argc, char *argv[]) {
+  if (argc != 5) {
+    fprintf(stderr, "Expected 4 arguments in invocation of hook %s but "
+        "received %d\n", argv[0], argc - 1);
+    return EXIT_SUCCESS;
+  }
+  if (strcmp(argv[2], "prepare") || strcmp(argv[3], "begin"))
+    return EXIT_SUCCESS;
+
+  xmlDocPtr document;
+  if ((document = xmlReadFd(STDIN_FILENO, NULL, NULL,
+          XML_PARSE_NONET | XML_PARSE_NOBLANKS)) == NULL)
+    vs_return(EXIT_FAILURE, "Can't parse description of domain \"%s\"\n",
+        argv[1]);
+
+  int status = EXIT_SUCCESS;
+  struct udev *udev = NULL;
+
+  // If the document's root node isn't a domain node or if the domain's type
+  // isn't KVM then this hook shouldn't be triggered
+  xmlNodePtr root = xmlDocGetRootElement(document);
+  if (root == NULL || !xmlStrEqual(root->name, BAD_CAST "domain")) {
+    fprintf(stderr, "Expected document root node type to be \"domain\"\n");
+    goto done;
+  }
+
+  char *type = (char *) xmlGetProp(root, BAD_CAST "type");
+  bool kvm = type != NULL && !strcmp(type, "kvm");
+  xmlFree(type);
+  if (!kvm) {
+    fprintf(stderr, "Expected domain type to be \"kvm\"\n");
+    goto done;
+  }
+
+  if ((udev = udev_new()) == NULL) {
+    fprintf(stderr, "Can't create udev context: %s\n", strerror(errno));
+    status = EXIT_FAILURE;
+    goto done;
+  }
+
+  for (xmlNodePtr devices = root->children; devices; devices = devices->next) {
+    if (devices->type != XML_ELEMENT_NODE
+        || !xmlStrEqual(devices->name, BAD_CAST "devices"))
+      continue;
+
+    for (xmlNodePtr node = devices->children; node; node = node->next) {
+      vs_symbol_t symbol;
+      if (node->type != XML_ELEMENT_NODE
+          || !xmlStrEqual(node->name, BAD_CAST "hostdev")
+          || vs_hostdev_symbol(node, &symbol) == -1
+          || symbol.subsystem != VS_SUBSYSTEM_PCI)
+        continue;
+
+      char buffer[VS_SYMBOL_BUFFER_SIZE];
+      vs_symbol_dump(&symbol, buffer);
+
+      // If the device is absent then disregard it here to let QEMU deal with
+      // the situation
+      uint64_t start = vs_monotonic_ns();
+      int e = vs_vfio_bind(udev, &symbol);
+      if (e == -1) {
+        status = EXIT_FAILURE;
+        goto done;
+      }
+      if (e == 0)
+        fprintf(stderr, "Prepared %s in %" PRIu64 " us\n",
+            buffer, (vs_monotonic_ns() - start) / 1000);
+    }
+  }
+
+done:
+  if (udev != NULL)
+    udev_unref(udev);
+  xmlFreeDoc(document);
+  return status;
+}
@@ -1,78 +1,277 @@
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "device.h"
+#include "layout.h"
+#include "status.h"
+#include "table.h"
+#include "topology.h"
+
+/// A device section of a layout file as it's read
+typedef struct layout_entry_t {
+  /// The name of the device or @c NULL if no section has been read yet
+  char *name;
+
+  /// The xtra of the device or @c NULL if it has none
+  char *xtra;
+
+  /// The topology of the device (with a @c NULL @a port if it has none)
+  vs_topology_t topology;
+
+  /// The prebind of the device or @c -1 if it isn't given
+  int prebind;
+
+  /// The name of each view of the device
+  char **view_list;
+
+  /// The number of names in the @a view_list
+  size_t view_list_length;
+} layout_entry_t;
+
+/// Return the @a text with its leading whitespace skipped and its trailing
+/// whitespace removed (in place)
+static char *layout_strip(char *text) __attribute__((nonnull));
+
+/**
+ * Construct a device from the @a entry and append it to the @a device_list of
+ * @a length devices
+ *
+ * Each string in the @a entry is moved into the device and the @a entry is
+ * reset. On failure this will log to @c stderr and return @c -1 with the
+ * @a entry unchanged.
+ */
+static int layout_append(vs_device_t ***device_list, size_t *length,
+    layout_entry_t *entry)
+  __attribute__((nonnull));
+
+/// Free each string in the @a entry and reset it
+static void entry_raze(layout_entry_t *entry) __attribute__((nonnull));
+
+vs_device_t **vs_layout_load(const char *path) {
+  FILE *file;
+  if ((file = fopen(path, "r")) == NULL)
+    vs_return(NULL, "fopen(\"%s\"): %s\n", path, strerror(errno));
+
+  vs_device_t **device_list;
+  size_t length = 0;
+  if ((device_list = calloc(1, sizeof(vs_device_t *))) == NULL)
+    vs_except(device_list, "calloc(): %s\n", strerror(errno));
+
+  // The name of each device section to detect a duplicate
+  vs_table_t name_table = { 0 };
+
+  layout_entry_t entry = { .prebind = -1 };
+  char *line = NULL;
+  size_t line_size = 0;
+  size_t number = 0;
+
+  while (getline(&line, &line_size, file) != -1) {
+    number++;
+    char *text = layout_strip(line);
+
+    // Skip a blank line or a comment
+    if (*text == '\0' || *text == '#')
+      continue;
+
+    // A section header that starts the next device
+    if (*text == '[') {
+      char *end = strchr(text, ']');
+      if (end == NULL || end[1] != '\0' || end == text + 1)
+        vs_except(parse, "%s:%zu: Invalid section \"%s\"\n",
+            path, number, text);
+      *end = '\0';
+      text++;
+
+      if (vs_table_get(&name_table, text, strlen(text)) != NULL)
+        vs_except(parse, "%s:%zu: Duplicate device \"%s\"\n",
+            path, number, text);
+      if (vs_table_put(&name_table, text, strlen(text), file) == -1)
+        goto except_parse;
+
+      if (entry.name != NULL
+          && layout_append(&device_list, &length, &entry) == -1)
+        goto except_parse;
+      if ((entry.name = strdup(text)) == NULL)
+        vs_except(parse, "strdup(): %s\n", strerror(errno));
+      continue;
+    }
+
+    char *equal;
+    if ((equal = strchr(text, '=')) == NULL)
+      vs_except(parse, "%s:%zu: Expected \"KEY = VALUE\" in \"%s\"\n",
+          path, number, text);
+    if (entry.name == NULL)
+      vs_except(parse, "%s:%zu: \"%s\" is outside of a device section\n",
+          path, number, text);
+
+    *equal = '\0';
+    char *key = layout_strip(text);
+    char *value = layout_strip(equal + 1);
+
+    if (!strcmp(key, "view")) {
+      char *state;
+      for (char *view = strtok_r(value, " \t", &state); view != NULL;
+          view = strtok_r(NULL, " \t", &state)) {
+        char **view_list = realloc(entry.view_list,
+            (entry.view_list_length + 1) * sizeof(char *));
+        if (view_list == NULL)
+          vs_except(parse, "realloc(): %s\n", strerror(errno));
+        entry.view_list = view_list;
+
+        if ((view_list[entry.view_list_length] = strdup(view)) == NULL)
+          vs_except(parse, "strdup(): %s\n", strerror(errno));
+        entry.view_list_length++;
+      }
+    } else if (!strcmp(key, "xtra")) {
+      if (entry.xtra != NULL)
+        vs_except(parse, "%s:%zu: Duplicate xtra in device \"%s\"\n",
+            path, number, entry.name);
+      if ((entry.xtra = strdup(value)) == NULL)
+        vs_except(parse, "strdup(): %s\n", strerror(errno));
+    } else if (!strcmp(key, "usb")) {
+      if (entry.topology.port != NULL)
+        vs_except(parse, "%s:%zu: Duplicate usb in device \"%s\"\n",
+            path, number, entry.name);
+      if (vs_topology_load(&entry.topology, value) == -1)
+        vs_except(parse, "%s:%zu: Invalid usb in device \"%s\"\n",
+            path, number, entry.name);
+    } else if (!strcmp(key, "prebind")) {
+      if (entry.prebind != -1)
+        vs_except(parse, "%s:%zu: Duplicate prebind in device \"%s\"\n",
+            path, number, entry.name);
+      if (!strcmp(value, "yes"))
+        entry.prebind = 1;
+      else if (!strcmp(value, "no"))
+        entry.prebind = 0;
+      else
+        vs_except(parse, "%s:%zu: Expected prebind \"yes\" or \"no\" in "
+            "device \"%s\"\n", path, number, entry.name);
+    } else {
+      vs_except(parse, "%s:%zu: Unknown key \"%s\"\n", path, number, key);
+    }
+  }
+
+  if (ferror(file))
+    vs_except(parse, "getline(\"%s\"): %s\n", path, strerror(errno));
+
+  if (entry.name != NULL && layout_append(&device_list, &length, &entry) == -1)
+    goto except_parse;
+
+  free(line);
+  vs_table_raze(&name_table);
+  fclose(file);
+
+  return device_list;
+
+except_parse:
+  free(line);
+  entry_raze(&entry);
+  vs_table_raze(&name_table);
+  vs_layout_free(device_list);
+
+except_device_list:
+  fclose(file);
+  return NULL;
+}
+
+void vs_layout_free(vs_device_t **device_list) {
+  if (device_list == NULL)
+    return;
+
+  for (size_t i = 0; device_list[i] != NULL; i++)
+    vs_layout_free_device(device_list[i]);
+  free(device_list);
+}
+
+void vs_layout_free_device(vs_device_t *device) {
+  free((char *) device->name);
+  free((char *) device->xtra);
+  free(device->topology.port);
+  for (size_t i = 0; device->view_list[i] != NULL; i++)
+    free((char *) device->view_list[i]);
+  free(device);
+}
+
+bool vs_layout_eq(const vs_device_t *a, const vs_device_t *b) {
+  if (strcmp(a->name, b->name))
+    return false;
+
+  if (a->prebind != b->prebind)
+    return false;
+
+  if (!vs_topology_eq(&a->topology, &b->topology))
+    return false;
+
+  if ((a->xtra == NULL) != (b->xtra == NULL))
+    return false;
+  if (a->xtra != NULL && strcmp(a->xtra, b->xtra))
+    return false;
+
+  size_t i;
+  for (i = 0; a->view_list[i] != NULL && b->view_list[i] != NULL; i++) {
+    if (strcmp(a->view_list[i], b->view_list[i]))
+      return false;
+  }
+
+  return a->view_list[i] == NULL && b->view_list[i] == NULL;
+}
+
+char *layout_strip(char *text) {
+  while (isspace((unsigned char) *text))
+    text++;
+
+  size_t length = strlen(text);
+  while (length > 0 && isspace((unsigned char) text[length - 1]))
+    text[--length] = '\0';
+
+  return text;
+}
+
+int layout_append(vs_device_t ***device_list, size_t *length,
+    layout_entry_t *entry) {
+  vs_device_t **list;
+  list = realloc(*device_list, (*length + 2) * sizeof(vs_device_t *));
+  if (list == NULL)
+    vs_return(-1, "realloc(): %s\n", strerror(errno));
+  *device_list = list;
+
+  vs_device_t *device = calloc(1,
+      sizeof(vs_device_t) + (entry->view_list_length + 1) * sizeof(char *));
+  if (device == NULL)
+    vs_return(-1, "calloc(): %s\n", strerror(errno));
+
+  device->name = entry->name;
+  device->xtra = entry->xtra;
+  device->topology = entry->topology;
+  device->prebind = entry->prebind != 0;
+  for (size_t i = 0; i < entry->view_list_length; i++)
+    device->view_list[i] = entry->view_list[i];
+  device->view_list[entry->view_list_length] = NULL;
+
+  free(entry->view_list);
+  memset(entry, 0, sizeof(layout_entry_t));
+  entry->prebind = -1;
+
+  list[(*length)++] = device;
+  list[*length] = NULL;
+
+  return 0;
+}
 
-static vs_device_t GPU1_VIDEO = {
-  .name = "GPU1_VIDEO", .view_list = { "DualScreen", "Screen1", NULL },
-  .xtra = "<rom file=\"/home/ktchen14/Gigabyte.GTX1070Ti.8192.171006.rom\" />",
-};
-
-static vs_device_t GPU1_AUDIO = {
-  .name = "GPU1_AUDIO", .view_list = { "DualScreen", "Screen1", NULL },
-};
-
-static vs_device_t GPU2_VIDEO = {
-  .name = "GPU2_VIDEO", .view_list = { "DualScreen", "Screen2", NULL },
-  .xtra = "<rom file=\"/home/ktchen14/Gigabyte.GTX1070Ti.8192.171006.rom\" />",
-};
-
-static vs_device_t GPU2_AUDIO = {
-  .name = "GPU2_AUDIO", .view_list = { "DualScreen", "Screen2", NULL },
-};
-
-// static vs_device_t SWITCH_PORT_1 = {
-//   .name = "SWITCH_PORT_1", .view_list = { "DualScreen", "Screen1", NULL },
-// };
-
-static vs_device_t USBHUB1_1 = {
-  .name = "USBHUB1_1", .view_list = { "DualScreen", "Screen1", NULL },
-};
-static vs_device_t USBHUB1_2 = {
-  .name = "USBHUB1_2", .view_list = { "DualScreen", "Screen1", NULL },
-};
-static vs_device_t USBHUB1_3 = {
-  .name = "USBHUB1_3", .view_list = { "DualScreen", "Screen1", NULL },
-};
-static vs_device_t USBHUB1_4 = {
-  .name = "USBHUB1_4", .view_list = { "DualScreen", "Screen1", NULL },
-};
-static vs_device_t USBHUB1_5 = {
-  .name = "USBHUB1_5", .view_list = { "DualScreen", "Screen1", NULL },
-};
-
-static vs_device_t SWITCH_PORT_2 = {
-  .name = "SWITCH_PORT_2", .view_list = { "DualScreen", NULL },
-};
-
-static vs_device_t SWITCH_PORT_3 = {
-  .name = "SWITCH_PORT_3", .view_list = { "DualScreen", NULL },
-};
-
-static vs_device_t USBHUB2_1 = {
-  .name = "USBHUB2_1", .view_list = { "DualScreen", "Screen2", NULL },
-};
-static vs_device_t USBHUB2_2 = {
-  .name = "USBHUB2_2", .view_list = { "DualScreen", "Screen2", NULL },
-};
-static vs_device_t USBHUB2_3 = {
-  .name = "USBHUB2_3", .view_list = { "DualScreen", "Screen2", NULL },
-};
-static vs_device_t USBHUB2_4 = {
-  .name = "USBHUB2_4", .view_list = { "DualScreen", "Screen2", NULL },
-};
-static vs_device_t USBHUB2_5 = {
-  .name = "USBHUB2_5", .view_list = { "DualScreen", "Screen2", NULL },
-};
-
-// static vs_device_t SWITCH_PORT_4 = {
-//   .name = "SWITCH_PORT_4", .view_list = { "DualScreen", "Screen2", NULL },
-// };
-
-vs_device_t *vs_device_list[] = {
-  &GPU1_VIDEO, &GPU1_AUDIO,
-  &GPU2_VIDEO, &GPU2_AUDIO,
-  &USBHUB1_1, &USBHUB1_2, &USBHUB1_3, &USBHUB1_4, &USBHUB1_5,
-  &SWITCH_PORT_2, &SWITCH_PORT_3,
-  &USBHUB2_1, &USBHUB2_2, &USBHUB2_3, &USBHUB2_4, &USBHUB2_5,
-  NULL,
-};
+void entry_raze(layout_entry_t *entry) {
+  free(entry->name);
+  free(entry->xtra);
+  free(entry->topology.port);
+  for (size_t i = 0; i < entry->view_list_length; i++)
+    free(entry->view_list[i]);
+  free(entry->view_list);
+  memset(entry, 0, sizeof(layout_entry_t));
+  entry->prebind = -1;
+}
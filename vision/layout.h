@@ -0,0 +1,53 @@
+#ifndef VS_LAYOUT_H
+#define VS_LAYOUT_H
+
+#include <stdbool.h>
+
+#include "device.h"
+
+/// The path of the layout file if none is given on the command line
+#ifndef VS_LAYOUT_PATH
+#define VS_LAYOUT_PATH "/etc/vision/layout.conf"
+#endif
+
+/**
+ * Load a device list from the layout file at @a path
+ *
+ * The layout file is a list of sections. Each section is a device in the form:
+ *
+ *   [NAME]
+ *   view = VIEW...
+ *   xtra = XML
+ *   usb = VENDOR:PRODUCT PORT[.PORT...]
+ *   prebind = yes|no
+ *
+ * The @c NAME is the device's @c VISION_NAME and must be unique in the file.
+ * Each @c VIEW (separated by whitespace) is a view that the device is in. The
+ * optional @c xtra is the rest of its line and is added to the device's
+ * manifest when it's attached. The optional @c usb is the topology (as in
+ * vs_topology_load()) that a USB device is matched by when it has no
+ * @c VISION_NAME. A PCI device is bound to vfio-pci as soon as it's assigned
+ * unless its optional @c prebind is @c no. Blank lines and lines that start
+ * with @c # are ignored.
+ *
+ * The returned device list is terminated by @c NULL and each device in it is
+ * unassigned. It should be released with vs_layout_free(). On failure this
+ * will log to @c stderr and return @c NULL.
+ */
+vs_device_t **vs_layout_load(const char *path)
+  __attribute__((malloc, nonnull));
+
+/// Free each device in the @a device_list and the @a device_list itself. Each
+/// device must already be unassigned.
+void vs_layout_free(vs_device_t **device_list);
+
+/// Free the @a device that was loaded with vs_layout_load(). It must already be
+/// unassigned.
+void vs_layout_free_device(vs_device_t *device);
+
+/// Return whether the devices @a a and @a b have the same name, view list,
+/// xtra, topology, and prebind
+bool vs_layout_eq(const vs_device_t *a, const vs_device_t *b)
+  __attribute__((nonnull, pure));
+
+#endif /* VS_LAYOUT_H */
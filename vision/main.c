@@ -2,42 +2,347 @@
 
 #include <stdbool.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <getopt.h>
 #include <libgen.h>
 #include <signal.h>
 #include <poll.h>
+#include <unistd.h>
+
+#include <sys/signalfd.h>
+
+#include <pthread.h>
 
 #include <libudev.h>
 #include <libvirt/libvirt.h>
-#include <libxml/xpath.h>
+#include <libxml/parser.h>
 #include <systemd/sd-daemon.h>
 
+#include "arena.h"
+#include "control.h"
 #include "device.h"
+#include "domain.h"
+#include "layout.h"
+#include "metadata.h"
+#include "metrics.h"
+#include "pool.h"
+#include "state.h"
 #include "status.h"
+#include "table.h"
+#include "topology.h"
+#include "trace.h"
+#include "vfio.h"
+#include "view.h"
 
 #define USAGE \
-"Usage: %s {attach,detach} DEVICE\n" \
+"Usage: %s [-e] [-t] [-f FILE] [-c PATH] [-m PATH] [-s MS] [-l MS]\n" \
+"       [-w COUNT]\n" \
+"\n" \
+"Run the vision daemon. The layout FILE is reloaded on SIGHUP and the latency\n" \
+"histogram of each stage of event handling is logged on SIGUSR1.\n" \
 "\n" \
-"Attach or detach DEVICE to/from the vision system. DEVICE must be the syspath\n" \
-"of a udev initialized device.\n"
+"  -e, --early-ready      notify systemd that the daemon is ready once udev and\n" \
+"                         libvirt are connected and reconcile each domain in\n" \
+"                         the background\n" \
+"  -f, --layout=FILE      load the device layout from FILE\n" \
+"                         (default: " VS_LAYOUT_PATH ")\n" \
+"  -c, --control=PATH     serve the control API (set-view, get-state, and\n" \
+"                         reconcile-now) on the Unix socket PATH\n" \
+"                         (default: " VS_CONTROL_PATH ")\n" \
+"  -m, --metrics=PATH     serve metrics in the Prometheus text format over\n" \
+"                         HTTP on the Unix socket PATH\n" \
+"                         (default: " VS_METRICS_PATH ")\n" \
+"  -s, --settle=MS        wait until no event is received for MS\n" \
+"                         milliseconds before domains are reconciled\n" \
+"                         (default: 50)\n" \
+"  -l, --settle-limit=MS  reconcile domains at most MS milliseconds after the\n" \
+"                         first event of a burst even if events are still\n" \
+"                         being received (default: 500)\n" \
+"  -w, --workers=COUNT    reconcile up to COUNT domains concurrently, each\n" \
+"                         with its own libvirt connection (default: 4)\n" \
+"  -t, --trace            log each timed span with its domain and device\n" \
+"  -h, --help             show this help and exit\n"
+
+/// Whether to notify systemd that the daemon is ready before each domain is
+/// reconciled
+static bool early_ready = false;
+
+/// The path of the layout file
+static const char *layout_path = VS_LAYOUT_PATH;
+
+/// The path of the control socket
+static const char *control_path = VS_CONTROL_PATH;
+
+/// The path of the metrics socket
+static const char *metrics_path = VS_METRICS_PATH;
+
+/// The quiet period (in milliseconds) that ends a burst of events
+static long settle = 50;
+
+/// The maximum time (in milliseconds) from the first event in a burst to the
+/// reconciliation of each pending domain
+static long settle_limit = 500;
+
+/// The number of workers (each with its own libvirt connection) in the pool
+static long worker_count = 4;
+
+/// The libvirt event loop timer that fires when a burst of events settles
+static int settle_timer = -1;
+
+/// The time (from vs_monotonic_ms()) of the first event in the current burst
+static long burst_start = 0;
+
+/// The time (from vs_monotonic_ms()) when the current burst will settle
+static long burst_until = 0;
+
+/// The number of events in the current burst. If this is zero then there's no
+/// current burst.
+static size_t burst_length = 0;
+
+/// Whether a pass of reconciliation is in progress
+static bool reconciling = false;
+
+/// Whether each domain found at startup isn't reconciled yet. Progress is
+/// reported to systemd through @c STATUS= until this is cleared.
+static bool converging = true;
+
+/// Whether a pass should include only autostarted (or active) domains. This is
+/// cleared once no such domain is pending at startup.
+static bool priority = true;
+
+/// The time (from vs_monotonic_ms()) when the daemon was started
+static long startup_start = 0;
+
+/// Whether the vision daemon should continue to run the event loop
+static bool running = true;
+
+/// Whether systemd was notified that the daemon is ready at startup. Until then
+/// a reload doesn't notify systemd since @c READY= is still to come.
+static bool ready = false;
+
+/// A job to bind a device to vfio-pci on a worker
+typedef struct prebind_t {
+  /// The job in the pool's queue
+  vs_job_t job;
+
+  /// The device to bind or @c NULL if the job was canceled. This is only read
+  /// and written on the main thread.
+  vs_device_t *device;
+
+  /// The symbol of the device when the job was created
+  vs_symbol_t symbol;
+
+  /// The text of the @a symbol (the device tag of the job's span)
+  char buffer[VS_SYMBOL_BUFFER_SIZE];
+
+  /// Whether the job was submitted to the pool
+  bool submitted;
+
+  /// The result of vs_vfio_bind()
+  int status;
+
+  /// The duration (in nanoseconds) of vs_vfio_bind()
+  uint64_t duration;
+} prebind_t;
+
+/**
+ * Parse the command line @a argv into @c early_ready, @c vs_trace_verbose,
+ * @c layout_path, @c control_path, @c metrics_path, @c settle,
+ * @c settle_limit, and @c worker_count. On failure this will log to @c stderr
+ * and return @c -1. If @c --help is in @a argv then this will print the usage
+ * to @c stdout and exit().
+ */
+int parse_option_list(int argc, char *argv[]);
 
 struct udev_monitor *initialize_device_list(struct udev *udev);
 
-int initialize_domain(virDomainPtr domain, unsigned int option);
+/**
+ * Start a pass with vs_domain_reconcile() unless a pass is in progress. In that
+ * case each pending domain is reconciled when the pass is done.
+ *
+ * At startup each autostarted (or active) domain is reconciled in a priority
+ * pass before the rest so that it's usable as soon as possible. While the
+ * domains found at startup are converging each pass is reported to systemd
+ * through @c STATUS=.
+ */
+void reconcile(void);
+
+/// Complete the pass, advance each control command that waited on it, and start
+/// another pass if a domain became pending during it. This is the done function
+/// of vs_domain_reconcile().
+void on_reconcile(void);
+
+/// Return the number of pending domains in @c vs_domain_list
+size_t count_pending(void);
+
+/**
+ * Add an event to the current burst (or start a burst) and extend the settle
+ * window
+ *
+ * The window is extended by @c settle milliseconds but never beyond
+ * @c settle_limit milliseconds from the first event of the burst. Each pending
+ * domain is reconciled when the window ends.
+ */
+void schedule(void);
+
+/**
+ * Return the vision device that the @a actual udev device should be assigned
+ * to or @c NULL if there's no such device
+ *
+ * If the @a actual udev device is tagged with @c "vision" then this is the
+ * vision device with its @c VISION_NAME. Otherwise this is the vision device
+ * with a topology that the @a actual udev device is at (from
+ * vs_topology_find()).
+ */
+vs_device_t *detect_device(struct udev_device *actual)
+  __attribute__((nonnull));
+
+/// Assign the @a actual udev device to the vision @a device (from
+/// detect_device()). Return whether any domain was marked as pending.
+bool on_detect(struct udev_device *actual, vs_device_t *device)
+  __attribute__((nonnull));
+
+/**
+ * Bind the assigned PCI @a device to vfio-pci with vs_vfio_bind() on a worker
+ * so that neither a domain's start nor an attachment waits on its driver
+ *
+ * This must be called with @c vs_device_lock held for writing. The @a device
+ * is held out of its views' active lists until the job is done so that it
+ * isn't attached anywhere new before it's bound. A domain that it's already
+ * attached to keeps it (see domain_plan()). If the pool isn't started yet then
+ * the job is submitted once it is.
+ */
+void prebind(vs_device_t *device) __attribute__((nonnull));
+
+/// Bind the device of the prebind @a job to vfio-pci with its own udev context.
+/// This is the @a run function of a prebind job.
+void prebind_run(vs_job_t *job, virConnectPtr virt, size_t worker)
+  __attribute__((nonnull));
+
+/// Record and log the result of the prebind @a job, return its device to its
+/// views' active lists, and mark each domain in them. This is the @a done
+/// function of a prebind job.
+void prebind_done(vs_job_t *job) __attribute__((nonnull));
+
+/// Cancel the prebind job of the @a device (if any) so that its result is
+/// discarded. This must be called (with @c vs_device_lock held for writing)
+/// before the @a device is assigned, unassigned, or freed.
+void prebind_cancel(vs_device_t *device) __attribute__((nonnull));
+
+/// Unassign the @a actual udev device from each vision device that it's
+/// assigned to. Return whether any domain was marked as pending.
+bool on_remove(struct udev_device *actual);
+
+/// Receive and apply an event from the udev monitor in @a opaque. This is a
+/// libvirt event loop handle callback on the monitor's fd.
+void on_monitor(int watch, int fd, int events, void *opaque);
+
+/**
+ * Reload the layout file and apply only the differences from the current
+ * layout
+ *
+ * An unchanged device is kept with its actual udev device and no domain in its
+ * views is touched. A removed device is unassigned and a changed device's
+ * actual udev device is moved to its replacement; in either case each domain
+ * in its views (before and after) is marked as pending. An added device is
+ * assigned from @a udev with detect_unassigned(). If the layout file can't be
+ * loaded or indexed then the current layout is kept. systemd is notified of
+ * the reload only once it's notified that the daemon is ready. Return whether
+ * any domain was marked as pending.
+ */
+bool reload(struct udev *udev) __attribute__((nonnull));
+
+/// Run on_detect() on each vision tagged device in @a udev and each USB device
+/// under an anchor hub (from vs_topology_scan()) for which detect_device() is
+/// an unassigned vision device. Return whether any domain was marked as
+/// pending.
+bool detect_unassigned(struct udev *udev) __attribute__((nonnull));
+
+/// Run on_detect() on the @a actual udev device (from vs_topology_scan()) if
+/// it isn't tagged with @c "vision" and its vision device from
+/// vs_topology_find() is unassigned. Set the @c bool at @a opaque if any
+/// domain was marked as pending.
+void detect_topology(struct udev_device *actual, void *opaque);
+
+/// Receive each signal from the signalfd @a fd. Reload the layout on @c SIGHUP
+/// with the udev context in @a opaque and log the latency histogram of each
+/// stage on @c SIGUSR1. This is a libvirt event loop
+/// handle callback on the signalfd.
+void on_signal(int watch, int fd, int events, void *opaque);
+
+/// Reconcile each pending domain at the end of a burst. This is the libvirt
+/// event loop callback of the @c settle_timer.
+void on_settle(int timer, void *opaque);
+
+/// Reload the cached vision metadata of the @a handle's domain when it's
+/// changed. This is a libvirt @c VIR_DOMAIN_EVENT_ID_METADATA_CHANGE callback.
+void on_metadata_change(virConnectPtr virt, virDomainPtr handle,
+    int type, const char *nsuri, void *opaque);
+
+/**
+ * Add, drop, or reload the @a handle's domain in @c vs_domain_list when it's
+ * defined, undefined, started, or stopped. This is a libvirt
+ * @c VIR_DOMAIN_EVENT_ID_LIFECYCLE callback.
+ *
+ * An update of a domain's definition (such as its redefinition in a pass)
+ * that leaves its digest as it was when it converged doesn't mark it as
+ * pending.
+ */
+void on_lifecycle(virConnectPtr virt, virDomainPtr handle,
+    int event, int detail, void *opaque);
+
+int main(int argc, char *argv[]) {
+  // Initialization
 
-int on_detect(struct udev_device *actual);
-bool on_remove(struct udev_device *device);
+  if (parse_option_list(argc, argv) == -1)
+    return 2;
 
-int main(int argc __attribute__((unused)), char *argv[] __attribute__((unused))) {
-  // Initialization
+  // Each libxml2 allocation (including libvirt's) must be from the arena
+  // allocator so it must be installed first
+  if (vs_arena_init() == -1)
+    return 1;
+
+  startup_start = vs_monotonic_ms();
+
+  // Block SIGHUP and SIGUSR1 (before any thread is created so that each thread
+  // inherits the mask) and receive them through a signalfd in the event loop
+  // instead
+  sigset_t signal_set;
+  sigemptyset(&signal_set);
+  sigaddset(&signal_set, SIGHUP);
+  sigaddset(&signal_set, SIGUSR1);
+  if ((errno = pthread_sigmask(SIG_BLOCK, &signal_set, NULL)) != 0)
+    vs_return(1, "pthread_sigmask(): %s\n", strerror(errno));
+
+  int signal_fd;
+  if ((signal_fd = signalfd(-1, &signal_set, SFD_NONBLOCK | SFD_CLOEXEC)) == -1)
+    vs_return(1, "signalfd(): %s\n", strerror(errno));
+
+  // The libvirt event loop must be registered before a connection is opened.
+  // It's used as the vision daemon's own event loop too.
+  if (virEventRegisterDefaultImpl() == -1)
+    goto except_event_loop;
+
+  // Each worker uses libxml2 so it must be initialized on the main thread
+  xmlInitParser();
 
   struct udev *udev;
   if ((udev = udev_new()) == NULL)
     vs_except(udev_new, "udev_new(): %s\n", strerror(errno));
 
+  if ((vs_device_list = vs_layout_load(layout_path)) == NULL)
+    goto except_layout;
+
+  if (vs_device_index() == -1)
+    goto except_device_index;
+
+  if (vs_view_index() == -1)
+    goto except_view_index;
+
   struct udev_monitor *monitor;
   if ((monitor = initialize_device_list(udev)) == NULL)
     goto except_initialize_device_list;
@@ -46,175 +351,841 @@ int main(int argc __attribute__((unused)), char *argv[] __attribute__((unused)))
   if ((virt = virConnectOpen("qemu:///system")) == NULL)
     goto except_open;
 
-  int e;
-
-  virDomainPtr *domain_list;
-  if ((e = virConnectListAllDomains(virt, &domain_list, 0)) == -1)
-    goto except_domain_list;
-  size_t domain_list_length = e;
-
-  // Loop through each domain
-  for (size_t i = 0; i < domain_list_length; i++) {
-    virDomainPtr domain = domain_list[i];
-
-    fprintf(stderr, "Initialization of domain \"%s\"\n",
-        virDomainGetName(domain));
-
-    initialize_domain(domain, VIR_DOMAIN_AFFECT_CURRENT);
+  if (vs_pool_init(worker_count, "qemu:///system") == -1)
+    goto except_pool;
 
-    if (virDomainIsActive(domain) != 1)
-      continue;
-
-    initialize_domain(domain, VIR_DOMAIN_AFFECT_CONFIG);
+  // Each device that was assigned before the pool was started is bound now
+  for (size_t i = 0; vs_device_list[i] != NULL; i++) {
+    prebind_t *prebind = (prebind_t *) vs_device_list[i]->prebind_job;
+    if (prebind != NULL && !prebind->submitted) {
+      prebind->submitted = true;
+      vs_pool_submit(&prebind->job);
+    }
   }
 
-  // Notify systemd that the vision daemon is initialized
-  sd_notify(0, "READY=1\n");
-
-  /* for (size_t i = 0; i < domain_list_length; i++) */
-  /*   virDomainFree(domain_list[i]); */
-  /* free(domain_list); */
-
-  struct pollfd pollfd = {
-    .fd = udev_monitor_get_fd(monitor), .events = POLLIN,
-  };
-
-  while ((e = poll(&pollfd, 1, -1)) > 0) {
-    if (pollfd.revents & POLLERR || pollfd.revents & POLLNVAL)
-      vs_except(poll, "Can't resume poll() on udev monitor fd\n");
-
-    struct udev_device *actual;
-    if ((actual = udev_monitor_receive_device(monitor)) == NULL)
-      vs_except(poll, "udev_monitor_receive_device(monitor): %s\n",
-          strerror(errno));
-    const char *action = udev_device_get_action(actual);
+  // Register for metadata and lifecycle changes before the domains are listed
+  // so that no change is missed. After this the domain list is maintained from
+  // these events.
+  int metadata_callback = virConnectDomainEventRegisterAny(virt, NULL,
+      VIR_DOMAIN_EVENT_ID_METADATA_CHANGE,
+      VIR_DOMAIN_EVENT_CALLBACK(on_metadata_change), NULL, NULL);
+  if (metadata_callback == -1)
+    goto except_metadata_callback;
+
+  int lifecycle_callback = virConnectDomainEventRegisterAny(virt, NULL,
+      VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+      VIR_DOMAIN_EVENT_CALLBACK(on_lifecycle), NULL, NULL);
+  if (lifecycle_callback == -1)
+    goto except_lifecycle_callback;
 
-    if (!strcmp(action, "add")) {
-      if (!udev_device_has_tag(actual, "vision"))
-        goto skip;
-      on_detect(actual);
-      for (size_t i = 0; i < domain_list_length; i++) {
-        virDomainPtr domain = domain_list[i];
-        initialize_domain(domain, VIR_DOMAIN_AFFECT_CURRENT);
+  int e;
 
-        if (virDomainIsActive(domain) != 1)
-          continue;
+  virDomainPtr *handle_list;
+  if ((e = virConnectListAllDomains(virt, &handle_list, 0)) == -1)
+    goto except_domain_list;
 
-        initialize_domain(domain, VIR_DOMAIN_AFFECT_CONFIG);
-      }
-    } else if (!strcmp(action, "remove")) {
-      if (on_remove(actual)) {
-        for (size_t i = 0; i < domain_list_length; i++) {
-          virDomainPtr domain = domain_list[i];
-          initialize_domain(domain, VIR_DOMAIN_AFFECT_CURRENT);
+  // Load the vision metadata of each domain. Each domain is pending until its
+  // first reconciliation.
+  for (int i = 0; i < e; i++) {
+    fprintf(stderr, "Initialization of domain \"%s\"\n",
+        virDomainGetName(handle_list[i]));
 
-          if (virDomainIsActive(domain) != 1)
-            continue;
+    vs_domain_t *domain;
+    if ((domain = vs_domain_add(handle_list[i])) != NULL)
+      domain->pending = true;
+    virDomainFree(handle_list[i]);
+  }
+  free(handle_list);
 
-          initialize_domain(domain, VIR_DOMAIN_AFFECT_CONFIG);
-        }
-      }
+  // A domain that was converged before a restart and is unchanged since then
+  // doesn't need its first reconciliation
+  if (vs_state_load(VS_STATE_PATH) == 0) {
+    for (vs_domain_t *domain = vs_domain_list; domain; domain = domain->next) {
+      if (!vs_state_match(domain))
+        continue;
+      fprintf(stderr, "Domain \"%s\" is unchanged since the state snapshot\n",
+          virDomainGetName(domain->domain));
+      domain->pending = false;
     }
+  }
+  vs_state_raze();
+
+  if ((settle_timer = virEventAddTimeout(-1, on_settle, NULL, NULL)) == -1)
+    goto except_settle_timer;
+
+  int watch = virEventAddHandle(udev_monitor_get_fd(monitor),
+      VIR_EVENT_HANDLE_READABLE, on_monitor, monitor, NULL);
+  if (watch == -1)
+    goto except_watch;
+
+  int signal_watch = virEventAddHandle(signal_fd,
+      VIR_EVENT_HANDLE_READABLE, on_signal, udev, NULL);
+  if (signal_watch == -1)
+    goto except_signal_watch;
+
+  // The daemon runs without metrics or the control API if either socket can't
+  // be served
+  vs_metrics_open(metrics_path);
+  vs_control_open(control_path, reconcile);
+
+  // Either notify systemd that the vision daemon is ready now and reconcile
+  // each domain in the background or run the event loop until each domain is
+  // reconciled first
+  reconcile();
+  if (early_ready) {
+    fprintf(stderr, "Vision daemon is ready before its domains converge\n");
+    sd_notify(0, "READY=1\n");
+    ready = true;
+  } else {
+    while (running && converging) {
+      if (virEventRunDefaultImpl() == -1)
+        break;
+    }
+    sd_notify(0, "READY=1\n");
+    ready = true;
+  }
 
-  skip:
-    udev_device_unref(actual);
+  while (running) {
+    if (virEventRunDefaultImpl() == -1)
+      break;
   }
 
-except_poll:
   // Shutdown
 
   sd_notify(0, "STOPPING=1\n");
 
+  fprintf(stderr, "Udev monitor delivered %zu event(s) of which %zu were for "
+      "a vision device\n", vs_metrics.event_count, vs_metrics.match_count);
+
+  running = false;
+  vs_control_close();
+  vs_metrics_close();
+  virEventRemoveHandle(signal_watch);
+  virEventRemoveHandle(watch);
+  virEventRemoveTimeout(settle_timer);
+  vs_pool_raze();
+  vs_domain_clear();
+  virConnectDomainEventDeregisterAny(virt, lifecycle_callback);
+  virConnectDomainEventDeregisterAny(virt, metadata_callback);
   virConnectClose(virt);
   udev_monitor_unref(monitor);
   for (size_t i = 0; vs_device_list[i] != NULL; i++) {
-    vs_device_t *device = vs_device_list[i];
-    if (device->actual != NULL)
-      device->actual = udev_device_unref(device->actual);
+    if (vs_device_list[i]->actual != NULL)
+      vs_device_unassign(vs_device_list[i]);
   }
+  vs_device_reap();
+  vs_view_raze();
+  vs_device_raze();
+  vs_layout_free(vs_device_list);
   udev_unref(udev);
+  close(signal_fd);
 
   return 0;
 
+except_signal_watch:
+  virEventRemoveHandle(watch);
+
+except_watch:
+  virEventRemoveTimeout(settle_timer);
+
+except_settle_timer:
+  running = false;
+  vs_pool_raze();
+  vs_domain_clear();
+
 except_domain_list:
+  virConnectDomainEventDeregisterAny(virt, lifecycle_callback);
+
+except_lifecycle_callback:
+  virConnectDomainEventDeregisterAny(virt, metadata_callback);
+
+except_metadata_callback:
+  if (vs_pool_size > 0)
+    vs_pool_raze();
+
+except_pool:
   virConnectClose(virt);
 
 except_open:
   udev_monitor_unref(monitor);
   for (size_t i = 0; vs_device_list[i] != NULL; i++) {
-    vs_device_t *device = vs_device_list[i];
-    if (device->actual != NULL)
-      device->actual = udev_device_unref(device->actual);
+    prebind_cancel(vs_device_list[i]);
+    if (vs_device_list[i]->actual != NULL)
+      vs_device_unassign(vs_device_list[i]);
   }
+  vs_device_reap();
 
 except_initialize_device_list:
+  vs_view_raze();
+
+except_view_index:
+  vs_device_raze();
+
+except_device_index:
+  vs_layout_free(vs_device_list);
+  vs_device_list = NULL;
+
+except_layout:
   udev_unref(udev);
 
 except_udev_new:
+except_event_loop:
+  close(signal_fd);
   return 1;
 }
 
-int on_detect(struct udev_device *actual) {
+int parse_option_list(int argc, char *argv[]) {
+  static const struct option option_list[] = {
+    { "early-ready",  no_argument,       NULL, 'e' },
+    { "layout",       required_argument, NULL, 'f' },
+    { "control",      required_argument, NULL, 'c' },
+    { "metrics",      required_argument, NULL, 'm' },
+    { "settle",       required_argument, NULL, 's' },
+    { "settle-limit", required_argument, NULL, 'l' },
+    { "workers",      required_argument, NULL, 'w' },
+    { "trace",        no_argument,       NULL, 't' },
+    { "help",         no_argument,       NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+  };
+
+  int c;
+  while ((c = getopt_long(
+          argc, argv, "etf:c:m:s:l:w:h", option_list, NULL)) != -1) {
+    long *target;
+    switch (c) {
+      case 'e': early_ready = true; continue;
+      case 't': vs_trace_verbose = true; continue;
+      case 'f': layout_path = optarg; continue;
+      case 'c': control_path = optarg; continue;
+      case 'm': metrics_path = optarg; continue;
+      case 's': target = &settle; break;
+      case 'l': target = &settle_limit; break;
+      case 'w': target = &worker_count; break;
+      case 'h': printf(USAGE, basename(argv[0])); exit(0);
+      default: goto except_usage;
+    }
+
+    char *string_left;
+    errno = 0;
+    long number = strtol(optarg, &string_left, 10);
+    if (*optarg == '\0' || *string_left != '\0' || errno != 0 || number < 0)
+      vs_except(usage, "%s: invalid number \"%s\"\n",
+          basename(argv[0]), optarg);
+    if (c == 'w' && (number < 1 || number > 256))
+      vs_except(usage, "%s: invalid worker count \"%s\"\n",
+          basename(argv[0]), optarg);
+    *target = number;
+  }
+
+  if (optind < argc)
+    vs_except(usage, "%s: unexpected argument \"%s\"\n",
+        basename(argv[0]), argv[optind]);
+
+  return 0;
+
+except_usage:
+  fprintf(stderr, USAGE, basename(argv[0]));
+  return -1;
+}
+
+void reconcile(void) {
+  if (reconciling)
+    return;
+
+  ssize_t length = 0;
+  if (priority && (length = vs_domain_reconcile(true, on_reconcile)) == 0) {
+    priority = false;
+    fprintf(stderr, "Autostarted domains converged %ld ms after startup\n",
+        vs_monotonic_ms() - startup_start);
+  }
+  if (!priority)
+    length = vs_domain_reconcile(false, on_reconcile);
+  reconciling = length > 0;
+
+  if (reconciling) {
+    vs_metrics.pass_count++;
+    vs_metrics.reconcile_count += length;
+  }
+
+  if (!converging)
+    return;
+
+  if (reconciling) {
+    sd_notifyf(0, "STATUS=Converging %zd %s domain(s), %zu more pending\n",
+        length, priority ? "autostarted" : "other", count_pending());
+  } else {
+    converging = false;
+    fprintf(stderr, "Domains converged %ld ms after startup\n",
+        vs_monotonic_ms() - startup_start);
+    sd_notify(0, "STATUS=Converged\n");
+  }
+}
+
+void on_reconcile(void) {
+  reconciling = false;
+  vs_state_save(VS_STATE_PATH);
+  if (!running)
+    return;
+
+  // Answer (or advance) each control command that waited on this pass before
+  // the next pass is started
+  vs_control_notify();
+  reconcile();
+}
+
+size_t count_pending(void) {
+  size_t count = 0;
+  for (vs_domain_t *domain = vs_domain_list; domain; domain = domain->next)
+    count += domain->pending;
+  return count;
+}
+
+void schedule(void) {
+  long now = vs_monotonic_ms();
+  if (burst_length == 0)
+    burst_start = now;
+  burst_until = now + settle;
+  if (burst_until > burst_start + settle_limit)
+    burst_until = burst_start + settle_limit;
+  burst_length++;
+
+  virEventUpdateTimeout(
+      settle_timer, burst_until > now ? burst_until - now : 0);
+}
+
+vs_device_t *detect_device(struct udev_device *actual) {
+  if (!udev_device_has_tag(actual, "vision"))
+    return vs_topology_find(actual);
+
   // Log an error to stderr if the device is tagged with "vision" but doesn't
   // have a VISION_NAME
   const char *vision_name;
   vision_name = udev_device_get_property_value(actual, "VISION_NAME");
   if (vision_name == NULL)
-    vs_except(vision_name,
+    vs_return(NULL,
         "udev_device_get_property_value(\"%s\", \"VISION_NAME\"): %s\n",
         udev_device_get_syspath(actual), strerror(errno));
 
+  return vs_device_find(vision_name);
+}
+
+bool on_detect(struct udev_device *actual, vs_device_t *device) {
   fprintf(stderr,
-      "Detected addition of udev device \"%s\" with VISION_NAME \"%s\"\n",
-      udev_device_get_syspath(actual), vision_name);
+      "Detected addition of udev device \"%s\" for vision device \"%s\"\n",
+      udev_device_get_syspath(actual), device->name);
+
+  // Assign the udev device to the vision device. Even if the assignment fails
+  // the vision device's prior udev device (if any) is unassigned so each
+  // domain in its views must be reconciled.
+  pthread_rwlock_wrlock(&vs_device_lock);
+  prebind_cancel(device);
+  int e = vs_device_assign(device, actual);
+  if (e == 0 && device->prebind && device->symbol.subsystem == VS_SUBSYSTEM_PCI)
+    prebind(device);
+  pthread_rwlock_unlock(&vs_device_lock);
 
-  // Assign the udev device to each vision device with the same name
-  for (size_t i = 0; vs_device_list[i] != NULL; i++) {
-    vs_device_t *device = vs_device_list[i];
+  if (e == -1)
+    fprintf(stderr,
+        "Can't assign device \"%s\" to vision device with name \"%s\"\n",
+        udev_device_get_syspath(actual), device->name);
 
-    if (strcmp(device->name, vision_name))
-      continue;
+  return vs_view_mark(device);
+}
 
-    if (vs_device_assign(device, actual) == 0)
-      continue;
+void prebind(vs_device_t *device) {
+  prebind_t *prebind;
+  if ((prebind = calloc(1, sizeof(prebind_t))) == NULL) {
+    fprintf(stderr, "Can't prebind device \"%s\": calloc(): %s\n",
+        device->name, strerror(errno));
+    return;
+  }
+  prebind->job.run = prebind_run;
+  prebind->job.done = prebind_done;
+  prebind->device = device;
+  prebind->symbol = device->symbol;
+  vs_symbol_dump(&prebind->symbol, prebind->buffer);
+
+  device->prebind_job = &prebind->job;
+  vs_view_update(device);
+
+  if (vs_pool_size > 0) {
+    prebind->submitted = true;
+    vs_pool_submit(&prebind->job);
+  }
+}
 
-    fprintf(stderr,
-        "Can't assign device \"%s\" to vision device with name \"%s\"\n",
-        udev_device_get_syspath(actual), vision_name);
+void prebind_run(vs_job_t *job, virConnectPtr virt __attribute__((unused)),
+    size_t worker __attribute__((unused))) {
+  prebind_t *prebind = (prebind_t *) job;
+
+  // A udev context isn't thread-safe so the worker has its own. The device
+  // may be freed in the meantime so its symbol is the span's device tag.
+  struct udev *udev;
+  if ((udev = udev_new()) == NULL) {
+    fprintf(stderr, "udev_new(): %s\n", strerror(errno));
+    prebind->status = -1;
+    return;
   }
 
-  return 0;
+  vs_span_t span = vs_span_begin(VS_STAGE_PREBIND, NULL, prebind->buffer);
+  prebind->status = vs_vfio_bind(udev, &prebind->symbol);
+  prebind->duration = vs_span_end(&span);
+  udev_unref(udev);
+}
 
-except_vision_name:
-  return -1;
+void prebind_done(vs_job_t *job) {
+  prebind_t *prebind = (prebind_t *) job;
+  vs_device_t *device = prebind->device;
+
+  // The result of a canceled job is discarded
+  if (device != NULL) {
+    if (prebind->status == -1) {
+      fprintf(stderr, "Can't prebind device \"%s\" (%s) to \"" VS_VFIO_DRIVER
+          "\"\n", device->name, prebind->buffer);
+    } else if (prebind->status == 0) {
+      device->prebind_duration = prebind->duration;
+      fprintf(stderr, "Prebound device \"%s\" (%s) to \"" VS_VFIO_DRIVER
+          "\" in %" PRIu64 " us\n", device->name, prebind->buffer,
+          prebind->duration / 1000);
+    }
+
+    pthread_rwlock_wrlock(&vs_device_lock);
+    device->prebind_job = NULL;
+    vs_view_update(device);
+    pthread_rwlock_unlock(&vs_device_lock);
+    vs_view_mark(device);
+  }
+  free(prebind);
+
+  // Each domain in the device's views is reconciled after the settle time.
+  // After the settle timer is removed (or before it's added) there's no pass.
+  if (running && settle_timer != -1)
+    schedule();
+}
+
+void prebind_cancel(vs_device_t *device) {
+  prebind_t *prebind = (prebind_t *) device->prebind_job;
+  if (prebind == NULL)
+    return;
+  device->prebind_job = NULL;
+
+  // A submitted job is freed when it's done
+  if (prebind->submitted) {
+    prebind->device = NULL;
+    return;
+  }
+  free(prebind);
 }
 
 bool on_remove(struct udev_device *actual) {
   const char *syspath = udev_device_get_syspath(actual);
   bool change = false;
 
-  for (size_t i = 0; vs_device_list[i] != NULL; i++) {
-    vs_device_t *device = vs_device_list[i];
-    if (device->actual == NULL)
-      continue;
-
-    if (strcmp(udev_device_get_syspath(device->actual), syspath))
-      continue;
-
+  vs_device_t *device;
+  if ((device = vs_device_find_syspath(syspath)) != NULL) {
     fprintf(stderr,
         "Udev device \"%s\" will be unassigned from device with name \"%s\"\n",
         syspath, device->name);
+    pthread_rwlock_wrlock(&vs_device_lock);
+    prebind_cancel(device);
     vs_device_unassign(device);
-    change = true;
+    pthread_rwlock_unlock(&vs_device_lock);
+
+    change |= vs_view_mark(device);
   }
 
   return change;
 }
 
+void on_monitor(
+    int watch __attribute__((unused)), int fd __attribute__((unused)),
+    int events, void *opaque) {
+  struct udev_monitor *monitor = opaque;
+
+  if (events & VIR_EVENT_HANDLE_ERROR || events & VIR_EVENT_HANDLE_HANGUP) {
+    fprintf(stderr, "Can't resume poll() on udev monitor fd\n");
+    running = false;
+    return;
+  }
+
+  vs_span_t span = vs_span_begin(VS_STAGE_UDEV_RECEIVE, NULL, NULL);
+  struct udev_device *actual = udev_monitor_receive_device(monitor);
+  vs_span_end(&span);
+  if (actual == NULL) {
+    fprintf(stderr, "udev_monitor_receive_device(monitor): %s\n",
+        strerror(errno));
+    return;
+  }
+  const char *action = udev_device_get_action(actual);
+  const char *syspath = udev_device_get_syspath(actual);
+
+  // Each udev event is applied to the device list as soon as it's received.
+  // The reconciliation of each affected domain is deferred until the burst of
+  // events settles.
+  bool change = false;
+  vs_metrics.event_count++;
+  if (!strcmp(action, "add")) {
+    vs_device_t *device;
+    if ((device = detect_device(actual)) != NULL) {
+      vs_metrics.match_count++;
+      span = vs_span_begin(VS_STAGE_DETECT, NULL, syspath);
+      change = on_detect(actual, device);
+      vs_span_end(&span);
+    }
+  } else if (!strcmp(action, "remove")) {
+    if (vs_device_find_syspath(syspath) != NULL)
+      vs_metrics.match_count++;
+    span = vs_span_begin(VS_STAGE_REMOVE, NULL, syspath);
+    change = on_remove(actual);
+    vs_span_end(&span);
+  }
+
+  udev_device_unref(actual);
+
+  if (change)
+    schedule();
+}
+
+bool reload(struct udev *udev) {
+  fprintf(stderr, "Reload of layout file \"%s\"\n", layout_path);
+  if (ready)
+    sd_notify(0, "RELOADING=1\n");
+
+  bool change = false;
+
+  vs_device_t **device_list;
+  if ((device_list = vs_layout_load(layout_path)) == NULL)
+    vs_except(layout, "Can't reload layout file \"%s\"\n", layout_path);
+
+  size_t length = 0;
+  while (device_list[length] != NULL)
+    length++;
+  size_t prior_length = 0;
+  while (vs_device_list[prior_length] != NULL)
+    prior_length++;
+
+  // The index of each device in the new layout by its name
+  vs_table_t name_table = { 0 };
+
+  // The udev device of each changed device in the new layout (by its index)
+  // to assign to it
+  struct udev_device **actual_list;
+  if ((actual_list = calloc(length + 1, sizeof(struct udev_device *))) == NULL)
+    vs_except(actual_list, "calloc(): %s\n", strerror(errno));
+
+  // Each device in the current layout that isn't kept
+  vs_device_t **drop_list;
+  if ((drop_list = calloc(prior_length + 1, sizeof(vs_device_t *))) == NULL)
+    vs_except(drop_list, "calloc(): %s\n", strerror(errno));
+  size_t drop_list_length = 0;
+
+  // The copy in the new layout (by its index) of each kept device. This is
+  // freed once the new layout is indexed.
+  vs_device_t **copy_list;
+  if ((copy_list = calloc(length + 1, sizeof(vs_device_t *))) == NULL)
+    vs_except(copy_list, "calloc(): %s\n", strerror(errno));
+
+  for (size_t i = 0; i < length; i++) {
+    vs_device_t *device = device_list[i];
+    device->index = i;
+    if (vs_table_put(&name_table,
+          device->name, strlen(device->name), device) == -1)
+      goto except_name_table;
+  }
+
+  size_t keep_count = 0;
+
+  pthread_rwlock_wrlock(&vs_device_lock);
+
+  // Match each device in the current layout to the device with the same name
+  // in the new layout
+  for (size_t i = 0; i < prior_length; i++) {
+    vs_device_t *prior = vs_device_list[i];
+    vs_device_t *device = vs_table_get(&name_table,
+        prior->name, strlen(prior->name));
+
+    // An unchanged device is kept (with its actual udev device) in place of
+    // its copy in the new layout
+    if (device != NULL && vs_layout_eq(prior, device)) {
+      copy_list[device->index] = device;
+      device_list[device->index] = prior;
+      keep_count++;
+      continue;
+    }
+
+    drop_list[drop_list_length++] = prior;
+    if (prior->actual == NULL)
+      continue;
+
+    // A changed device's actual udev device is moved to its replacement. The
+    // device itself is only unassigned once the new layout is indexed.
+    if (device != NULL)
+      actual_list[device->index] = udev_device_ref(prior->actual);
+
+    fprintf(stderr, "Device \"%s\" is %s in the layout\n",
+        prior->name, device != NULL ? "changed" : "removed");
+    change |= vs_view_mark(prior);
+  }
+
+  // Replace the device list and reconstruct each index from it
+  vs_device_t **prior_list = vs_device_list;
+  vs_view_raze();
+  vs_device_list = device_list;
+  if (vs_device_index() == -1 || vs_view_index() == -1)
+    vs_except(index, "Can't index layout file \"%s\"\n", layout_path);
+  free(prior_list);
+
+  for (size_t i = 0; i < length; i++) {
+    if (copy_list[i] != NULL)
+      vs_layout_free_device(copy_list[i]);
+  }
+
+  for (size_t i = 0; i < drop_list_length; i++) {
+    prebind_cancel(drop_list[i]);
+    if (drop_list[i]->actual != NULL)
+      vs_device_unassign(drop_list[i]);
+    vs_layout_free_device(drop_list[i]);
+  }
+
+  for (size_t i = 0; i < length; i++) {
+    if (actual_list[i] == NULL)
+      continue;
+
+    // A changed device is bound again (as on_detect() does) since its prior
+    // bind (if any) was canceled with the prior device
+    vs_device_t *device = device_list[i];
+    if (vs_device_assign(device, actual_list[i]) == -1)
+      fprintf(stderr, "Can't assign device \"%s\" to vision device with "
+          "name \"%s\"\n", udev_device_get_syspath(actual_list[i]),
+          device->name);
+    else if (device->prebind && device->symbol.subsystem == VS_SUBSYSTEM_PCI)
+      prebind(device);
+    change |= vs_view_mark(device);
+    udev_device_unref(actual_list[i]);
+  }
+
+  pthread_rwlock_unlock(&vs_device_lock);
+
+  // Each added device (or a device that wasn't assigned before) is assigned
+  // from udev
+  change |= detect_unassigned(udev);
+
+  fprintf(stderr, "Reload of layout file \"%s\" kept %zu of %zu device(s)\n",
+      layout_path, keep_count, length);
+
+  free(copy_list);
+  free(drop_list);
+  free(actual_list);
+  vs_table_raze(&name_table);
+  if (ready)
+    sd_notify(0, "READY=1\n");
+
+  return change;
+
+except_index:
+  // Restore the current layout. No device in it was changed so only its
+  // indexes must be reconstructed.
+  vs_view_raze();
+  vs_device_list = prior_list;
+  if (vs_device_index() == -1 || vs_view_index() == -1) {
+    fprintf(stderr, "Can't restore the current layout\n");
+    running = false;
+  }
+  pthread_rwlock_unlock(&vs_device_lock);
+
+  for (size_t i = 0; i < length; i++) {
+    if (copy_list[i] != NULL)
+      device_list[i] = copy_list[i];
+    if (actual_list[i] != NULL)
+      udev_device_unref(actual_list[i]);
+  }
+  fprintf(stderr, "Reload of layout file \"%s\" kept the current layout\n",
+      layout_path);
+
+except_name_table:
+  free(copy_list);
+
+except_copy_list:
+  free(drop_list);
+
+except_drop_list:
+  free(actual_list);
+
+except_actual_list:
+  vs_table_raze(&name_table);
+  vs_layout_free(device_list);
+
+except_layout:
+  if (ready)
+    sd_notify(0, "READY=1\n");
+  return change;
+}
+
+bool detect_unassigned(struct udev *udev) {
+  bool change = false;
+  int e;
+
+  struct udev_enumerate *enumerate;
+  if ((enumerate = udev_enumerate_new(udev)) == NULL)
+    vs_return(false, "udev_enumerate_new(udev): %s\n", strerror(errno));
+  if ((e = udev_enumerate_add_match_is_initialized(enumerate)) != 0)
+    vs_except(enumerate, "udev_enumerate_add_match_is_initialized(enumerate): "
+        "%s\n", strerror(-e));
+  if ((e = udev_enumerate_add_match_tag(enumerate, "vision")) != 0)
+    vs_except(enumerate, "udev_enumerate_add_match_tag(enumerate, "
+        "\"vision\"): %s\n", strerror(-e));
+  if ((e = udev_enumerate_scan_devices(enumerate)) != 0)
+    vs_except(enumerate, "udev_enumerate_scan_devices(enumerate): %s\n",
+        strerror(-e));
+
+  struct udev_list_entry *item;
+  udev_list_entry_foreach(item, udev_enumerate_get_list_entry(enumerate)) {
+    struct udev_device *actual;
+    actual = udev_device_new_from_syspath(udev, udev_list_entry_get_name(item));
+    if (actual == NULL)
+      continue;
+
+    vs_device_t *device = detect_device(actual);
+    if (device != NULL && device->actual == NULL)
+      change |= on_detect(actual, device);
+
+    udev_device_unref(actual);
+  }
+
+  vs_topology_scan(udev, detect_topology, &change);
+
+except_enumerate:
+  udev_enumerate_unref(enumerate);
+  return change;
+}
+
+void detect_topology(struct udev_device *actual, void *opaque) {
+  bool *change = opaque;
+
+  // A tagged device is detected (by its VISION_NAME) from the "vision" tag
+  if (udev_device_has_tag(actual, "vision"))
+    return;
+
+  vs_device_t *device = vs_topology_find(actual);
+  if (device != NULL && device->actual == NULL)
+    *change |= on_detect(actual, device);
+}
+
+void on_signal(
+    int watch __attribute__((unused)), int fd,
+    int events __attribute__((unused)), void *opaque) {
+  struct signalfd_siginfo info;
+
+  while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+    if (info.ssi_signo == SIGHUP && reload(opaque))
+      schedule();
+    if (info.ssi_signo == SIGUSR1)
+      vs_trace_dump(stderr);
+  }
+}
+
+void on_settle(int timer, void *opaque __attribute__((unused))) {
+  virEventUpdateTimeout(timer, -1);
+
+  fprintf(stderr, "Reconciliation after burst of %zu event(s)\n",
+      burst_length);
+  burst_length = 0;
+
+  reconcile();
+}
+
+void on_metadata_change(
+    virConnectPtr virt __attribute__((unused)), virDomainPtr handle,
+    int type, const char *nsuri, void *opaque __attribute__((unused))) {
+  if (type != VIR_DOMAIN_METADATA_ELEMENT || nsuri == NULL)
+    return;
+  if (strcmp(nsuri, VS_METADATA_URI))
+    return;
+
+  vs_domain_t *domain;
+  if ((domain = vs_domain_find_handle(handle)) == NULL)
+    return;
+
+  // This is also triggered by each of our own metadata updates. In that case
+  // the reloaded metadata is the same as the cached metadata so there's
+  // nothing to do.
+  if (vs_domain_load(domain) != 1)
+    return;
+
+  fprintf(stderr, "Vision metadata of domain \"%s\" was changed\n",
+      virDomainGetName(domain->domain));
+
+  domain->pending = true;
+  schedule();
+}
+
+void on_lifecycle(
+    virConnectPtr virt __attribute__((unused)), virDomainPtr handle,
+    int event, int detail, void *opaque __attribute__((unused))) {
+  vs_domain_t *domain = vs_domain_find_handle(handle);
+
+  switch (event) {
+    case VIR_DOMAIN_EVENT_DEFINED:
+    case VIR_DOMAIN_EVENT_STARTED:
+      if (domain == NULL) {
+        fprintf(stderr, "Domain \"%s\" was added\n",
+            virDomainGetName(handle));
+        if ((domain = vs_domain_add(handle)) == NULL)
+          return;
+        break;
+      }
+
+      if (vs_domain_load(domain) == -1)
+        return;
+
+      // A pass's own redefinition of the domain is an update. If the domain
+      // is busy then its metadata is reloaded (and compared) when the pass is
+      // done. Otherwise it's unchanged if its digest is still the converged
+      // one.
+      if (event == VIR_DOMAIN_EVENT_DEFINED
+          && detail == VIR_DOMAIN_EVENT_DEFINED_UPDATED
+          && (domain->busy || (domain->digest != 0
+              && vs_domain_digest(domain) == domain->digest))) {
+        fprintf(stderr, "Domain \"%s\" was updated without a change\n",
+            virDomainGetName(handle));
+        return;
+      }
+      break;
+
+    case VIR_DOMAIN_EVENT_UNDEFINED:
+    case VIR_DOMAIN_EVENT_STOPPED:
+      if (domain == NULL)
+        return;
+
+      // An undefined domain that's still active is now transient and a stopped
+      // domain that isn't persistent is gone
+      if (virDomainIsActive(handle) != 1 && virDomainIsPersistent(handle) != 1) {
+        fprintf(stderr, "Domain \"%s\" was removed\n",
+            virDomainGetName(handle));
+        vs_domain_drop(domain);
+        return;
+      }
+
+      if (vs_domain_load(domain) == -1)
+        return;
+      break;
+
+    default:
+      return;
+  }
+
+  // A domain that's defined or started (or stopped) may have a different
+  // device list from its cached metadata so reconcile it
+  domain->pending = true;
+  schedule();
+}
+
 struct udev_monitor *initialize_device_list(struct udev *udev) {
   int e;
 
-  // Enumerate each initialized device in udev with the "vision" tag
+  // Enumerate each initialized device in udev with the "vision" tag. Each
+  // device that's matched by its topology is scanned from its anchor hub
+  // after this.
   struct udev_enumerate *enumerate;
   if ((enumerate = udev_enumerate_new(udev)) == NULL)
     vs_except(enumerate_new, "udev_enumerate_new(udev): %s\n", strerror(errno));
@@ -237,6 +1208,21 @@ struct udev_monitor *initialize_device_list(struct udev *udev) {
         "udev_monitor_new_from_netlink(udev, \"udev\"): %s\n",
         strerror(errno));
 
+  // Each vision device is a PCI device or a USB device (rather than a USB
+  // interface). So filter by subsystem and devtype instead. These filters are
+  // installed on the monitor's socket so that the kernel drops each other
+  // event (block, net, input, and so on) before it wakes the vision daemon. A
+  // remove event still has its subsystem and devtype so it isn't dropped.
+  e = udev_monitor_filter_add_match_subsystem_devtype(monitor, "pci", NULL);
+  if (e < 0)
+    vs_except(scan, "udev_monitor_filter_add_match_subsystem_devtype("
+        "monitor, \"pci\", NULL): %s\n", strerror(-e));
+  e = udev_monitor_filter_add_match_subsystem_devtype(
+      monitor, "usb", "usb_device");
+  if (e < 0)
+    vs_except(scan, "udev_monitor_filter_add_match_subsystem_devtype("
+        "monitor, \"usb\", \"usb_device\"): %s\n", strerror(-e));
+
   // Enable receiving on the monitor and then scan the enumeration to ensure
   // that each device is seen
   if ((e = udev_monitor_enable_receiving(monitor)) != 0)
@@ -260,18 +1246,22 @@ struct udev_monitor *initialize_device_list(struct udev *udev) {
     struct udev_device *actual;
     if ((actual = udev_device_new_from_syspath(udev, syspath)) == NULL)
       continue;
-    if (!udev_device_has_tag(actual, "vision"))
-      goto skip;
     if (!udev_device_get_is_initialized(actual))
       goto skip;
 
-    on_detect(actual);
+    vs_device_t *device;
+    if ((device = detect_device(actual)) != NULL)
+      on_detect(actual, device);
 
   skip:
     udev_device_unref(actual);
   }
   enumerate = udev_enumerate_unref(enumerate);
 
+  bool change = false;
+  if (vs_topology_scan(udev, detect_topology, &change) == -1)
+    vs_except(poll, "Can't scan the anchor hub of each topology\n");
+
   // Next poll with a timeout of 0 to handle any events received during the
   // enumeration
   struct pollfd pollfd = {
@@ -289,8 +1279,9 @@ struct udev_monitor *initialize_device_list(struct udev *udev) {
     const char *action = udev_device_get_action(actual);
 
     if (!strcmp(action, "add")) {
-      if (udev_device_has_tag(actual, "vision"))
-        on_detect(actual);
+      vs_device_t *device;
+      if ((device = detect_device(actual)) != NULL)
+        on_detect(actual, device);
     } else if (!strcmp(action, "remove")) {
       on_remove(actual);
     }
@@ -305,10 +1296,11 @@ struct udev_monitor *initialize_device_list(struct udev *udev) {
 
 except_poll:
   for (size_t i = 0; vs_device_list[i] != NULL; i++) {
-    vs_device_t *device = vs_device_list[i];
-    if (device->actual != NULL)
-      device->actual = udev_device_unref(device->actual);
+    prebind_cancel(vs_device_list[i]);
+    if (vs_device_list[i]->actual != NULL)
+      vs_device_unassign(vs_device_list[i]);
   }
+  vs_device_reap();
 
 except_scan:
   udev_monitor_unref(monitor);
@@ -320,236 +1312,3 @@ except_enumerate_filter:
 except_enumerate_new:
   return NULL;
 }
-
-int initialize_domain(virDomainPtr domain, unsigned int option) {
-  char *metadata = virDomainGetMetadata(domain,
-      VIR_DOMAIN_METADATA_ELEMENT,
-      "http://github.com/ktchen14/overseer/vision",
-      option);
-
-  // This isn't a vision managed domain
-  if (metadata == NULL)
-    return 0;
-
-  // Create an XML document from the domain's vision metadata. XML isn't used as
-  // markup here so skip blanks and reduce CDATAs. Use the domain name itself as
-  // the URI (it doesn't seem to matter and we don't have a better option).
-  xmlDocPtr document = xmlReadDoc(BAD_CAST metadata, virDomainGetName(domain),
-      NULL, XML_PARSE_NOBLANKS | XML_PARSE_NOCDATA);
-  if (document == NULL)
-    vs_except(document,
-        "Can't load XML document from vision metadata of domain \"%s\"\n",
-        virDomainGetName(domain));
-
-  xmlNodePtr root;
-  if ((root = xmlDocGetRootElement(document)) == NULL)
-    vs_except(root, "No root element in vision metadata of domain \"%s\"\n",
-        virDomainGetName(domain));
-
-  // It's okay if no view is set on the domain. In this case we should detach
-  // all vision managed devices from the domain.
-  char *view = (char *) xmlGetProp(root, BAD_CAST "view");
-
-  if (view != NULL)
-    fprintf(stderr, "Domain \"%s\" is configured with view \"%s\"\n",
-        virDomainGetName(domain), view);
-  else
-    fprintf(stderr, "Domain \"%s\" is configured with no view \n",
-        virDomainGetName(domain));
-
-  // This shouldn't fail even if no <device> elements are in the metadata
-  xmlXPathContextPtr ctxt = xmlXPathNewContext(document);
-  xmlXPathObjectPtr result;
-  if ((result = xmlXPathEval(BAD_CAST "/vision/device", ctxt)) == NULL)
-    vs_except(eval,
-        "Can't read device list from vision metadata of domain \"%s\"\n",
-        virDomainGetName(domain));
-  if (result->type != XPATH_NODESET)
-    vs_except(result,
-        "Can't read device list from vision metadata of domain \"%s\"\n",
-        virDomainGetName(domain));
-
-  bool update_metadata = false; // Should the domain's metadata be updated?
-
-  for (size_t i = 0; vs_device_list[i] != NULL; i++)
-    vs_device_list[i]->action = VS_DEVICE_NONE;
-
-  // Loop through each vision managed device in the domain's metadata
-  for (int i = 0; i < xmlXPathNodeSetGetLength(result->nodesetval); i++) {
-    xmlNodePtr device_node = xmlXPathNodeSetItem(result->nodesetval, i);
-    if (device_node->type != XML_ELEMENT_NODE)
-      continue;
-
-    // Load the symbol for each device. If we can't then remove the device
-    // element.
-    char *symbol_text = (char *) xmlGetProp(device_node, BAD_CAST "symbol");
-    if (symbol_text == NULL)
-      vs_except(symbol_text,
-          "Malformed <device> element in vision metadata of domain \"%s\"\n",
-          virDomainGetName(domain));
-
-    fprintf(stderr, "Attachment #%d on domain \"%s\" is \"%s\"\n",
-        i, virDomainGetName(domain), symbol_text);
-
-    vs_symbol_t symbol;
-    if (vs_symbol_load(&symbol, symbol_text) == -1)
-      vs_except(symbol,
-          "Malformed <device> element in vision metadata of domain \"%s\"\n",
-          virDomainGetName(domain));
-
-    bool detach = true;
-
-    // Loop through each vision device to determine if this device should be
-    // detached from the domain
-    for (size_t j = 0; vs_device_list[j] != NULL; j++) {
-      vs_device_t *device = vs_device_list[j];
-
-      if (device->actual == NULL || !vs_symbol_eq(&device->symbol, &symbol))
-        continue;
-
-      fprintf(stderr, "Attachment \"%s\" is device \"%s\"\n",
-          symbol_text, device->name);
-
-      // Don't detach this device if a vision device is active in the view
-      if (vs_device_in_view(device, view)) {
-        fprintf(stderr, "Device \"%s\" is active in view \"%s\"\n",
-            device->name, view);
-        device->action = VS_DEVICE_KEEP;
-        detach = false;
-      } else {
-        fprintf(stderr, "Device \"%s\" is inactive in view \"%s\"\n",
-            device->name, view);
-        device->action = VS_DEVICE_DETACH;
-      }
-    }
-
-    // This device shouldn't be detached. Move on to the next symbol.
-    if (!detach) {
-      xmlFree(symbol_text);
-      continue;
-    }
-
-    fprintf(stderr, "Attachment \"%s\" will be detached from domain \"%s\"\n",
-        symbol_text, virDomainGetName(domain));
-
-    // Detach the device. Do a detach-device in libvirt and then remove it
-    // from the domain's vision metadata.
-
-    char *manifest;
-    if ((manifest = vs_symbol_manifest(&symbol)) == NULL)
-      goto except_manifest;
-    virDomainDetachDeviceFlags(domain, manifest, option);
-    free(manifest);
-
-  except_manifest:
-  except_symbol:
-    xmlFree(symbol_text);
-
-  except_symbol_text:
-    xmlUnlinkNode(device_node);
-    // TODO: The device node must be free()ed sometime. Can't do it here because
-    // then the xmlXPathFreeObject(result) will fail.
-    update_metadata = true;
-  }
-
-  // Loop through each vision device to determine if this device should be
-  // attached to the domain
-  for (size_t i = 0; vs_device_list[i] != NULL; i++) {
-    vs_device_t *device = vs_device_list[i];
-
-    if (device->actual == NULL)
-      continue;
-
-    // If this device is kept (from detachment) then don't append a duplicate
-    // node to the vision metadata
-    if (device->action == VS_DEVICE_KEEP)
-      continue;
-
-    if (vs_device_in_view(device, view)) {
-      fprintf(stderr, "Device \"%s\" is active in view \"%s\"\n",
-          device->name, view);
-    } else {
-      fprintf(stderr, "Device \"%s\" is inactive in view \"%s\"\n",
-          device->name, view);
-      continue;
-    }
-
-    fprintf(stderr, "Device \"%s\" will be attached to domain \"%s\"\n",
-        device->name, virDomainGetName(domain));
-
-    device->action = VS_DEVICE_ATTACH;
-
-    xmlNodePtr device_node;
-    if ((device_node = xmlNewNode(NULL, BAD_CAST "device")) == NULL)
-      vs_continue("Can't create XML <device> node\n");
-    char buffer[VS_SYMBOL_BUFFER_SIZE];
-    vs_symbol_dump(&device->symbol, buffer);
-    if (xmlSetProp(device_node, BAD_CAST "symbol", BAD_CAST buffer) == NULL)
-      vs_except(attr, "Can't set \"symbol\" attribute to \"%s\"\n", buffer);
-    if (xmlAddChild(root, device_node) == NULL)
-      vs_except(attr, "Failed to add device node to vision metadata root\n");
-    update_metadata = true;
-
-    continue;
-
-  except_attr:
-    xmlFreeNode(device_node);
-  }
-
-  // The metadata has changed (from either detachment or attachment). Update it
-  // on the domain *after* all detachments and *before* all attachments.
-  if (update_metadata) {
-    xmlChar *update;
-    int length;
-    xmlDocDumpFormatMemory(document, &update, &length, 1);
-
-    fprintf(stderr, "Metadata in domain \"%s\" will be updated to:\n%s",
-        virDomainGetName(domain), update);
-
-    virDomainSetMetadata(domain,
-        VIR_DOMAIN_METADATA_ELEMENT,
-        (char *) update,
-        "vision", "http://github.com/ktchen14/overseer/vision",
-        option);
-    free(update);
-  }
-
-  for (size_t i = 0; vs_device_list[i] != NULL; i++) {
-    vs_device_t *device = vs_device_list[i];
-    if (device->action == VS_DEVICE_NONE || device->action == VS_DEVICE_DETACH)
-      continue;
-
-    // Do an attach-device on each device marked VS_DEVICE_KEEP or
-    // VS_DEVICE_ATTACH
-
-    char *manifest;
-    if ((manifest = vs_device_manifest(device)) == NULL)
-      continue;
-    virDomainAttachDeviceFlags(domain, manifest, option);
-    free(manifest);
-  }
-
-  xmlXPathFreeObject(result);
-  if (view != NULL)
-    xmlFree(view);
-  xmlXPathFreeContext(ctxt);
-  xmlFreeDoc(document);
-  free(metadata);
-
-  return 0;
-
-except_result:
-  xmlXPathFreeObject(result);
-
-except_eval:
-  xmlXPathFreeContext(ctxt);
-  if (view != NULL)
-    xmlFree(view);
-
-except_root:
-  xmlFreeDoc(document);
-
-except_document:
-  free(metadata);
-  return -1;
-}
@@ -0,0 +1,292 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libxml/chvalid.h>
+#include <libxml/xmlreader.h>
+
+#include "device.h"
+#include "metadata.h"
+#include "status.h"
+
+/// Return the value of the attribute with the @a name on the current element
+/// of the @a reader or @c NULL if it has no such attribute. The value is valid
+/// until the @a reader is advanced.
+static const char *metadata_attribute(xmlTextReaderPtr reader, const char *name)
+  __attribute__((nonnull));
+
+/**
+ * Write the @a text escaped as an XML attribute value to the @a buffer (with no
+ * terminator) and return the length of the escaped text. If @a buffer is
+ * @c NULL then just return the length.
+ *
+ * This escapes the @a text as libxml2 does when it formats a document without
+ * an encoding: each non-ASCII character is written as a character reference.
+ */
+static size_t metadata_escape(char *buffer, const char *text)
+  __attribute__((nonnull(2)));
+
+vs_metadata_t *vs_metadata_load(const char *text, const char *name) {
+  vs_metadata_t *metadata;
+  if ((metadata = calloc(1, sizeof(vs_metadata_t))) == NULL)
+    vs_return(NULL, "calloc(): %s\n", strerror(errno));
+
+  // The vision metadata has a fixed shape so read it as a stream of nodes
+  // rather than build a tree and search it. XML isn't used as markup here so
+  // skip blanks and reduce CDATAs. Use the domain name itself as the URI (it
+  // doesn't seem to matter and we don't have a better option).
+  xmlTextReaderPtr reader = xmlReaderForMemory(text, strlen(text), name,
+      NULL, XML_PARSE_NOBLANKS | XML_PARSE_NOCDATA);
+  if (reader == NULL)
+    vs_except(reader,
+        "Can't load XML document from vision metadata of domain \"%s\"\n",
+        name);
+
+  size_t attachment_list_size = 0;
+  bool malformed = false;
+  bool root = false;
+  bool vision = false;
+  int i = 0;
+
+  int e;
+  while ((e = xmlTextReaderRead(reader)) == 1) {
+    if (xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT)
+      continue;
+
+    // As in an XPath without a prefix only an element without a namespace is
+    // matched by its name
+    const char *element = NULL;
+    if (xmlTextReaderConstNamespaceUri(reader) == NULL)
+      element = (const char *) xmlTextReaderConstLocalName(reader);
+
+    // It's okay if no view is set on the domain. In this case we should detach
+    // all vision managed devices from the domain.
+    if (xmlTextReaderDepth(reader) == 0) {
+      root = true;
+      vision = element != NULL && !strcmp(element, "vision");
+
+      const char *view = metadata_attribute(reader, "view");
+      if (view != NULL && (metadata->view = strdup(view)) == NULL)
+        vs_except(read, "strdup(): %s\n", strerror(errno));
+      continue;
+    }
+
+    if (!vision || xmlTextReaderDepth(reader) != 1 || element == NULL
+        || strcmp(element, "device"))
+      continue;
+
+    // Load the symbol of each vision managed device in the domain's metadata.
+    // If we can't then drop the device element.
+    const char *symbol_text = metadata_attribute(reader, "symbol");
+    if (symbol_text == NULL) {
+      fprintf(stderr,
+          "Malformed <device> element in vision metadata of domain \"%s\"\n",
+          name);
+      malformed = true;
+      i++;
+      continue;
+    }
+
+    fprintf(stderr, "Attachment #%d on domain \"%s\" is \"%s\"\n",
+        i++, name, symbol_text);
+
+    if (metadata->attachment_list_length == attachment_list_size) {
+      size_t size = attachment_list_size ? 2 * attachment_list_size : 4;
+      vs_symbol_t *attachment_list = realloc(metadata->attachment_list,
+          size * sizeof(vs_symbol_t));
+      if (attachment_list == NULL)
+        vs_except(read, "realloc(): %s\n", strerror(errno));
+      metadata->attachment_list = attachment_list;
+      attachment_list_size = size;
+    }
+
+    vs_symbol_t *symbol;
+    symbol = &metadata->attachment_list[metadata->attachment_list_length];
+    if (vs_symbol_load(symbol, symbol_text) == -1) {
+      fprintf(stderr,
+          "Malformed <device> element in vision metadata of domain \"%s\"\n",
+          name);
+      malformed = true;
+    } else
+      metadata->attachment_list_length++;
+  }
+
+  if (e == -1)
+    vs_except(read,
+        "Can't load XML document from vision metadata of domain \"%s\"\n",
+        name);
+  if (!root)
+    vs_except(read, "No root element in vision metadata of domain \"%s\"\n",
+        name);
+
+  xmlFreeTextReader(reader);
+
+  // If this fails then the metadata is rewritten on its next reconciliation
+  if (!malformed)
+    metadata->canonical = vs_metadata_dump(metadata);
+
+  return metadata;
+
+except_read:
+  xmlFreeTextReader(reader);
+
+except_reader:
+  vs_metadata_free(metadata);
+  return NULL;
+}
+
+char *vs_metadata_dump(const vs_metadata_t *metadata) {
+  static const char header[] = "<?xml version=\"1.0\"?>\n<vision";
+  static const char device_head[] = "  <device symbol=\"";
+  static const char device_tail[] = "\"/>\n";
+  static const char footer[] = "</vision>\n";
+
+  // Write the same document that libxml2 would format from a tree in a buffer
+  // of the exact size. An empty <vision> element is closed in place.
+  size_t size = sizeof(header) - 1 + sizeof(">\n") - 1 + sizeof(footer) - 1;
+  if (metadata->view != NULL)
+    size += sizeof(" view=\"\"") - 1 + metadata_escape(NULL, metadata->view);
+  size += metadata->attachment_list_length * (sizeof(device_head) - 1
+      + VS_SYMBOL_BUFFER_SIZE - 1 + sizeof(device_tail) - 1);
+
+  char *text;
+  if ((text = malloc(size + 1)) == NULL)
+    vs_return(NULL, "malloc(): %s\n", strerror(errno));
+
+  char *cursor = stpcpy(text, header);
+  if (metadata->view != NULL) {
+    cursor = stpcpy(cursor, " view=\"");
+    cursor += metadata_escape(cursor, metadata->view);
+    cursor = stpcpy(cursor, "\"");
+  }
+
+  if (metadata->attachment_list_length == 0) {
+    strcpy(cursor, "/>\n");
+    return text;
+  }
+
+  cursor = stpcpy(cursor, ">\n");
+  for (size_t i = 0; i < metadata->attachment_list_length; i++) {
+    cursor = stpcpy(cursor, device_head);
+    vs_symbol_dump(&metadata->attachment_list[i], cursor);
+    cursor += strlen(cursor);
+    cursor = stpcpy(cursor, device_tail);
+  }
+  strcpy(cursor, footer);
+
+  return text;
+}
+
+int vs_metadata_attach(vs_metadata_t *metadata, const vs_symbol_t *symbol) {
+  vs_symbol_t *attachment_list;
+  attachment_list = realloc(metadata->attachment_list,
+      (metadata->attachment_list_length + 1) * sizeof(vs_symbol_t));
+  if (attachment_list == NULL)
+    vs_return(-1, "realloc(): %s\n", strerror(errno));
+
+  metadata->attachment_list = attachment_list;
+  metadata->attachment_list[metadata->attachment_list_length++] = *symbol;
+
+  return 0;
+}
+
+bool vs_metadata_eq(const vs_metadata_t *a, const vs_metadata_t *b) {
+  if (a == NULL || b == NULL)
+    return a == b;
+
+  if ((a->view == NULL) != (b->view == NULL))
+    return false;
+  if (a->view != NULL && strcmp(a->view, b->view))
+    return false;
+
+  if (a->attachment_list_length != b->attachment_list_length)
+    return false;
+
+  for (size_t i = 0; i < a->attachment_list_length; i++) {
+    if (!vs_symbol_eq(&a->attachment_list[i], &b->attachment_list[i]))
+      return false;
+  }
+
+  return true;
+}
+
+void vs_metadata_free(vs_metadata_t *metadata) {
+  if (metadata == NULL)
+    return;
+
+  free(metadata->view);
+  free(metadata->attachment_list);
+  free(metadata->canonical);
+  free(metadata);
+}
+
+const char *metadata_attribute(xmlTextReaderPtr reader, const char *name) {
+  // As in xmlGetProp() an attribute is matched by its name in any namespace
+  const char *value = NULL;
+  for (int e = xmlTextReaderMoveToFirstAttribute(reader); e == 1;
+      e = xmlTextReaderMoveToNextAttribute(reader)) {
+    const char *local = (const char *) xmlTextReaderConstLocalName(reader);
+    if (xmlTextReaderIsNamespaceDecl(reader) != 1 && !strcmp(local, name)) {
+      value = (const char *) xmlTextReaderConstValue(reader);
+      break;
+    }
+  }
+  xmlTextReaderMoveToElement(reader);
+  return value;
+}
+
+size_t metadata_escape(char *buffer, const char *text) {
+  size_t length = 0;
+
+  const unsigned char *c;
+  for (c = (const unsigned char *) text; *c != '\0'; c++) {
+    char reference[sizeof("&#x10FFFF;")];
+    const char *entity;
+    switch (*c) {
+      case '<':  entity = "&lt;"; break;
+      case '>':  entity = "&gt;"; break;
+      case '&':  entity = "&amp;"; break;
+      case '"':  entity = "&quot;"; break;
+      case '\n': entity = "&#10;"; break;
+      case '\r': entity = "&#13;"; break;
+      case '\t': entity = "&#9;"; break;
+      default:
+        // A document without an encoding is ASCII so libxml2 writes each
+        // UTF-8 sequence as a character reference. It writes a byte that
+        // isn't the start of a valid character (but not a last byte) alone.
+        if (*c >= 0x80 && c[1] != '\0') {
+          unsigned long value = 0;
+          size_t size = 1;
+          if (*c >= 0xc0 && *c < 0xe0)
+            value = c[0] & 0x1f, size = 2;
+          else if (*c >= 0xe0 && *c < 0xf0 && c[2] != '\0')
+            value = c[0] & 0x0f, size = 3;
+          else if (*c >= 0xf0 && *c < 0xf8 && c[2] != '\0' && c[3] != '\0')
+            value = c[0] & 0x07, size = 4;
+          for (size_t i = 1; i < size; i++)
+            value = value << 6 | (c[i] & 0x3f);
+          if (size == 1 || !xmlIsCharQ(value))
+            value = *c, size = 1;
+          snprintf(reference, sizeof(reference), "&#x%lX;", value);
+          entity = reference;
+          c += size - 1;
+          break;
+        }
+
+        if (buffer != NULL)
+          buffer[length] = *c;
+        length++;
+        continue;
+    }
+
+    size_t size = strlen(entity);
+    if (buffer != NULL)
+      memcpy(buffer + length, entity, size);
+    length += size;
+  }
+
+  return length;
+}
@@ -0,0 +1,79 @@
+#ifndef VS_METADATA_H
+#define VS_METADATA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "device.h"
+
+/// The namespace URI of the vision metadata element in a libvirt domain
+#define VS_METADATA_URI "http://github.com/ktchen14/overseer/vision"
+
+/// The namespace prefix of the vision metadata element in a libvirt domain
+#define VS_METADATA_KEY "vision"
+
+/**
+ * The parsed vision metadata of a libvirt domain
+ *
+ * This holds the content of a metadata element in the form:
+ *
+ *   <vision view="...">
+ *     <device symbol="..." />
+ *     ...
+ *   </vision>
+ */
+typedef struct vs_metadata_t {
+  /// The view that the domain is set to or @c NULL if it has no view
+  char *view;
+
+  /// The symbol of each device attached to the domain by the vision system
+  vs_symbol_t *attachment_list;
+
+  /// The number of symbols in the @a attachment_list
+  size_t attachment_list_length;
+
+  /// The canonical serialization (from vs_metadata_dump()) of the metadata as
+  /// it's stored in the domain. If a malformed <device> element was dropped
+  /// from the metadata when it was loaded then this is @c NULL so that the
+  /// metadata is rewritten.
+  char *canonical;
+} vs_metadata_t;
+
+/**
+ * Load the vision metadata from the XML @a text. The @a name is used only in
+ * log messages.
+ *
+ * A <device> element without a valid @c symbol attribute is dropped from the
+ * metadata. The returned metadata should be freed with vs_metadata_free(). On
+ * failure this will log to @c stderr and return @c NULL.
+ *
+ * The metadata's @a canonical serialization is set unless a <device> element
+ * was dropped.
+ */
+vs_metadata_t *vs_metadata_load(const char *text, const char *name)
+  __attribute__((malloc, nonnull));
+
+/**
+ * Dump the @a metadata to an XML document with a @c vision root element
+ *
+ * The returned string should be free()ed by the caller. On failure this will
+ * log to @c stderr and return @c NULL.
+ */
+char *vs_metadata_dump(const vs_metadata_t *metadata)
+  __attribute__((malloc, nonnull));
+
+/**
+ * Append the @a symbol to the @a metadata's attachment list. On failure this
+ * will log to @c stderr and return @c -1.
+ */
+int vs_metadata_attach(vs_metadata_t *metadata, const vs_symbol_t *symbol)
+  __attribute__((nonnull));
+
+/// Return whether the metadata @a a and @a b have the same view and attachment
+/// list (regardless of @a canonical). Either metadata may be @c NULL.
+bool vs_metadata_eq(const vs_metadata_t *a, const vs_metadata_t *b);
+
+/// Free the @a metadata. If @a metadata is @c NULL then do nothing.
+void vs_metadata_free(vs_metadata_t *metadata);
+
+#endif /* VS_METADATA_H */
@@ -0,0 +1,362 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <libvirt/libvirt.h>
+
+#include "device.h"
+#include "domain.h"
+#include "metrics.h"
+#include "socket.h"
+#include "status.h"
+#include "trace.h"
+
+/// The most bytes of a request that are read before a client is answered
+#define METRICS_REQUEST_LIMIT 8192
+
+/// A client of the metrics socket
+typedef struct metrics_client_t {
+  /// The client's connected socket
+  int fd;
+
+  /// The libvirt event loop handle on the @a fd
+  int watch;
+
+  /// The number of bytes of the request that were read
+  size_t received;
+
+  /// The number of characters of the blank line (that ends an HTTP request
+  /// header) that were read last
+  size_t blank;
+
+  /// The response to the client or @c NULL if the request isn't read yet
+  char *response;
+
+  /// The number of bytes in the @a response
+  size_t response_size;
+
+  /// The number of bytes of the @a response that were sent
+  size_t sent;
+} metrics_client_t;
+
+vs_metrics_t vs_metrics;
+
+/// The name of each kind of libvirt call
+static const char *const call_name[VS_CALL_COUNT] = {
+  [VS_CALL_LOOKUP]       = "lookup",
+  [VS_CALL_GET_METADATA] = "get-metadata",
+  [VS_CALL_GET_XML_DESC] = "get-xml-desc",
+  [VS_CALL_DETACH]       = "detach",
+  [VS_CALL_ATTACH]       = "attach",
+  [VS_CALL_SET_METADATA] = "set-metadata",
+  [VS_CALL_DEFINE]       = "define",
+};
+
+/// The number of libvirt calls of each kind that succeeded (@c [0]) or failed
+/// (@c [1])
+static atomic_size_t call_count[VS_CALL_COUNT][2];
+
+/// The listening socket or @c -1 if the metrics aren't served
+static int metrics_fd = -1;
+
+/// The libvirt event loop handle on @c metrics_fd
+static int metrics_watch = -1;
+
+/// The path of the listening socket
+static char *metrics_path = NULL;
+
+/// Accept each pending client on the listening socket @a fd. This is a libvirt
+/// event loop handle callback.
+static void on_accept(int watch, int fd, int events, void *opaque);
+
+/// Read the request of the client in @a opaque and then send it the response.
+/// This is a libvirt event loop handle callback on the client's socket.
+static void on_client(int watch, int fd, int events, void *opaque);
+
+/// Close the client in @a opaque and free it. This is the libvirt event loop
+/// free callback of a client's handle.
+static void client_free(void *opaque);
+
+/// Write the metrics to the @a file in the Prometheus text exposition format
+static void metrics_write(FILE *file) __attribute__((nonnull));
+
+/// Write the @a text to the @a file as the value of a label
+static void metrics_label(FILE *file, const char *text)
+  __attribute__((nonnull));
+
+void vs_metrics_call(vs_call_t call, bool success) {
+  atomic_fetch_add_explicit(
+      &call_count[call][!success], 1, memory_order_relaxed);
+}
+
+int vs_metrics_open(const char *path) {
+  if ((metrics_path = strdup(path)) == NULL)
+    vs_return(-1, "strdup(): %s\n", strerror(errno));
+
+  if ((metrics_fd = vs_socket_listen(path)) == -1)
+    goto except_listen;
+
+  metrics_watch = virEventAddHandle(metrics_fd,
+      VIR_EVENT_HANDLE_READABLE, on_accept, NULL, NULL);
+  if (metrics_watch == -1)
+    vs_except(watch, "Can't watch metrics socket \"%s\"\n", path);
+
+  return 0;
+
+except_watch:
+  unlink(path);
+  close(metrics_fd);
+  metrics_fd = -1;
+
+except_listen:
+  free(metrics_path);
+  metrics_path = NULL;
+  return -1;
+}
+
+void vs_metrics_close(void) {
+  if (metrics_fd == -1)
+    return;
+
+  virEventRemoveHandle(metrics_watch);
+  metrics_watch = -1;
+  close(metrics_fd);
+  metrics_fd = -1;
+
+  unlink(metrics_path);
+  free(metrics_path);
+  metrics_path = NULL;
+}
+
+void on_accept(
+    int watch __attribute__((unused)), int fd,
+    int events __attribute__((unused)), void *opaque __attribute__((unused))) {
+  int client_fd;
+  while ((client_fd = accept4(fd, NULL, NULL,
+          SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+    metrics_client_t *client;
+    if ((client = calloc(1, sizeof(metrics_client_t))) == NULL) {
+      fprintf(stderr, "calloc(): %s\n", strerror(errno));
+      close(client_fd);
+      continue;
+    }
+    client->fd = client_fd;
+
+    client->watch = virEventAddHandle(client_fd,
+        VIR_EVENT_HANDLE_READABLE, on_client, client, client_free);
+    if (client->watch == -1) {
+      fprintf(stderr, "Can't watch metrics client\n");
+      client_free(client);
+    }
+  }
+
+  if (errno != EAGAIN && errno != EWOULDBLOCK)
+    fprintf(stderr, "accept4(): %s\n", strerror(errno));
+}
+
+void on_client(int watch, int fd, int events, void *opaque) {
+  metrics_client_t *client = opaque;
+
+  if (client->response == NULL) {
+    // Read the request until the blank line that ends its header. The request
+    // itself is ignored since there's only one response.
+    bool done = events & (VIR_EVENT_HANDLE_ERROR | VIR_EVENT_HANDLE_HANGUP);
+    while (!done) {
+      char buffer[512];
+      ssize_t size = read(fd, buffer, sizeof(buffer));
+      if (size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+      if (size == -1) {
+        virEventRemoveHandle(watch);
+        return;
+      }
+
+      done = size == 0;
+      for (ssize_t i = 0; i < size && !done; i++) {
+        if (buffer[i] == "\r\n\r\n"[client->blank])
+          client->blank++;
+        else
+          client->blank = buffer[i] == '\r';
+        done = client->blank == 4;
+      }
+      client->received += size;
+      done |= client->received >= METRICS_REQUEST_LIMIT;
+    }
+
+    char *body;
+    size_t body_size;
+    FILE *file;
+    if ((file = open_memstream(&body, &body_size)) == NULL) {
+      fprintf(stderr, "open_memstream(): %s\n", strerror(errno));
+      virEventRemoveHandle(watch);
+      return;
+    }
+    metrics_write(file);
+    fclose(file);
+
+    int e = asprintf(&client->response,
+        "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+        "Content-Length: %zu\r\n"
+        "Connection: close\r\n"
+        "\r\n"
+        "%s", body_size, body);
+    free(body);
+    if (e == -1) {
+      fprintf(stderr, "asprintf(): %s\n", strerror(errno));
+      client->response = NULL;
+      virEventRemoveHandle(watch);
+      return;
+    }
+    client->response_size = e;
+
+    virEventUpdateHandle(watch, VIR_EVENT_HANDLE_WRITABLE);
+  }
+
+  // Send as much of the response as the socket takes and wait for the rest
+  while (client->sent < client->response_size) {
+    ssize_t size = send(fd, client->response + client->sent,
+        client->response_size - client->sent, MSG_NOSIGNAL);
+    if (size == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return;
+    if (size == -1)
+      break;
+    client->sent += size;
+  }
+
+  virEventRemoveHandle(watch);
+}
+
+void client_free(void *opaque) {
+  metrics_client_t *client = opaque;
+  close(client->fd);
+  free(client->response);
+  free(client);
+}
+
+void metrics_write(FILE *file) {
+  fprintf(file,
+      "# HELP vision_udev_events_total Events delivered by the udev monitor.\n"
+      "# TYPE vision_udev_events_total counter\n"
+      "vision_udev_events_total{outcome=\"matched\"} %zu\n"
+      "vision_udev_events_total{outcome=\"filtered\"} %zu\n",
+      vs_metrics.match_count, vs_metrics.event_count - vs_metrics.match_count);
+
+  fprintf(file,
+      "# HELP vision_passes_total Passes of reconciliation started.\n"
+      "# TYPE vision_passes_total counter\n"
+      "vision_passes_total %zu\n"
+      "# HELP vision_reconciliations_total Domains reconciled in a pass.\n"
+      "# TYPE vision_reconciliations_total counter\n"
+      "vision_reconciliations_total{outcome=\"success\"} %zu\n"
+      "vision_reconciliations_total{outcome=\"failure\"} %zu\n",
+      vs_metrics.pass_count,
+      vs_metrics.reconcile_count - vs_metrics.failure_count,
+      vs_metrics.failure_count);
+
+  fprintf(file,
+      "# HELP vision_libvirt_calls_total Libvirt calls on a domain.\n"
+      "# TYPE vision_libvirt_calls_total counter\n");
+  for (size_t i = 0; i < VS_CALL_COUNT; i++) {
+    fprintf(file,
+        "vision_libvirt_calls_total{call=\"%s\",outcome=\"success\"} %zu\n"
+        "vision_libvirt_calls_total{call=\"%s\",outcome=\"failure\"} %zu\n",
+        call_name[i], atomic_load(&call_count[i][0]),
+        call_name[i], atomic_load(&call_count[i][1]));
+  }
+
+  fprintf(file,
+      "# HELP vision_device_assignments_total Udev devices assigned to a "
+      "vision device.\n"
+      "# TYPE vision_device_assignments_total counter\n"
+      "vision_device_assignments_total{outcome=\"success\"} %zu\n"
+      "vision_device_assignments_total{outcome=\"failure\"} %zu\n"
+      "# HELP vision_device_unassignments_total Udev devices unassigned from a "
+      "vision device.\n"
+      "# TYPE vision_device_unassignments_total counter\n"
+      "vision_device_unassignments_total %zu\n",
+      vs_metrics.assign_count, vs_metrics.assign_failure_count,
+      vs_metrics.unassign_count);
+
+  // The device list is only changed on the main thread so it's read here
+  // without the device lock
+  size_t assigned = 0;
+  size_t unassigned = 0;
+  fprintf(file,
+      "# HELP vision_device_assigned Whether a vision device is assigned a "
+      "udev device.\n"
+      "# TYPE vision_device_assigned gauge\n");
+  for (size_t i = 0; vs_device_list != NULL && vs_device_list[i]; i++) {
+    vs_device_t *device = vs_device_list[i];
+    if (device->actual != NULL)
+      assigned++;
+    else
+      unassigned++;
+
+    fputs("vision_device_assigned{device=\"", file);
+    metrics_label(file, device->name);
+    fprintf(file, "\"} %d\n", device->actual != NULL);
+  }
+  fprintf(file,
+      "# HELP vision_device_prebind_seconds Duration of a vision device's last "
+      "binding to vfio-pci when it was detected.\n"
+      "# TYPE vision_device_prebind_seconds gauge\n");
+  for (size_t i = 0; vs_device_list != NULL && vs_device_list[i]; i++) {
+    vs_device_t *device = vs_device_list[i];
+    if (device->prebind_duration == 0)
+      continue;
+
+    fputs("vision_device_prebind_seconds{device=\"", file);
+    metrics_label(file, device->name);
+    fprintf(file, "\"} %.9f\n", (double) device->prebind_duration / 1e9);
+  }
+
+  fprintf(file,
+      "# HELP vision_devices Vision devices in the layout.\n"
+      "# TYPE vision_devices gauge\n"
+      "vision_devices{state=\"assigned\"} %zu\n"
+      "vision_devices{state=\"unassigned\"} %zu\n",
+      assigned, unassigned);
+
+  size_t managed = 0;
+  size_t unmanaged = 0;
+  size_t pending = 0;
+  for (vs_domain_t *domain = vs_domain_list; domain; domain = domain->next) {
+    if (domain->current != NULL || domain->config != NULL)
+      managed++;
+    else
+      unmanaged++;
+    pending += domain->pending;
+  }
+  fprintf(file,
+      "# HELP vision_domains Libvirt domains known to the vision daemon.\n"
+      "# TYPE vision_domains gauge\n"
+      "vision_domains{state=\"managed\"} %zu\n"
+      "vision_domains{state=\"unmanaged\"} %zu\n"
+      "# HELP vision_domains_pending Domains that must be reconciled.\n"
+      "# TYPE vision_domains_pending gauge\n"
+      "vision_domains_pending %zu\n",
+      managed, unmanaged, pending);
+
+  vs_trace_expose(file);
+}
+
+void metrics_label(FILE *file, const char *text) {
+  for (; *text != '\0'; text++) {
+    switch (*text) {
+      case '\\': fputs("\\\\", file); break;
+      case '"':  fputs("\\\"", file); break;
+      case '\n': fputs("\\n", file); break;
+      default:   fputc(*text, file); break;
+    }
+  }
+}
@@ -0,0 +1,73 @@
+#ifndef VS_METRICS_H
+#define VS_METRICS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/// The path of the metrics socket
+#define VS_METRICS_PATH "/run/vision/metrics"
+
+/// A kind of libvirt call on a domain that's counted by its outcome
+typedef enum vs_call_t {
+  VS_CALL_LOOKUP,           ///< A virDomainLookupByUUID() call
+  VS_CALL_GET_METADATA,     ///< A virDomainGetMetadata() call
+  VS_CALL_GET_XML_DESC,     ///< A virDomainGetXMLDesc() call
+  VS_CALL_DETACH,           ///< A virDomainDetachDeviceFlags() call
+  VS_CALL_ATTACH,           ///< A virDomainAttachDeviceFlags() call
+  VS_CALL_SET_METADATA,     ///< A virDomainSetMetadata() call
+  VS_CALL_DEFINE,           ///< A virDomainDefineXML() call
+  VS_CALL_COUNT,            ///< The number of kinds
+} vs_call_t;
+
+/// The counters of the vision daemon. Each is only updated on the main thread.
+typedef struct vs_metrics_t {
+  /// The number of events delivered by the udev monitor
+  size_t event_count;
+
+  /// The number of events delivered by the udev monitor that were for a vision
+  /// device. The rest were filtered out.
+  size_t match_count;
+
+  /// The number of passes of reconciliation started
+  size_t pass_count;
+
+  /// The number of domains in each pass of reconciliation
+  size_t reconcile_count;
+
+  /// The number of domains that failed in a pass of reconciliation
+  size_t failure_count;
+
+  /// The number of udev devices assigned to a vision device
+  size_t assign_count;
+
+  /// The number of udev devices that couldn't be assigned to a vision device
+  size_t assign_failure_count;
+
+  /// The number of udev devices unassigned from a vision device
+  size_t unassign_count;
+} vs_metrics_t;
+
+/// The counters of the vision daemon
+extern vs_metrics_t vs_metrics;
+
+/// Count a libvirt @a call by whether it was a @a success. This may be called
+/// on any thread.
+void vs_metrics_call(vs_call_t call, bool success);
+
+/**
+ * Serve the metrics on a Unix socket at @a path from the libvirt event loop
+ *
+ * Each client is sent the counters, the gauges of the device and domain lists,
+ * and the latency histogram of each stage (from vs_trace_expose()) in the
+ * Prometheus text exposition format as an HTTP response. A client is served
+ * without blocking so a slow client never delays event handling. Any socket
+ * already at @a path is replaced. On failure this will log to @c stderr and
+ * return @c -1.
+ */
+int vs_metrics_open(const char *path) __attribute__((nonnull));
+
+/// Stop serving the metrics and remove the socket. Each client that's still
+/// connected is disconnected.
+void vs_metrics_close(void);
+
+#endif /* VS_METRICS_H */
@@ -0,0 +1,215 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <libvirt/libvirt.h>
+
+#include "pool.h"
+#include "status.h"
+
+size_t vs_pool_size = 0;
+
+/// The lock on the pool's queue, its done list, and @c pool_stopping
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/// Signaled when a job is added to the queue or when the pool is stopping
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+
+/// The jobs waiting for a worker in the order that they were submitted
+static vs_job_t *queue_head = NULL, **queue_tail = &queue_head;
+
+/// The jobs that were run and wait for their @a done on the main thread
+static vs_job_t *done_head = NULL, **done_tail = &done_head;
+
+/// Whether each worker should exit once the queue is empty
+static bool pool_stopping = false;
+
+/// The thread of each worker
+static pthread_t *thread_list = NULL;
+
+/// The libvirt connection of each worker
+static virConnectPtr *connection_list = NULL;
+
+/// The number of connections in @c connection_list. This may be more than
+/// @c vs_pool_size if a worker couldn't be started.
+static size_t connection_count = 0;
+
+/// An eventfd written by a worker when it adds a job to the done list
+static int done_fd = -1;
+
+/// The libvirt event loop handle on @c done_fd
+static int done_watch = -1;
+
+/// Run each job from the queue on the worker with the index in @a opaque
+static void *pool_work(void *opaque);
+
+/// Call the @a done function of each job in the done list. This is a libvirt
+/// event loop handle callback on @c done_fd.
+static void on_done(int watch, int fd, int events, void *opaque);
+
+/// Call the @a done function of each job in the done list
+static void pool_complete(void);
+
+int vs_pool_init(size_t size, const char *uri) {
+  if ((done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == -1)
+    vs_return(-1, "eventfd(): %s\n", strerror(errno));
+
+  done_watch = virEventAddHandle(done_fd,
+      VIR_EVENT_HANDLE_READABLE, on_done, NULL, NULL);
+  if (done_watch == -1)
+    vs_except(watch, "Can't add handle on done fd to event loop\n");
+
+  if ((thread_list = calloc(size, sizeof(pthread_t))) == NULL)
+    vs_except(alloc, "calloc(): %s\n", strerror(errno));
+  if ((connection_list = calloc(size, sizeof(virConnectPtr))) == NULL)
+    vs_except(alloc, "calloc(): %s\n", strerror(errno));
+
+  for (size_t i = 0; i < size; i++) {
+    if ((connection_list[i] = virConnectOpen(uri)) == NULL)
+      vs_except(alloc, "Can't open libvirt connection for worker %zu\n", i);
+  }
+  connection_count = size;
+
+  for (; vs_pool_size < size; vs_pool_size++) {
+    int e = pthread_create(&thread_list[vs_pool_size], NULL,
+        pool_work, (void *) (uintptr_t) vs_pool_size);
+    if (e != 0) {
+      fprintf(stderr, "pthread_create(): %s\n", strerror(e));
+      vs_pool_raze();
+      return -1;
+    }
+  }
+
+  return 0;
+
+except_alloc:
+  for (size_t i = 0; connection_list != NULL && i < size; i++) {
+    if (connection_list[i] != NULL)
+      virConnectClose(connection_list[i]);
+  }
+  free(connection_list);
+  free(thread_list);
+  connection_list = NULL;
+  thread_list = NULL;
+  virEventRemoveHandle(done_watch);
+
+except_watch:
+  close(done_fd);
+  done_fd = -1;
+  return -1;
+}
+
+void vs_pool_submit(vs_job_t *job) {
+  job->next = NULL;
+
+  pthread_mutex_lock(&pool_mutex);
+  *queue_tail = job;
+  queue_tail = &job->next;
+  pthread_cond_signal(&pool_cond);
+  pthread_mutex_unlock(&pool_mutex);
+}
+
+void vs_pool_raze(void) {
+  pthread_mutex_lock(&pool_mutex);
+  pool_stopping = true;
+  pthread_cond_broadcast(&pool_cond);
+  pthread_mutex_unlock(&pool_mutex);
+
+  for (size_t i = 0; i < vs_pool_size; i++)
+    pthread_join(thread_list[i], NULL);
+
+  // Each job has run so complete each of them here. A done function may submit
+  // another job so repeat this until there's nothing left to do.
+  while (queue_head != NULL || done_head != NULL) {
+    for (vs_job_t *job; (job = queue_head) != NULL; ) {
+      if ((queue_head = job->next) == NULL)
+        queue_tail = &queue_head;
+      job->arena_size = 0;
+      job->run(job, connection_list[0], 0);
+      *done_tail = job;
+      done_tail = &job->next;
+      job->next = NULL;
+    }
+    pool_complete();
+  }
+
+  for (size_t i = 0; i < connection_count; i++)
+    virConnectClose(connection_list[i]);
+  free(connection_list);
+  free(thread_list);
+  connection_list = NULL;
+  thread_list = NULL;
+  connection_count = 0;
+  vs_pool_size = 0;
+  pool_stopping = false;
+
+  virEventRemoveHandle(done_watch);
+  close(done_fd);
+  done_watch = done_fd = -1;
+}
+
+void *pool_work(void *opaque) {
+  size_t worker = (uintptr_t) opaque;
+  virConnectPtr virt = connection_list[worker];
+
+  pthread_mutex_lock(&pool_mutex);
+  while (true) {
+    while (queue_head == NULL && !pool_stopping)
+      pthread_cond_wait(&pool_cond, &pool_mutex);
+    if (queue_head == NULL)
+      break;
+
+    vs_job_t *job = queue_head;
+    if ((queue_head = job->next) == NULL)
+      queue_tail = &queue_head;
+    pthread_mutex_unlock(&pool_mutex);
+
+    job->arena_size = 0;
+    job->run(job, virt, worker);
+
+    pthread_mutex_lock(&pool_mutex);
+    job->next = NULL;
+    *done_tail = job;
+    done_tail = &job->next;
+
+    uint64_t one = 1;
+    if (write(done_fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+      fprintf(stderr, "write(done_fd): %s\n", strerror(errno));
+  }
+  pthread_mutex_unlock(&pool_mutex);
+
+  return NULL;
+}
+
+void on_done(
+    int watch __attribute__((unused)), int fd,
+    int events __attribute__((unused)), void *opaque __attribute__((unused))) {
+  uint64_t count;
+  if (read(fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+    fprintf(stderr, "read(done_fd): %s\n", strerror(errno));
+
+  pool_complete();
+}
+
+void pool_complete(void) {
+  pthread_mutex_lock(&pool_mutex);
+  vs_job_t *job = done_head;
+  done_head = NULL;
+  done_tail = &done_head;
+  pthread_mutex_unlock(&pool_mutex);
+
+  while (job != NULL) {
+    vs_job_t *next = job->next;
+    if (job->done != NULL)
+      job->done(job);
+    job = next;
+  }
+}
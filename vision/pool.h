@@ -0,0 +1,55 @@
+#ifndef VS_POOL_H
+#define VS_POOL_H
+
+#include <stddef.h>
+
+#include <libvirt/libvirt.h>
+
+/**
+ * A job to run on a worker in the pool
+ *
+ * A job is usually embedded in a larger structure. Its @a run function is
+ * called on a worker thread and then its @a done function is called on the
+ * main thread (from the libvirt event loop).
+ */
+typedef struct vs_job_t {
+  /// The next job in the pool's queue
+  struct vs_job_t *next;
+
+  /// Run the @a job on the @a worker with the worker's own libvirt connection
+  /// @a virt
+  void (*run)(struct vs_job_t *job, virConnectPtr virt, size_t worker);
+
+  /// Complete the @a job on the main thread. This may be @c NULL.
+  void (*done)(struct vs_job_t *job);
+
+  /// The number of bytes allocated from the worker's arena by the last run of
+  /// the job. This is reset before each run and added to by the job itself
+  /// from each arena scope that it ends. No job holds a scope across a libvirt
+  /// call.
+  size_t arena_size;
+} vs_job_t;
+
+/// The number of workers in the pool
+extern size_t vs_pool_size;
+
+/**
+ * Start @a size workers each with its own libvirt connection to @a uri
+ *
+ * This must be called after the libvirt event loop is registered. On failure
+ * this will log to @c stderr and return @c -1.
+ */
+int vs_pool_init(size_t size, const char *uri) __attribute__((nonnull));
+
+/// Add the @a job to the pool's queue. The @a job must not be in the queue.
+void vs_pool_submit(vs_job_t *job) __attribute__((nonnull));
+
+/**
+ * Stop each worker and close its libvirt connection
+ *
+ * Each job already in the queue is run and then the @a done function of each
+ * job is called before this returns.
+ */
+void vs_pool_raze(void);
+
+#endif /* VS_POOL_H */
@@ -0,0 +1,57 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libgen.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "socket.h"
+#include "status.h"
+
+int vs_socket_listen(const char *path) {
+  struct sockaddr_un address = { .sun_family = AF_UNIX };
+  if (strlen(path) >= sizeof(address.sun_path))
+    vs_return(-1, "Socket path \"%s\" is too long\n", path);
+  strcpy(address.sun_path, path);
+
+  // The directory of the socket may not exist (yet) in /run
+  char *directory;
+  if ((directory = strdup(path)) == NULL)
+    vs_return(-1, "strdup(): %s\n", strerror(errno));
+  if (mkdir(dirname(directory), 0755) == -1 && errno != EEXIST) {
+    fprintf(stderr, "mkdir(\"%s\"): %s\n", directory, strerror(errno));
+    free(directory);
+    return -1;
+  }
+  free(directory);
+
+  int fd;
+  if ((fd = socket(
+          AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1)
+    vs_return(-1, "socket(): %s\n", strerror(errno));
+
+  // Replace the socket of a prior daemon
+  if (unlink(path) == -1 && errno != ENOENT)
+    vs_except(socket, "unlink(\"%s\"): %s\n", path, strerror(errno));
+
+  if (bind(fd, (struct sockaddr *) &address, sizeof(address)) == -1)
+    vs_except(socket, "bind(\"%s\"): %s\n", path, strerror(errno));
+
+  if (listen(fd, 16) == -1)
+    vs_except(bind, "listen(\"%s\"): %s\n", path, strerror(errno));
+
+  return fd;
+
+except_bind:
+  unlink(path);
+
+except_socket:
+  close(fd);
+  return -1;
+}
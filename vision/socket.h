@@ -0,0 +1,13 @@
+#ifndef VS_SOCKET_H
+#define VS_SOCKET_H
+
+/**
+ * Create a nonblocking Unix stream socket that listens at @a path
+ *
+ * The directory of @a path is created if it doesn't exist and any socket
+ * already at @a path (from a prior daemon) is replaced. Return the socket's fd.
+ * On failure this will log to @c stderr and return @c -1.
+ */
+int vs_socket_listen(const char *path) __attribute__((nonnull));
+
+#endif /* VS_SOCKET_H */
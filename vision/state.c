@@ -0,0 +1,184 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libgen.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <libvirt/libvirt.h>
+
+#include "domain.h"
+#include "state.h"
+#include "status.h"
+#include "table.h"
+
+/// The first line of a snapshot. This is changed whenever the format of the
+/// snapshot or of a domain's digest is changed to invalidate each old snapshot.
+#define STATE_HEADER "vision-state 1"
+
+/// A domain in the snapshot
+typedef struct state_entry_t {
+  /// The UUID of the domain
+  unsigned char uuid[VIR_UUID_BUFLEN];
+
+  /// The digest of the domain when the snapshot was saved
+  uint64_t digest;
+} state_entry_t;
+
+/// Each domain in the loaded snapshot
+static state_entry_t *state_list = NULL;
+
+/// The index of each entry in @c state_list by its UUID
+static vs_table_t state_table;
+
+/// Read the UUID in the @a text (as 32 hex digits with no delimiter) into
+/// @a uuid. If the @a text isn't a UUID then return @c -1.
+static int state_uuid(const char *text, unsigned char uuid[VIR_UUID_BUFLEN])
+  __attribute__((nonnull));
+
+int vs_state_load(const char *path) {
+  vs_state_raze();
+
+  FILE *file;
+  if ((file = fopen(path, "r")) == NULL) {
+    if (errno == ENOENT)
+      return 0;
+    vs_return(-1, "fopen(\"%s\"): %s\n", path, strerror(errno));
+  }
+
+  char *line = NULL;
+  size_t line_size = 0;
+  size_t length = 0;
+
+  // Ignore a snapshot in an unknown format
+  if (getline(&line, &line_size, file) == -1
+      || strcmp(line, STATE_HEADER "\n"))
+    vs_except(header, "Ignoring snapshot \"%s\" in an unknown format\n", path);
+
+  while (getline(&line, &line_size, file) != -1) {
+    char uuid[2 * VIR_UUID_BUFLEN + 1];
+    uint64_t digest;
+    if (sscanf(line, "%32s %" SCNx64, uuid, &digest) != 2)
+      continue;
+
+    state_entry_t *entry_list;
+    entry_list = realloc(state_list, (length + 1) * sizeof(state_entry_t));
+    if (entry_list == NULL)
+      vs_except(list, "realloc(): %s\n", strerror(errno));
+    state_list = entry_list;
+
+    if (state_uuid(uuid, state_list[length].uuid) == -1)
+      continue;
+    state_list[length++].digest = digest;
+  }
+
+  for (size_t i = 0; i < length; i++) {
+    if (vs_table_put(&state_table,
+          state_list[i].uuid, VIR_UUID_BUFLEN, &state_list[i]) == -1)
+      goto except_list;
+  }
+
+  free(line);
+  fclose(file);
+
+  fprintf(stderr, "Loaded %zu domain(s) from snapshot \"%s\"\n", length, path);
+
+  return 0;
+
+except_list:
+  vs_state_raze();
+
+except_header:
+  free(line);
+  fclose(file);
+  return -1;
+}
+
+bool vs_state_match(vs_domain_t *domain) {
+  state_entry_t *entry = vs_table_get(
+      &state_table, domain->uuid, VIR_UUID_BUFLEN);
+  if (entry == NULL)
+    return false;
+
+  uint64_t digest = vs_domain_digest(domain);
+  if (digest == 0 || digest != entry->digest)
+    return false;
+
+  domain->digest = digest;
+  return true;
+}
+
+void vs_state_raze(void) {
+  vs_table_raze(&state_table);
+  free(state_list);
+  state_list = NULL;
+}
+
+int vs_state_save(const char *path) {
+  // The directory of the snapshot may not exist (yet) in /run
+  char *directory;
+  if ((directory = strdup(path)) == NULL)
+    vs_return(-1, "strdup(): %s\n", strerror(errno));
+  if (mkdir(dirname(directory), 0755) == -1 && errno != EEXIST) {
+    fprintf(stderr, "mkdir(\"%s\"): %s\n", directory, strerror(errno));
+    free(directory);
+    return -1;
+  }
+  free(directory);
+
+  char *temporary;
+  if (asprintf(&temporary, "%s.tmp", path) == -1)
+    vs_return(-1, "asprintf(): %s\n", strerror(errno));
+
+  FILE *file;
+  if ((file = fopen(temporary, "w")) == NULL)
+    vs_except(open, "fopen(\"%s\"): %s\n", temporary, strerror(errno));
+
+  fputs(STATE_HEADER "\n", file);
+  for (vs_domain_t *domain = vs_domain_list; domain; domain = domain->next) {
+    if (domain->digest == 0 || domain->pending)
+      continue;
+
+    for (size_t i = 0; i < VIR_UUID_BUFLEN; i++)
+      fprintf(file, "%02x", domain->uuid[i]);
+    fprintf(file, " %016" PRIx64 "\n", domain->digest);
+  }
+
+  if (ferror(file) | fclose(file))
+    vs_except(write, "Can't write snapshot \"%s\"\n", temporary);
+
+  if (rename(temporary, path) == -1)
+    vs_except(write, "rename(\"%s\", \"%s\"): %s\n",
+        temporary, path, strerror(errno));
+
+  free(temporary);
+  return 0;
+
+except_write:
+  unlink(temporary);
+
+except_open:
+  free(temporary);
+  return -1;
+}
+
+int state_uuid(const char *text, unsigned char uuid[VIR_UUID_BUFLEN]) {
+  if (strlen(text) != 2 * VIR_UUID_BUFLEN)
+    return -1;
+
+  for (size_t i = 0; i < VIR_UUID_BUFLEN; i++) {
+    unsigned int byte;
+    if (sscanf(text + 2 * i, "%2x", &byte) != 1)
+      return -1;
+    uuid[i] = byte;
+  }
+
+  return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef VS_STATE_H
+#define VS_STATE_H
+
+#include <stdbool.h>
+
+#include "domain.h"
+
+/// The path of the state snapshot. It's in @c /run so that it doesn't survive a
+/// reboot (when each domain is stopped anyway).
+#define VS_STATE_PATH "/run/vision/state"
+
+/**
+ * Load the state snapshot at @a path
+ *
+ * The snapshot has the UUID and digest (from vs_domain_digest()) of each
+ * domain that was converged when it was saved. If there's no snapshot at
+ * @a path then this will load an empty snapshot and return @c 0. On failure
+ * this will log to @c stderr and return @c -1.
+ */
+int vs_state_load(const char *path) __attribute__((nonnull));
+
+/// Return whether the @a domain is in the loaded snapshot with the same digest
+/// as it has now. If it is then the @a domain's digest is set.
+bool vs_state_match(vs_domain_t *domain) __attribute__((nonnull));
+
+/// Release the loaded snapshot
+void vs_state_raze(void);
+
+/**
+ * Save the UUID and digest of each converged domain in @c vs_domain_list to a
+ * snapshot at @a path
+ *
+ * The snapshot is written to a temporary file that's then renamed to @a path so
+ * that it's never read incomplete. On failure this will log to @c stderr and
+ * return @c -1.
+ */
+int vs_state_save(const char *path) __attribute__((nonnull));
+
+#endif /* VS_STATE_H */
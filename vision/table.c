@@ -0,0 +1,170 @@
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "status.h"
+#include "table.h"
+
+/// The number of buckets allocated in a table on its first insertion
+#define TABLE_INITIAL_SIZE 16
+
+/// An entry in a chain of a table's bucket
+typedef struct vs_table_entry_t {
+  /// The next entry in the chain
+  struct vs_table_entry_t *next;
+
+  /// The hash of the entry's key
+  uint64_t hash;
+
+  /// The entry's value
+  void *value;
+
+  /// The number of bytes in the entry's key
+  size_t size;
+
+  /// The entry's key
+  unsigned char key[];
+} vs_table_entry_t;
+
+/**
+ * Return the location of the pointer to the entry with the @a key in the
+ * @a table's chain for the @a hash. If there's no such entry then the pointer
+ * at the location is @c NULL. The @a table must have a bucket list.
+ */
+static vs_table_entry_t **table_locate(const vs_table_t *table,
+    uint64_t hash, const void *key, size_t size)
+  __attribute__((nonnull));
+
+/// Double the number of buckets in the @a table. On failure this will log to
+/// @c stderr and return @c -1.
+static int table_grow(vs_table_t *table) __attribute__((nonnull));
+
+uint64_t vs_table_hash(const void *key, size_t size) {
+  const unsigned char *byte = key;
+  uint64_t hash = UINT64_C(0xcbf29ce484222325);
+
+  for (size_t i = 0; i < size; i++) {
+    hash ^= byte[i];
+    hash *= UINT64_C(0x100000001b3);
+  }
+
+  return hash;
+}
+
+void *vs_table_get(const vs_table_t *table, const void *key, size_t size) {
+  if (table->length == 0)
+    return NULL;
+
+  vs_table_entry_t *entry;
+  entry = *table_locate(table, vs_table_hash(key, size), key, size);
+  return entry != NULL ? entry->value : NULL;
+}
+
+int vs_table_put(vs_table_t *table, const void *key, size_t size, void *value) {
+  if (table->length >= table->bucket_list_size && table_grow(table) == -1)
+    return -1;
+
+  uint64_t hash = vs_table_hash(key, size);
+  vs_table_entry_t **location = table_locate(table, hash, key, size);
+
+  if (*location != NULL) {
+    (*location)->value = value;
+    return 0;
+  }
+
+  vs_table_entry_t *entry;
+  if ((entry = malloc(sizeof(vs_table_entry_t) + size)) == NULL)
+    vs_return(-1, "malloc(): %s\n", strerror(errno));
+
+  entry->next = NULL;
+  entry->hash = hash;
+  entry->value = value;
+  entry->size = size;
+  memcpy(entry->key, key, size);
+
+  *location = entry;
+  table->length++;
+
+  return 0;
+}
+
+void *vs_table_pop(vs_table_t *table, const void *key, size_t size) {
+  if (table->length == 0)
+    return NULL;
+
+  vs_table_entry_t **location;
+  location = table_locate(table, vs_table_hash(key, size), key, size);
+
+  vs_table_entry_t *entry;
+  if ((entry = *location) == NULL)
+    return NULL;
+
+  void *value = entry->value;
+  *location = entry->next;
+  free(entry);
+  table->length--;
+
+  return value;
+}
+
+void vs_table_raze(vs_table_t *table) {
+  for (size_t i = 0; i < table->bucket_list_size; i++) {
+    vs_table_entry_t *entry = table->bucket_list[i];
+    while (entry != NULL) {
+      vs_table_entry_t *next = entry->next;
+      free(entry);
+      entry = next;
+    }
+  }
+
+  free(table->bucket_list);
+  table->bucket_list = NULL;
+  table->bucket_list_size = 0;
+  table->length = 0;
+}
+
+vs_table_entry_t **table_locate(const vs_table_t *table,
+    uint64_t hash, const void *key, size_t size) {
+  vs_table_entry_t **location;
+  location = &table->bucket_list[hash & (table->bucket_list_size - 1)];
+
+  for (; *location != NULL; location = &(*location)->next) {
+    vs_table_entry_t *entry = *location;
+    if (entry->hash != hash || entry->size != size)
+      continue;
+    if (!memcmp(entry->key, key, size))
+      break;
+  }
+
+  return location;
+}
+
+int table_grow(vs_table_t *table) {
+  size_t size = table->bucket_list_size;
+  size = size != 0 ? size * 2 : TABLE_INITIAL_SIZE;
+
+  vs_table_entry_t **bucket_list;
+  if ((bucket_list = calloc(size, sizeof(vs_table_entry_t *))) == NULL)
+    vs_return(-1, "calloc(): %s\n", strerror(errno));
+
+  // Move each entry into its chain in the new bucket list
+  for (size_t i = 0; i < table->bucket_list_size; i++) {
+    vs_table_entry_t *entry = table->bucket_list[i];
+    while (entry != NULL) {
+      vs_table_entry_t *next = entry->next;
+      vs_table_entry_t **bucket = &bucket_list[entry->hash & (size - 1)];
+      entry->next = *bucket;
+      *bucket = entry;
+      entry = next;
+    }
+  }
+
+  free(table->bucket_list);
+  table->bucket_list = bucket_list;
+  table->bucket_list_size = size;
+
+  return 0;
+}
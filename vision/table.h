@@ -0,0 +1,51 @@
+#ifndef VS_TABLE_H
+#define VS_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A hash table from a key of bytes to a value pointer
+ *
+ * Each key is copied into the table so the caller doesn't have to keep it
+ * alive. The value isn't owned by the table. A zeroed table is a valid empty
+ * table.
+ */
+typedef struct vs_table_t {
+  /// The bucket list where each bucket is a chain of entries
+  struct vs_table_entry_t **bucket_list;
+
+  /// The number of buckets in the @a bucket_list (zero or a power of two)
+  size_t bucket_list_size;
+
+  /// The number of entries in the table
+  size_t length;
+} vs_table_t;
+
+/// Return the FNV-1a hash of the @a size bytes at @a key
+uint64_t vs_table_hash(const void *key, size_t size) __attribute__((pure));
+
+/// Return the value of the @a key with @a size bytes in the @a table or @c NULL
+/// if the @a key isn't in the @a table
+void *vs_table_get(const vs_table_t *table, const void *key, size_t size)
+  __attribute__((nonnull(1, 2)));
+
+/**
+ * Set the value of the @a key with @a size bytes in the @a table to @a value
+ *
+ * If the @a key is already in the @a table then its value is replaced. On
+ * failure this will log to @c stderr and return @c -1.
+ */
+int vs_table_put(vs_table_t *table, const void *key, size_t size, void *value)
+  __attribute__((nonnull(1, 2)));
+
+/// Remove the @a key with @a size bytes from the @a table and return its value
+/// or @c NULL if the @a key isn't in the @a table
+void *vs_table_pop(vs_table_t *table, const void *key, size_t size)
+  __attribute__((nonnull(1, 2)));
+
+/// Remove each entry from the @a table and free its bucket list. The @a table
+/// is then a valid empty table.
+void vs_table_raze(vs_table_t *table) __attribute__((nonnull));
+
+#endif /* VS_TABLE_H */
@@ -0,0 +1,214 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+#include <libxml/xpath.h>
+
+#include "arena.h"
+#include "metadata.h"
+
+/// The number of simulated events across each thread
+#define ARENA_EVENT_COUNT 1000000
+
+/// The number of threads that the events are run on (as on the pool)
+#define ARENA_THREAD_COUNT 4
+
+/// The number of events on each thread between RSS checkpoints
+#define ARENA_CHECKPOINT 25000
+
+/// The number of bytes that the RSS may grow from the end of the warm-up (the
+/// first checkpoint) to the last checkpoint
+#define ARENA_RSS_LIMIT (4 * 1024 * 1024)
+
+/// A libvirt domain description like the one that a job reads
+static const char domain_text[] =
+  "<domain type='kvm' id='1'><name>test</name>"
+  "<metadata><vision:vision xmlns:vision='http://github.com/ktchen14/overseer/"
+  "vision' view='Test'><vision:device symbol='PCI-0000:01:00.0'/>"
+  "</vision:vision></metadata><devices>"
+  "<hostdev mode='subsystem' type='pci' managed='yes'><source>"
+  "<address domain='0x0000' bus='0x01' slot='0x00' function='0x0'/>"
+  "</source></hostdev>"
+  "<hostdev mode='subsystem' type='usb' managed='yes'><source>"
+  "<address bus='1' device='2'/></source></hostdev>"
+  "</devices></domain>";
+
+/// The vision metadata of the domain
+static const char metadata_text[] =
+  "<vision view=\"Test\"><device symbol=\"PCI-0000:01:00.0\"/>"
+  "<device symbol=\"USB-001:002\"/></vision>";
+
+/// The number of events that failed
+static size_t failure_count = 0;
+
+/// Return the resident set size of the process in bytes
+static size_t read_rss(void);
+
+/// Simulate the @a i th event in an arena scope. Return whether it succeeded.
+static bool simulate(size_t i);
+
+/// Run @c ARENA_CHECKPOINT events (per checkpoint) on a thread
+static void *run(void *argument);
+
+/// The barrier that each thread and the main thread wait on at a checkpoint
+static pthread_barrier_t checkpoint;
+
+/**
+ * Check that the RSS is stable over @c ARENA_EVENT_COUNT simulated events
+ *
+ * Each event runs in an arena scope as a job's plan does. It parses a domain
+ * description, searches it with XPath, reads and dumps it, and leaves part of
+ * it unfreed. It also loads and dumps vision metadata, causes a libxml2 error,
+ * and allocates scratch memory (some of it larger than an arena block) with
+ * vs_arena_alloc(). Any of this that isn't released at the end of the scope
+ * would grow the RSS.
+ */
+int main(void) {
+  if (vs_arena_init() == -1)
+    return EXIT_FAILURE;
+  xmlInitParser();
+
+  // Each malformed document is logged by libxml2 so discard the log
+  if (freopen("/dev/null", "w", stderr) == NULL)
+    return EXIT_FAILURE;
+
+  // A nested scope ends with the outermost scope
+  vs_arena_begin();
+  vs_arena_begin();
+  if (vs_arena_alloc(64) == NULL || vs_arena_end() != 0
+      || vs_arena_end() == 0) {
+    printf("A nested scope isn't released with the outermost scope\n");
+    return EXIT_FAILURE;
+  }
+
+  size_t round_count =
+    ARENA_EVENT_COUNT / ARENA_THREAD_COUNT / ARENA_CHECKPOINT;
+  pthread_barrier_init(&checkpoint, NULL, ARENA_THREAD_COUNT + 1);
+
+  pthread_t thread_list[ARENA_THREAD_COUNT];
+  for (size_t i = 0; i < ARENA_THREAD_COUNT; i++) {
+    if (pthread_create(&thread_list[i], NULL, run, (void *) round_count) != 0)
+      return EXIT_FAILURE;
+  }
+
+  size_t baseline = 0;
+  size_t rss = 0;
+  for (size_t round = 0; round < round_count; round++) {
+    pthread_barrier_wait(&checkpoint);
+    rss = read_rss();
+    if (round == 0)
+      baseline = rss;
+    printf("RSS after %zu event(s) is %zu KiB\n",
+        (round + 1) * ARENA_THREAD_COUNT * ARENA_CHECKPOINT, rss / 1024);
+    pthread_barrier_wait(&checkpoint);
+  }
+
+  for (size_t i = 0; i < ARENA_THREAD_COUNT; i++)
+    pthread_join(thread_list[i], NULL);
+  pthread_barrier_destroy(&checkpoint);
+
+  if (failure_count > 0) {
+    printf("%zu event(s) failed\n", failure_count);
+    return EXIT_FAILURE;
+  }
+  if (rss > baseline + ARENA_RSS_LIMIT) {
+    printf("RSS grew from %zu KiB to %zu KiB\n", baseline / 1024, rss / 1024);
+    return EXIT_FAILURE;
+  }
+  printf("RSS is stable\n");
+  return EXIT_SUCCESS;
+}
+
+size_t read_rss(void) {
+  FILE *file;
+  if ((file = fopen("/proc/self/statm", "r")) == NULL)
+    return 0;
+
+  size_t size = 0;
+  size_t resident = 0;
+  if (fscanf(file, "%zu %zu", &size, &resident) != 2)
+    resident = 0;
+  fclose(file);
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+bool simulate(size_t i) {
+  bool success = false;
+  vs_arena_begin();
+
+  xmlDocPtr document = xmlReadMemory(domain_text, sizeof(domain_text) - 1,
+      NULL, NULL, XML_PARSE_NONET | XML_PARSE_NOBLANKS);
+  if (document == NULL)
+    goto done;
+
+  // A result (and on every other event the document itself) is left unfreed
+  xmlXPathContextPtr context = xmlXPathNewContext(document);
+  xmlXPathObjectPtr result = xmlXPathEval(BAD_CAST "//hostdev", context);
+  if (result == NULL || xmlXPathNodeSetGetLength(result->nodesetval) != 2)
+    goto done;
+  xmlChar *type = xmlGetProp(result->nodesetval->nodeTab[1], BAD_CAST "type");
+  if (type == NULL || strcmp((char *) type, "usb"))
+    goto done;
+  xmlFree(type);
+
+  xmlChar *text;
+  int length;
+  xmlDocDumpFormatMemory(document, &text, &length, 1);
+  if (text == NULL)
+    goto done;
+  xmlFree(text);
+  xmlXPathFreeContext(context);
+  if (i % 2 == 0)
+    xmlFreeDoc(document);
+
+  // The metadata is loaded and dumped with malloc() around libxml2
+  vs_metadata_t *metadata;
+  if ((metadata = vs_metadata_load(metadata_text, "test")) == NULL)
+    goto done;
+  bool valid = metadata->canonical != NULL
+    && metadata->attachment_list_length == 2;
+  vs_metadata_free(metadata);
+  if (!valid)
+    goto done;
+
+  // The last error (with its strings) is from the arena
+  if (xmlReadMemory("<vision>", 8, NULL, NULL, XML_PARSE_NONET) != NULL)
+    goto done;
+
+  // Each 64th event has scratch memory larger than an arena block
+  size_t size = i % 64 == 0 ? 256 * 1024 : 512;
+  char *scratch;
+  if ((scratch = vs_arena_alloc(size)) == NULL || scratch[size - 1] != 0)
+    goto done;
+  memset(scratch, 1, size);
+
+  success = true;
+
+done:
+  return vs_arena_end() > 0 && success;
+}
+
+void *run(void *argument) {
+  size_t round_count = (size_t) argument;
+  size_t i = 0;
+
+  for (size_t round = 0; round < round_count; round++) {
+    size_t failure = 0;
+    for (size_t j = 0; j < ARENA_CHECKPOINT; j++)
+      failure += !simulate(i++);
+    __atomic_fetch_add(&failure_count, failure, __ATOMIC_RELAXED);
+
+    // Wait while the main thread reads the RSS
+    pthread_barrier_wait(&checkpoint);
+    pthread_barrier_wait(&checkpoint);
+  }
+
+  return NULL;
+}
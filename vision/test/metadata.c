@@ -0,0 +1,213 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "device.h"
+#include "metadata.h"
+#include "metadata_dom.h"
+
+/// The number of random metadata that are dumped and loaded with each codec
+#define METADATA_RANDOM_COUNT 2000
+
+/// The number of checks that failed
+static size_t failure_count = 0;
+
+/// Load the @a text with each codec and check that they agree on the result
+static void check_load(const char *text) __attribute__((nonnull));
+
+/// Dump the @a metadata with each codec and check that they agree. Return the
+/// dump or @c NULL if they don't.
+static char *check_dump(const vs_metadata_t *metadata)
+  __attribute__((nonnull));
+
+/// Dump the @a metadata with each codec and check that they agree, then load
+/// the dump with each codec and check that it's the @a metadata
+static void check_round_trip(const vs_metadata_t *metadata)
+  __attribute__((nonnull));
+
+/// Set the @a symbol to an arbitrary symbol from the xorshift @a state
+static void random_symbol(vs_symbol_t *symbol, uint64_t *state)
+  __attribute__((nonnull));
+
+/**
+ * Check the metadata codec against the tree and XPath codec that it replaced
+ *
+ * Metadata with 0, 1, 16, and 256 attachments and a series of random metadata
+ * (each with or without a view that must be escaped) are dumped and loaded
+ * back. A set of malformed and unusual documents is loaded with both codecs.
+ */
+int main(void) {
+  // Each attachment and malformed <device> is logged so discard the log
+  if (freopen("/dev/null", "w", stderr) == NULL)
+    return EXIT_FAILURE;
+
+  static const char *view_list[] = {
+    NULL, "", "Bench", "Kevin's PC", "<a & \"b\">\n\t\r", "\xc3\xa9t\xc3\xa9",
+    "\xe2\x82\xac \xf0\x9f\x92\xbb",
+  };
+  static const size_t length_list[] = { 0, 1, 16, 256 };
+  uint64_t state = 0x9e3779b97f4a7c15;
+
+  vs_symbol_t attachment_list[256];
+  for (size_t i = 0; i < sizeof(view_list) / sizeof(*view_list); i++) {
+    for (size_t j = 0; j < sizeof(length_list) / sizeof(*length_list); j++) {
+      for (size_t k = 0; k < length_list[j]; k++)
+        random_symbol(&attachment_list[k], &state);
+      vs_metadata_t metadata = {
+        .view = (char *) view_list[i],
+        .attachment_list = attachment_list,
+        .attachment_list_length = length_list[j],
+      };
+      check_round_trip(&metadata);
+    }
+  }
+
+  for (size_t i = 0; i < METADATA_RANDOM_COUNT; i++) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    size_t length = state % 32;
+    for (size_t k = 0; k < length; k++)
+      random_symbol(&attachment_list[k], &state);
+    vs_metadata_t metadata = {
+      .view = (char *) view_list[i % (sizeof(view_list) / sizeof(*view_list))],
+      .attachment_list = attachment_list,
+      .attachment_list_length = length,
+    };
+    check_round_trip(&metadata);
+  }
+
+  // A view that isn't valid UTF-8 isn't loaded back as it was so just dump it
+  static const char *invalid_list[] = {
+    "\x80x", "x\xc3", "\xc3", "\xe2\x82", "\xf8\x80\x80x", "\xef\xbf\xbe",
+    "\xf4\x90\x80\x80", "\x01\x1f",
+  };
+  for (size_t i = 0; i < sizeof(invalid_list) / sizeof(*invalid_list); i++) {
+    vs_metadata_t metadata = { .view = (char *) invalid_list[i] };
+    free(check_dump(&metadata));
+  }
+
+  static const char *text_list[] = {
+    "<vision/>",
+    "<vision view=\"A\"/>",
+    "<vision view=\"A\"><device symbol=\"PCI-0000:01:00.0\"/></vision>",
+    "<vision>\n  <device symbol=\"USB-001:002\" />\n</vision>\n",
+    "<vision view='A &amp; B &#65;'><device symbol='USB-255:255'/></vision>",
+    "<vision><![CDATA[text]]><device symbol=\"USB-001:002\"/></vision>",
+    "<vision><!-- comment --><device symbol=\"USB-001:002\"/></vision>",
+    "<vision><?pi data?><device symbol=\"USB-001:002\"/></vision>",
+    "<vision>text<device symbol=\"USB-001:002\">text</device></vision>",
+    "<vision><device/></vision>",
+    "<vision><device symbol=\"\"/></vision>",
+    "<vision><device symbol=\"USB-256:000\"/></vision>",
+    "<vision><device symbol=\"PCI-0000:00:20.0\"/>"
+      "<device symbol=\"PCI-0000:00:1f.7\"/></vision>",
+    "<vision><device other=\"USB-001:002\"/>"
+      "<device symbol=\"USB-001:002\" other=\"x\"/></vision>",
+    "<vision><other symbol=\"USB-001:002\"/></vision>",
+    "<vision><other><device symbol=\"USB-001:002\"/></other></vision>",
+    "<vision><device symbol=\"USB-001:002\">"
+      "<device symbol=\"USB-003:004\"/></device></vision>",
+    "<other view=\"A\"><device symbol=\"USB-001:002\"/></other>",
+    "<v:vision xmlns:v=\"" VS_METADATA_URI "\" view=\"A\">"
+      "<v:device symbol=\"USB-001:002\"/></v:vision>",
+    "<vision xmlns=\"" VS_METADATA_URI "\" view=\"A\">"
+      "<device symbol=\"USB-001:002\"/></vision>",
+    "<vision view=\"A\"><device xmlns=\"" VS_METADATA_URI "\" "
+      "symbol=\"USB-001:002\"/></vision>",
+    "<vision xmlns:v=\"" VS_METADATA_URI "\" v:view=\"A\">"
+      "<device v:symbol=\"USB-001:002\"/></vision>",
+    "<?xml version=\"1.0\"?>\n<vision view=\"A\"/>\n",
+    "",
+    "   ",
+    "<vision>",
+    "<vision><device symbol=\"USB-001:002\"></vision>",
+    "<vision view=\"A\"/><vision view=\"B\"/>",
+    "<vision view=\"&bad;\"/>",
+    "not xml",
+  };
+  for (size_t i = 0; i < sizeof(text_list) / sizeof(*text_list); i++)
+    check_load(text_list[i]);
+
+  if (failure_count > 0) {
+    printf("%zu check(s) failed\n", failure_count);
+    return EXIT_FAILURE;
+  }
+  printf("Each check passed\n");
+  return EXIT_SUCCESS;
+}
+
+void check_load(const char *text) {
+  vs_metadata_t *metadata = vs_metadata_load(text, "test");
+  vs_metadata_t *expect = metadata_dom_load(text, "test");
+
+  if (metadata == NULL || expect == NULL) {
+    if (metadata != expect) {
+      printf("Load of \"%s\" is %s but should be %s\n", text,
+          metadata == NULL ? "invalid" : "valid",
+          metadata == NULL ? "valid" : "invalid");
+      failure_count++;
+    }
+  } else if (!vs_metadata_eq(metadata, expect)) {
+    printf("Load of \"%s\" isn't the expected metadata\n", text);
+    failure_count++;
+  } else if ((metadata->canonical == NULL) != (expect->canonical == NULL)
+      || (metadata->canonical != NULL
+        && strcmp(metadata->canonical, expect->canonical))) {
+    printf("Load of \"%s\" isn't the expected canonical text\n", text);
+    failure_count++;
+  }
+
+  vs_metadata_free(metadata);
+  vs_metadata_free(expect);
+}
+
+char *check_dump(const vs_metadata_t *metadata) {
+  char *text = vs_metadata_dump(metadata);
+  char *expect = metadata_dom_dump(metadata);
+  if (text == NULL || expect == NULL || strcmp(text, expect)) {
+    printf("Dump of metadata with %zu attachment(s) is \"%s\" but should be "
+        "\"%s\"\n", metadata->attachment_list_length, text, expect);
+    failure_count++;
+    free(text);
+    text = NULL;
+  }
+  free(expect);
+  return text;
+}
+
+void check_round_trip(const vs_metadata_t *metadata) {
+  char *text;
+  if ((text = check_dump(metadata)) == NULL)
+    return;
+
+  vs_metadata_t *loaded = vs_metadata_load(text, "test");
+  if (loaded == NULL || !vs_metadata_eq(loaded, metadata)
+      || loaded->canonical == NULL || strcmp(loaded->canonical, text)) {
+    printf("Load of dump \"%s\" isn't the dumped metadata\n", text);
+    failure_count++;
+  }
+  vs_metadata_free(loaded);
+
+  check_load(text);
+  free(text);
+}
+
+void random_symbol(vs_symbol_t *symbol, uint64_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  if (*state & 1) {
+    symbol->subsystem = VS_SUBSYSTEM_PCI;
+    symbol->pci.domain = *state >> 48;
+    symbol->pci.bus = *state >> 40;
+    symbol->pci.slot = *state >> 32;
+    symbol->pci.function = *state >> 24;
+  } else {
+    symbol->subsystem = VS_SUBSYSTEM_USB;
+    symbol->usb.busnum = *state >> 48;
+    symbol->usb.devnum = *state >> 40;
+  }
+}
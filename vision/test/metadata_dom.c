@@ -0,0 +1,170 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libxml/tree.h>
+#include <libxml/xpath.h>
+
+#include "device.h"
+#include "metadata.h"
+#include "metadata_dom.h"
+#include "status.h"
+
+vs_metadata_t *metadata_dom_load(const char *text, const char *name) {
+  vs_metadata_t *metadata;
+  if ((metadata = calloc(1, sizeof(vs_metadata_t))) == NULL)
+    vs_return(NULL, "calloc(): %s\n", strerror(errno));
+
+  // Create an XML document from the domain's vision metadata. XML isn't used as
+  // markup here so skip blanks and reduce CDATAs. Use the domain name itself as
+  // the URI (it doesn't seem to matter and we don't have a better option).
+  xmlDocPtr document = xmlReadDoc(BAD_CAST text, name,
+      NULL, XML_PARSE_NOBLANKS | XML_PARSE_NOCDATA);
+  if (document == NULL)
+    vs_except(document,
+        "Can't load XML document from vision metadata of domain \"%s\"\n",
+        name);
+
+  xmlNodePtr root;
+  if ((root = xmlDocGetRootElement(document)) == NULL)
+    vs_except(root, "No root element in vision metadata of domain \"%s\"\n",
+        name);
+
+  // It's okay if no view is set on the domain. In this case we should detach
+  // all vision managed devices from the domain.
+  char *view = (char *) xmlGetProp(root, BAD_CAST "view");
+  if (view != NULL) {
+    metadata->view = strdup(view);
+    xmlFree(view);
+    if (metadata->view == NULL)
+      vs_except(root, "strdup(): %s\n", strerror(errno));
+  }
+
+  // This shouldn't fail even if no <device> elements are in the metadata
+  xmlXPathContextPtr ctxt = xmlXPathNewContext(document);
+  xmlXPathObjectPtr result;
+  if ((result = xmlXPathEval(BAD_CAST "/vision/device", ctxt)) == NULL)
+    vs_except(eval,
+        "Can't read device list from vision metadata of domain \"%s\"\n",
+        name);
+  if (result->type != XPATH_NODESET)
+    vs_except(result,
+        "Can't read device list from vision metadata of domain \"%s\"\n",
+        name);
+
+  int length = xmlXPathNodeSetGetLength(result->nodesetval);
+  if (length > 0) {
+    metadata->attachment_list = calloc(length, sizeof(vs_symbol_t));
+    if (metadata->attachment_list == NULL)
+      vs_except(result, "calloc(): %s\n", strerror(errno));
+  }
+
+  bool malformed = false;
+
+  // Load the symbol of each vision managed device in the domain's metadata. If
+  // we can't then drop the device element.
+  for (int i = 0; i < length; i++) {
+    xmlNodePtr device_node = xmlXPathNodeSetItem(result->nodesetval, i);
+    if (device_node->type != XML_ELEMENT_NODE)
+      continue;
+
+    char *symbol_text = (char *) xmlGetProp(device_node, BAD_CAST "symbol");
+    if (symbol_text == NULL) {
+      fprintf(stderr,
+          "Malformed <device> element in vision metadata of domain \"%s\"\n",
+          name);
+      malformed = true;
+      continue;
+    }
+
+    fprintf(stderr, "Attachment #%d on domain \"%s\" is \"%s\"\n",
+        i, name, symbol_text);
+
+    vs_symbol_t *symbol;
+    symbol = &metadata->attachment_list[metadata->attachment_list_length];
+    if (vs_symbol_load(symbol, symbol_text) == -1) {
+      fprintf(stderr,
+          "Malformed <device> element in vision metadata of domain \"%s\"\n",
+          name);
+      malformed = true;
+    } else
+      metadata->attachment_list_length++;
+
+    xmlFree(symbol_text);
+  }
+
+  xmlXPathFreeObject(result);
+  xmlXPathFreeContext(ctxt);
+  xmlFreeDoc(document);
+
+  // If this fails then the metadata is rewritten on its next reconciliation
+  if (!malformed)
+    metadata->canonical = metadata_dom_dump(metadata);
+
+  return metadata;
+
+except_result:
+  xmlXPathFreeObject(result);
+
+except_eval:
+  xmlXPathFreeContext(ctxt);
+
+except_root:
+  xmlFreeDoc(document);
+
+except_document:
+  vs_metadata_free(metadata);
+  return NULL;
+}
+
+char *metadata_dom_dump(const vs_metadata_t *metadata) {
+  xmlDocPtr document;
+  if ((document = xmlNewDoc(BAD_CAST "1.0")) == NULL)
+    vs_return(NULL, "Can't create XML document\n");
+
+  xmlNodePtr root;
+  if ((root = xmlNewNode(NULL, BAD_CAST "vision")) == NULL)
+    vs_except(node, "Can't create XML <vision> node\n");
+  xmlDocSetRootElement(document, root);
+
+  if (metadata->view != NULL) {
+    if (xmlSetProp(root, BAD_CAST "view", BAD_CAST metadata->view) == NULL)
+      vs_except(node, "Can't set \"view\" attribute to \"%s\"\n",
+          metadata->view);
+  }
+
+  for (size_t i = 0; i < metadata->attachment_list_length; i++) {
+    xmlNodePtr device_node;
+    device_node = xmlNewChild(root, NULL, BAD_CAST "device", NULL);
+    if (device_node == NULL)
+      vs_except(node, "Can't create XML <device> node\n");
+
+    char buffer[VS_SYMBOL_BUFFER_SIZE];
+    vs_symbol_dump(&metadata->attachment_list[i], buffer);
+    if (xmlSetProp(device_node, BAD_CAST "symbol", BAD_CAST buffer) == NULL)
+      vs_except(node, "Can't set \"symbol\" attribute to \"%s\"\n", buffer);
+  }
+
+  xmlChar *update;
+  int length;
+  xmlDocDumpFormatMemory(document, &update, &length, 1);
+  xmlFreeDoc(document);
+
+  if (update == NULL)
+    vs_return(NULL, "Can't dump vision metadata\n");
+
+  // The buffer is from xmlMalloc() so copy it to a buffer from malloc()
+  char *text = strdup((char *) update);
+  xmlFree(update);
+  if (text == NULL)
+    vs_return(NULL, "strdup(): %s\n", strerror(errno));
+
+  return text;
+
+except_node:
+  xmlFreeDoc(document);
+  return NULL;
+}
@@ -0,0 +1,24 @@
+#ifndef VS_TEST_METADATA_DOM_H
+#define VS_TEST_METADATA_DOM_H
+
+#include "metadata.h"
+
+/**
+ * The tree and XPath metadata codec that vs_metadata_load() and
+ * vs_metadata_dump() replaced
+ *
+ * This is kept as the reference for the metadata test and benchmark. It's the
+ * same as it was in the daemon.
+ */
+
+/// Load the vision metadata from the XML @a text with an xmlDoc and an XPath
+/// search. This is otherwise the same as vs_metadata_load().
+vs_metadata_t *metadata_dom_load(const char *text, const char *name)
+  __attribute__((malloc, nonnull));
+
+/// Dump the @a metadata by a format of an xmlDoc. This is otherwise the same as
+/// vs_metadata_dump().
+char *metadata_dom_dump(const vs_metadata_t *metadata)
+  __attribute__((malloc, nonnull));
+
+#endif /* VS_TEST_METADATA_DOM_H */
@@ -0,0 +1,192 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "device.h"
+#include "symbol_regexp.h"
+
+/// The number of random texts that are loaded with each codec
+#define SYMBOL_RANDOM_COUNT 2000000
+
+/// The characters that a random or mutated text is made of
+static const char symbol_alphabet[] = "0123456789abcdefABCDEFgG:.-+ x";
+
+/// The number of checks that failed
+static size_t failure_count = 0;
+
+/// Dump the @a symbol and load it back and check that each codec agrees
+static void check_round_trip(const vs_symbol_t *symbol)
+  __attribute__((nonnull));
+
+/// Load the @a text with each codec and check that they agree on whether it's
+/// valid and on the symbol that it's loaded to
+static void check_load(const char *text) __attribute__((nonnull));
+
+/// Return the next number from the xorshift generator with the @a state
+static uint64_t symbol_random(uint64_t *state) __attribute__((nonnull));
+
+/**
+ * Check the symbol codec against the regular expression codec that it replaced
+ *
+ * Each USB symbol and each PCI domain, and each PCI bus, slot, and function
+ * combination, is dumped and loaded back. Each @c "USB-ddd:ddd" text, each
+ * single character substitution, insertion, and deletion on a valid text, and
+ * a fixed series of random texts is loaded with both codecs.
+ */
+int main(void) {
+  if (symbol_regexp_init() == -1)
+    return EXIT_FAILURE;
+
+  // Each failed load is logged by vs_symbol_load() so discard the log
+  if (freopen("/dev/null", "w", stderr) == NULL)
+    return EXIT_FAILURE;
+
+  vs_symbol_t symbol = { .subsystem = VS_SUBSYSTEM_USB };
+  for (unsigned busnum = 0; busnum <= UINT8_MAX; busnum++) {
+    for (unsigned devnum = 0; devnum <= UINT8_MAX; devnum++) {
+      symbol.usb.busnum = busnum;
+      symbol.usb.devnum = devnum;
+      check_round_trip(&symbol);
+    }
+  }
+
+  symbol = (vs_symbol_t) { .subsystem = VS_SUBSYSTEM_PCI };
+  for (unsigned domain = 0; domain <= UINT16_MAX; domain++) {
+    symbol.pci.domain = domain;
+    check_round_trip(&symbol);
+  }
+  const uint16_t domain_list[] = { 0x0000, 0x0001, 0xabcd, 0xffff };
+  for (size_t i = 0; i < sizeof(domain_list) / sizeof(*domain_list); i++) {
+    for (unsigned bus = 0; bus <= UINT8_MAX; bus++) {
+      for (unsigned slot = 0; slot <= 0x1f; slot++) {
+        for (unsigned function = 0; function <= 0x7; function++) {
+          symbol.pci.domain = domain_list[i];
+          symbol.pci.bus = bus;
+          symbol.pci.slot = slot;
+          symbol.pci.function = function;
+          check_round_trip(&symbol);
+        }
+      }
+    }
+  }
+
+  // Each USB text with three decimal digits in each number (valid or not)
+  char text[64];
+  for (unsigned busnum = 0; busnum <= 999; busnum++) {
+    for (unsigned devnum = 0; devnum <= 999; devnum++) {
+      snprintf(text, sizeof(text), "USB-%03u:%03u", busnum, devnum);
+      check_load(text);
+    }
+  }
+
+  // Each single character substitution, insertion, and deletion on a valid
+  // text of each subsystem
+  const char *valid_list[] = { "PCI-0000:00:00.0", "PCI-fFfF:Ff:1F.7",
+    "USB-000:000", "USB-255:255" };
+  for (size_t i = 0; i < sizeof(valid_list) / sizeof(*valid_list); i++) {
+    const char *valid = valid_list[i];
+    size_t length = strlen(valid);
+    check_load(valid);
+
+    for (size_t j = 0; j <= length; j++) {
+      for (const char *c = symbol_alphabet; *c != '\0'; c++) {
+        // Substitution
+        if (j < length) {
+          strcpy(text, valid);
+          text[j] = *c;
+          check_load(text);
+        }
+
+        // Insertion
+        memcpy(text, valid, j);
+        text[j] = *c;
+        strcpy(text + j + 1, valid + j);
+        check_load(text);
+      }
+
+      // Deletion (and truncation)
+      if (j < length) {
+        memcpy(text, valid, j);
+        strcpy(text + j, valid + j + 1);
+        check_load(text);
+        memcpy(text, valid, j);
+        text[j] = '\0';
+        check_load(text);
+      }
+    }
+  }
+
+  // A fixed series of random texts after a subsystem prefix
+  const char *prefix_list[] = { "PCI-", "USB-", "pci-", "PCI", "" };
+  uint64_t state = 0x9e3779b97f4a7c15;
+  for (size_t i = 0; i < SYMBOL_RANDOM_COUNT; i++) {
+    const char *prefix = prefix_list[symbol_random(&state) % 5];
+    size_t prefix_length = strlen(prefix);
+    size_t length = symbol_random(&state) % 20;
+    memcpy(text, prefix, prefix_length);
+    for (size_t j = 0; j < length; j++) {
+      text[prefix_length + j] =
+        symbol_alphabet[symbol_random(&state) % (sizeof(symbol_alphabet) - 1)];
+    }
+    text[prefix_length + length] = '\0';
+    check_load(text);
+  }
+
+  symbol_regexp_raze();
+
+  if (failure_count > 0) {
+    printf("%zu check(s) failed\n", failure_count);
+    return EXIT_FAILURE;
+  }
+  printf("Each check passed\n");
+  return EXIT_SUCCESS;
+}
+
+void check_round_trip(const vs_symbol_t *symbol) {
+  char buffer[VS_SYMBOL_BUFFER_SIZE];
+  char expect[VS_SYMBOL_BUFFER_SIZE];
+  vs_symbol_dump(symbol, buffer);
+  symbol_regexp_dump(symbol, expect);
+  if (strcmp(buffer, expect)) {
+    printf("Dump \"%s\" isn't \"%s\"\n", buffer, expect);
+    failure_count++;
+    return;
+  }
+
+  vs_symbol_t loaded;
+  if (vs_symbol_load(&loaded, buffer) == -1) {
+    printf("Can't load dump \"%s\"\n", buffer);
+    failure_count++;
+    return;
+  }
+  if (!symbol_regexp_eq(&loaded, symbol) || !vs_symbol_eq(&loaded, symbol)
+      || vs_symbol_key(&loaded) != vs_symbol_key(symbol)) {
+    printf("Load of dump \"%s\" isn't the dumped symbol\n", buffer);
+    failure_count++;
+  }
+}
+
+void check_load(const char *text) {
+  vs_symbol_t symbol;
+  vs_symbol_t expect;
+  int e = vs_symbol_load(&symbol, text);
+  if (e != symbol_regexp_load(&expect, text)) {
+    printf("Load of \"%s\" is %s but should be %s\n", text,
+        e == 0 ? "valid" : "invalid", e == 0 ? "invalid" : "valid");
+    failure_count++;
+    return;
+  }
+  if (e == 0 && !symbol_regexp_eq(&symbol, &expect)) {
+    printf("Load of \"%s\" isn't the expected symbol\n", text);
+    failure_count++;
+  }
+}
+
+uint64_t symbol_random(uint64_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
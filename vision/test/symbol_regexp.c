@@ -0,0 +1,121 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <regex.h>
+
+#include "device.h"
+#include "symbol_regexp.h"
+
+/// The POSIX extended regular expression used to deserialize a PCI symbol
+#define PCI_SYMBOL_REGEXP "^" \
+  "([[:xdigit:]]{4}):"    /* PCI domain number (0000 - ffff) */ \
+  "([[:xdigit:]]{2}):"    /* PCI bus number (00 - ff) */ \
+  "([01][[:xdigit:]])\\." /* PCI slot number (00 - 1f) */ \
+  "([0-7])" "$"           /* PCI function number (0 - 7) */
+
+// The number of parenthesized subexpressions in PCI_SYMBOL_REGEXP
+#define PCI_SYMBOL_NSUB 4
+
+/// The POSIX extended regular expression used to deserialize a USB symbol
+#define USB_SYMBOL_REGEXP "^" \
+  "([01][[:digit:]]{2}|2[0-4][[:digit:]]|25[0-5]):" /* USB busnum (0 - 255) */ \
+  "([01][[:digit:]]{2}|2[0-4][[:digit:]]|25[0-5])$" /* USB devnum (0 - 255) */
+
+// The number of parenthesized subexpressions in USB_SYMBOL_REGEXP
+#define USB_SYMBOL_NSUB 2
+
+/// A POSIX regular expression object initialized from @c PCI_SYMBOL_REGEXP
+static regex_t pci_symbol_regexp;
+
+/// A POSIX regular expression object initialized from @c USB_SYMBOL_REGEXP
+static regex_t usb_symbol_regexp;
+
+int symbol_regexp_init(void) {
+  int e;
+
+  if ((e = regcomp(&pci_symbol_regexp, PCI_SYMBOL_REGEXP, REG_EXTENDED)) != 0) {
+    size_t length = regerror(e, &pci_symbol_regexp, NULL, 0);
+    char buffer[length];
+    regerror(e, &pci_symbol_regexp, buffer, length);
+    fprintf(stderr, "regcomp(PCI_SYMBOL_REGEXP): %s\n", buffer);
+    return -1;
+  }
+
+  if ((e = regcomp(&usb_symbol_regexp, USB_SYMBOL_REGEXP, REG_EXTENDED)) != 0) {
+    size_t length = regerror(e, &usb_symbol_regexp, NULL, 0);
+    char buffer[length];
+    regerror(e, &usb_symbol_regexp, buffer, length);
+    fprintf(stderr, "regcomp(USB_SYMBOL_REGEXP): %s\n", buffer);
+    regfree(&pci_symbol_regexp);
+    return -1;
+  }
+
+  return 0;
+}
+
+void symbol_regexp_raze(void) {
+  regfree(&pci_symbol_regexp);
+  regfree(&usb_symbol_regexp);
+}
+
+int symbol_regexp_load(vs_symbol_t *symbol, const char *buffer) {
+  if (!strncmp(buffer, "PCI-", strlen("PCI-"))) {
+    const char *text = buffer + strlen("PCI-");
+    regmatch_t result[PCI_SYMBOL_NSUB + 1];
+    if (regexec(&pci_symbol_regexp, text, PCI_SYMBOL_NSUB + 1, result, 0) != 0)
+      return -1;
+
+    // Each number in the text is followed by either a NUL or a nondigit
+    // delimiter
+    symbol->subsystem = VS_SUBSYSTEM_PCI;
+    symbol->pci.domain = strtoul(text + result[1].rm_so, NULL, 16);
+    symbol->pci.bus = strtoul(text + result[2].rm_so, NULL, 16);
+    symbol->pci.slot = strtoul(text + result[3].rm_so, NULL, 16);
+    symbol->pci.function = strtoul(text + result[4].rm_so, NULL, 16);
+    return 0;
+  }
+
+  if (!strncmp(buffer, "USB-", strlen("USB-"))) {
+    const char *text = buffer + strlen("USB-");
+    regmatch_t result[USB_SYMBOL_NSUB + 1];
+    if (regexec(&usb_symbol_regexp, text, USB_SYMBOL_NSUB + 1, result, 0) != 0)
+      return -1;
+
+    symbol->subsystem = VS_SUBSYSTEM_USB;
+    symbol->usb.busnum = strtoul(text + result[1].rm_so, NULL, 10);
+    symbol->usb.devnum = strtoul(text + result[2].rm_so, NULL, 10);
+    return 0;
+  }
+
+  return -1;
+}
+
+void symbol_regexp_dump(const vs_symbol_t *symbol, char *buffer) {
+  if (symbol->subsystem == VS_SUBSYSTEM_PCI)
+    sprintf(buffer, "PCI-%04x:%02x:%02x.%d",
+        symbol->pci.domain,
+        symbol->pci.bus,
+        symbol->pci.slot,
+        symbol->pci.function);
+  else
+    sprintf(buffer, "USB-%03d:%03d", symbol->usb.busnum, symbol->usb.devnum);
+}
+
+bool symbol_regexp_eq(const vs_symbol_t *a, const vs_symbol_t *b) {
+  if (a->subsystem != b->subsystem)
+    return false;
+
+  if (a->subsystem == VS_SUBSYSTEM_PCI) {
+    if (a->pci.domain != b->pci.domain)
+      return false;
+    if (a->pci.bus != b->pci.bus)
+      return false;
+    if (a->pci.slot != b->pci.slot)
+      return false;
+    return a->pci.function == b->pci.function;
+  }
+
+  return a->usb.busnum == b->usb.busnum && a->usb.devnum == b->usb.devnum;
+}
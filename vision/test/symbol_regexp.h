@@ -0,0 +1,38 @@
+#ifndef VS_TEST_SYMBOL_REGEXP_H
+#define VS_TEST_SYMBOL_REGEXP_H
+
+#include <stdbool.h>
+
+#include "device.h"
+
+/**
+ * The regular expression symbol codec that vs_symbol_load() and
+ * vs_symbol_dump() replaced
+ *
+ * This is kept as the reference for the symbol test and benchmark. It's the
+ * same as it was in the daemon except that a failed load isn't logged.
+ */
+
+/// Compile the regular expressions. On failure this will log to @c stderr and
+/// return @c -1.
+int symbol_regexp_init(void);
+
+/// Free the regular expressions
+void symbol_regexp_raze(void);
+
+/// Deserialize and load the @a symbol from the null terminated string in the
+/// @a buffer. On failure this will return @c -1.
+int symbol_regexp_load(vs_symbol_t *symbol, const char *buffer)
+  __attribute__((nonnull));
+
+/// Serialize the @a symbol to the @a buffer with sprintf(). The @a buffer's
+/// size must be at least @c VS_SYMBOL_BUFFER_SIZE.
+void symbol_regexp_dump(const vs_symbol_t *symbol, char *buffer)
+  __attribute__((nonnull));
+
+/// Return whether the symbols @a a and @a b represent the same host device by
+/// a comparison of each field
+bool symbol_regexp_eq(const vs_symbol_t *a, const vs_symbol_t *b)
+  __attribute__((nonnull, pure));
+
+#endif /* VS_TEST_SYMBOL_REGEXP_H */
@@ -0,0 +1,223 @@
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libudev.h>
+
+#include "device.h"
+#include "status.h"
+#include "topology.h"
+
+/// Read the hex number in the @a name attribute of the @a actual udev device
+/// into @a number. On failure this will return @c -1.
+static int topology_id(struct udev_device *actual, const char *name,
+    unsigned long *number)
+  __attribute__((nonnull));
+
+/// Run @a detect (with @a opaque) on each initialized USB device in @a udev
+/// under the @a anchor hub. On failure this will log to @c stderr and return
+/// @c -1.
+static int topology_scan_anchor(struct udev *udev, struct udev_device *anchor,
+    void (*detect)(struct udev_device *actual, void *opaque), void *opaque)
+  __attribute__((nonnull (1, 2, 3)));
+
+int vs_topology_load(vs_topology_t *topology, const char *text) {
+  unsigned int vendor;
+  unsigned int product;
+  int length = -1;
+  if (sscanf(text, "%4x:%4x %n", &vendor, &product, &length) != 2
+      || length == -1)
+    vs_return(-1, "Expected \"VENDOR:PRODUCT PORT\" in topology \"%s\"\n",
+        text);
+
+  // Each port is a nonzero number and the ports are separated by a "."
+  const char *port = text + length;
+  for (const char *cursor = port; ; cursor++) {
+    if (*cursor == '0' || !isdigit((unsigned char) *cursor))
+      vs_return(-1, "Invalid port path \"%s\" in topology \"%s\"\n",
+          port, text);
+    while (isdigit((unsigned char) *cursor))
+      cursor++;
+    if (*cursor == '\0')
+      break;
+    if (*cursor != '.')
+      vs_return(-1, "Invalid port path \"%s\" in topology \"%s\"\n",
+          port, text);
+  }
+
+  if ((topology->port = strdup(port)) == NULL)
+    vs_return(-1, "strdup(): %s\n", strerror(errno));
+  topology->vendor = vendor;
+  topology->product = product;
+  return 0;
+}
+
+bool vs_topology_eq(const vs_topology_t *a, const vs_topology_t *b) {
+  if (a->port == NULL || b->port == NULL)
+    return a->port == b->port;
+  return a->vendor == b->vendor && a->product == b->product
+    && !strcmp(a->port, b->port);
+}
+
+bool vs_topology_match(const vs_topology_t *topology,
+    struct udev_device *actual) {
+  if (topology->port == NULL)
+    return false;
+
+  const char *devtype = udev_device_get_devtype(actual);
+  if (devtype == NULL || strcmp(devtype, "usb_device"))
+    return false;
+
+  // Find the hub that's one hub up for each port in the port path. Each parent
+  // is cached in (and owned by) its child so none is unref'd here.
+  struct udev_device *anchor = actual;
+  for (const char *port = topology->port; port != NULL;
+      port = strchr(port + 1, '.')) {
+    anchor = udev_device_get_parent_with_subsystem_devtype(
+        anchor, "usb", "usb_device");
+    if (anchor == NULL)
+      return false;
+  }
+
+  unsigned long vendor;
+  unsigned long product;
+  if (topology_id(anchor, "idVendor", &vendor) == -1
+      || topology_id(anchor, "idProduct", &product) == -1
+      || vendor != topology->vendor || product != topology->product)
+    return false;
+
+  // The devpath is the port path from the root hub (which itself is "0") so
+  // the device's devpath must be the anchor hub's followed by the port path
+  const char *devpath = udev_device_get_sysattr_value(actual, "devpath");
+  const char *anchor_devpath = udev_device_get_sysattr_value(anchor, "devpath");
+  if (devpath == NULL || anchor_devpath == NULL)
+    return false;
+
+  if (!strcmp(anchor_devpath, "0"))
+    return !strcmp(devpath, topology->port);
+
+  size_t length = strlen(anchor_devpath);
+  return !strncmp(devpath, anchor_devpath, length) && devpath[length] == '.'
+    && !strcmp(devpath + length + 1, topology->port);
+}
+
+vs_device_t *vs_topology_find(struct udev_device *actual) {
+  for (size_t i = 0; vs_device_list[i] != NULL; i++) {
+    if (vs_topology_match(&vs_device_list[i]->topology, actual))
+      return vs_device_list[i];
+  }
+  return NULL;
+}
+
+int vs_topology_scan(struct udev *udev,
+    void (*detect)(struct udev_device *actual, void *opaque), void *opaque) {
+  int status = 0;
+  int e;
+
+  for (size_t i = 0; vs_device_list[i] != NULL; i++) {
+    const vs_topology_t *topology = &vs_device_list[i]->topology;
+    if (topology->port == NULL)
+      continue;
+
+    // Each anchor hub (by vendor and product) is only scanned once
+    size_t j = 0;
+    while (j < i && (vs_device_list[j]->topology.port == NULL
+          || vs_device_list[j]->topology.vendor != topology->vendor
+          || vs_device_list[j]->topology.product != topology->product))
+      j++;
+    if (j < i)
+      continue;
+
+    char vendor[sizeof("ffff")];
+    char product[sizeof("ffff")];
+    snprintf(vendor, sizeof(vendor), "%04x", topology->vendor);
+    snprintf(product, sizeof(product), "%04x", topology->product);
+
+    struct udev_enumerate *enumerate;
+    if ((enumerate = udev_enumerate_new(udev)) == NULL)
+      vs_return(-1, "udev_enumerate_new(udev): %s\n", strerror(errno));
+    if ((e = udev_enumerate_add_match_subsystem(enumerate, "usb")) != 0
+        || (e = udev_enumerate_add_match_sysattr(
+            enumerate, "idVendor", vendor)) != 0
+        || (e = udev_enumerate_add_match_sysattr(
+            enumerate, "idProduct", product)) != 0
+        || (e = udev_enumerate_scan_devices(enumerate)) != 0) {
+      udev_enumerate_unref(enumerate);
+      vs_return(-1, "Can't enumerate anchor hub %s:%s: %s\n",
+          vendor, product, strerror(-e));
+    }
+
+    struct udev_list_entry *item;
+    udev_list_entry_foreach(item, udev_enumerate_get_list_entry(enumerate)) {
+      struct udev_device *anchor;
+      anchor = udev_device_new_from_syspath(udev,
+          udev_list_entry_get_name(item));
+      if (anchor == NULL)
+        continue;
+      if (topology_scan_anchor(udev, anchor, detect, opaque) == -1)
+        status = -1;
+      udev_device_unref(anchor);
+    }
+
+    udev_enumerate_unref(enumerate);
+  }
+
+  return status;
+}
+
+int topology_scan_anchor(struct udev *udev, struct udev_device *anchor,
+    void (*detect)(struct udev_device *actual, void *opaque), void *opaque) {
+  int e;
+
+  // The parent match includes the anchor hub itself and each USB interface
+  // under it. Neither is at a topology.
+  struct udev_enumerate *enumerate;
+  if ((enumerate = udev_enumerate_new(udev)) == NULL)
+    vs_return(-1, "udev_enumerate_new(udev): %s\n", strerror(errno));
+  if ((e = udev_enumerate_add_match_parent(enumerate, anchor)) != 0
+      || (e = udev_enumerate_add_match_is_initialized(enumerate)) != 0
+      || (e = udev_enumerate_add_match_subsystem(enumerate, "usb")) != 0
+      || (e = udev_enumerate_scan_devices(enumerate)) != 0) {
+    udev_enumerate_unref(enumerate);
+    vs_return(-1, "Can't enumerate devices under anchor hub \"%s\": %s\n",
+        udev_device_get_syspath(anchor), strerror(-e));
+  }
+
+  const char *syspath = udev_device_get_syspath(anchor);
+  struct udev_list_entry *item;
+  udev_list_entry_foreach(item, udev_enumerate_get_list_entry(enumerate)) {
+    if (!strcmp(udev_list_entry_get_name(item), syspath))
+      continue;
+
+    struct udev_device *actual;
+    actual = udev_device_new_from_syspath(udev, udev_list_entry_get_name(item));
+    if (actual == NULL)
+      continue;
+
+    const char *devtype = udev_device_get_devtype(actual);
+    if (devtype != NULL && !strcmp(devtype, "usb_device"))
+      detect(actual, opaque);
+    udev_device_unref(actual);
+  }
+
+  udev_enumerate_unref(enumerate);
+  return 0;
+}
+
+int topology_id(struct udev_device *actual, const char *name,
+    unsigned long *number) {
+  const char *text;
+  if ((text = udev_device_get_sysattr_value(actual, name)) == NULL)
+    return -1;
+
+  char *string_left;
+  errno = 0;
+  *number = strtoul(text, &string_left, 16);
+  return *text != '\0' && *string_left == '\0' && errno == 0 ? 0 : -1;
+}
@@ -0,0 +1,58 @@
+#ifndef VS_TOPOLOGY_H
+#define VS_TOPOLOGY_H
+
+#include <stdbool.h>
+
+#include <libudev.h>
+
+#include "device.h"
+
+/**
+ * Parse the USB @a topology from the null terminated @a text
+ *
+ * The @a text is in the form @c "VENDOR:PRODUCT PORT[.PORT...]". The
+ * @c VENDOR and @c PRODUCT are the hex @c idVendor and @c idProduct of the
+ * anchor hub and each @c PORT is a port number on the hub before it (starting
+ * with the anchor hub). The @a topology's @a port should be free()ed by the
+ * caller. On failure this will log to @c stderr and return @c -1.
+ */
+int vs_topology_load(vs_topology_t *topology, const char *text)
+  __attribute__((nonnull));
+
+/// Return whether the @a topology of @a a and @a b is the same
+bool vs_topology_eq(const vs_topology_t *a, const vs_topology_t *b)
+  __attribute__((nonnull, pure));
+
+/**
+ * Return whether the @a actual udev device is at the @a topology
+ *
+ * This is the case if the @a actual udev device is a USB device and its
+ * ancestor as many hubs up as there are ports in the @a topology's @a port has
+ * the @a topology's @a vendor and @a product, and the @a actual udev device is
+ * on that port path from it. The sysfs @c devpath of each device is compared
+ * so no kernel name is saved anywhere.
+ */
+bool vs_topology_match(const vs_topology_t *topology,
+    struct udev_device *actual)
+  __attribute__((nonnull));
+
+/// Return the device in @c vs_device_list with a topology that the @a actual
+/// udev device is at or @c NULL if there's no such device
+vs_device_t *vs_topology_find(struct udev_device *actual)
+  __attribute__((nonnull));
+
+/**
+ * Run @a detect (with @a opaque) on each initialized USB device in @a udev
+ * that's under an anchor hub of a topology in @c vs_device_list
+ *
+ * Each anchor hub is enumerated by its @a vendor and @a product and then only
+ * its descendants are enumerated (with udev_enumerate_add_match_parent()) so
+ * that no other device is run through vs_topology_find(). A device under
+ * nested anchor hubs may be detected more than once. On failure this will log
+ * to @c stderr and return @c -1.
+ */
+int vs_topology_scan(struct udev *udev,
+    void (*detect)(struct udev_device *actual, void *opaque), void *opaque)
+  __attribute__((nonnull (1, 2)));
+
+#endif /* VS_TOPOLOGY_H */
@@ -0,0 +1,188 @@
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "trace.h"
+
+/// The number of buckets in each stage's histogram. Bucket @c i counts each
+/// span of less than 2^i microseconds (and at least 2^(i - 1)); the last
+/// bucket also counts each longer span.
+#define TRACE_BUCKET_COUNT 32
+
+/// The latency histogram of a stage. Each counter is updated atomically since
+/// spans are recorded on both the main thread and the workers.
+typedef struct trace_histogram_t {
+  /// The number of spans recorded
+  atomic_uint_fast64_t count;
+
+  /// The sum of the duration (in nanoseconds) of each span
+  atomic_uint_fast64_t sum;
+
+  /// The longest duration (in nanoseconds) of any span
+  atomic_uint_fast64_t max;
+
+  /// The number of spans in each bucket
+  atomic_uint_fast64_t bucket[TRACE_BUCKET_COUNT];
+} trace_histogram_t;
+
+/// The name of each stage
+static const char *const stage_name[VS_STAGE_COUNT] = {
+  [VS_STAGE_UDEV_RECEIVE]   = "udev-receive",
+  [VS_STAGE_DETECT]         = "detect",
+  [VS_STAGE_REMOVE]         = "remove",
+  [VS_STAGE_PREBIND]        = "prebind",
+  [VS_STAGE_METADATA_FETCH] = "metadata-fetch",
+  [VS_STAGE_METADATA_PARSE] = "metadata-parse",
+  [VS_STAGE_DESCRIBE]       = "describe",
+  [VS_STAGE_PLAN]           = "plan",
+  [VS_STAGE_DETACH]         = "detach",
+  [VS_STAGE_ATTACH]         = "attach",
+  [VS_STAGE_METADATA_WRITE] = "metadata-write",
+  [VS_STAGE_REDEFINE]       = "redefine",
+  [VS_STAGE_RECONCILE]      = "reconcile",
+};
+
+/// The histogram of each stage
+static trace_histogram_t histogram_list[VS_STAGE_COUNT];
+
+bool vs_trace_verbose = false;
+
+/// Return the index of the bucket for a span of @a duration nanoseconds
+static size_t trace_bucket(uint64_t duration);
+
+/// Return the duration (in nanoseconds) under which the @a rank th span of the
+/// @a histogram (in order of duration) is known to be. This is the upper bound
+/// of its bucket (capped at the longest span).
+static uint64_t trace_rank(const trace_histogram_t *histogram, uint64_t rank)
+  __attribute__((nonnull));
+
+uint64_t vs_monotonic_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+long vs_monotonic_ms(void) {
+  return vs_monotonic_ns() / 1000000;
+}
+
+vs_span_t vs_span_begin(
+    vs_stage_t stage, const char *domain, const char *device) {
+  return (vs_span_t) {
+    .stage = stage,
+    .domain = domain,
+    .device = device,
+    .start = vs_monotonic_ns(),
+  };
+}
+
+uint64_t vs_span_end(const vs_span_t *span) {
+  uint64_t duration = vs_monotonic_ns() - span->start;
+  trace_histogram_t *histogram = &histogram_list[span->stage];
+
+  atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&histogram->sum, duration, memory_order_relaxed);
+  atomic_fetch_add_explicit(
+      &histogram->bucket[trace_bucket(duration)], 1, memory_order_relaxed);
+
+  uint_fast64_t max = atomic_load_explicit(
+      &histogram->max, memory_order_relaxed);
+  while (duration > max && !atomic_compare_exchange_weak_explicit(
+        &histogram->max, &max, duration,
+        memory_order_relaxed, memory_order_relaxed))
+    continue;
+
+  if (vs_trace_verbose)
+    fprintf(stderr, "Span %s domain=\"%s\" device=\"%s\" took %" PRIu64 " us\n",
+        stage_name[span->stage],
+        span->domain != NULL ? span->domain : "",
+        span->device != NULL ? span->device : "",
+        duration / 1000);
+
+  return duration;
+}
+
+void vs_trace_dump(FILE *file) {
+  fprintf(file, "%-16s %10s %12s %12s %12s %12s %12s\n",
+      "stage", "count", "mean_us", "p50_us", "p90_us", "p99_us", "max_us");
+
+  for (size_t i = 0; i < VS_STAGE_COUNT; i++) {
+    const trace_histogram_t *histogram = &histogram_list[i];
+
+    uint64_t count = atomic_load(&histogram->count);
+    if (count == 0) {
+      fprintf(file, "%-16s %10d %12s %12s %12s %12s %12s\n",
+          stage_name[i], 0, "-", "-", "-", "-", "-");
+      continue;
+    }
+
+    // The percentiles are by nearest rank
+    fprintf(file, "%-16s %10" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64
+        " %12" PRIu64 " %12" PRIu64 "\n",
+        stage_name[i], count,
+        atomic_load(&histogram->sum) / count / 1000,
+        trace_rank(histogram, (count * 50 + 99) / 100) / 1000,
+        trace_rank(histogram, (count * 90 + 99) / 100) / 1000,
+        trace_rank(histogram, (count * 99 + 99) / 100) / 1000,
+        atomic_load(&histogram->max) / 1000);
+  }
+
+  fflush(file);
+}
+
+void vs_trace_expose(FILE *file) {
+  fputs("# HELP vision_stage_duration_seconds Latency of each stage of event "
+      "handling.\n"
+      "# TYPE vision_stage_duration_seconds histogram\n", file);
+
+  for (size_t i = 0; i < VS_STAGE_COUNT; i++) {
+    const trace_histogram_t *histogram = &histogram_list[i];
+
+    // Each bucket is cumulative. The last bucket also counts each longer span
+    // so it's only reported as +Inf.
+    uint64_t seen = 0;
+    for (size_t j = 0; j < TRACE_BUCKET_COUNT - 1; j++) {
+      seen += atomic_load(&histogram->bucket[j]);
+      fprintf(file, "vision_stage_duration_seconds_bucket"
+          "{stage=\"%s\",le=\"%.6f\"} %" PRIu64 "\n",
+          stage_name[i], (double) ((uint64_t) 1 << j) / 1e6, seen);
+    }
+
+    uint64_t count = atomic_load(&histogram->count);
+    fprintf(file,
+        "vision_stage_duration_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %"
+        PRIu64 "\n"
+        "vision_stage_duration_seconds_sum{stage=\"%s\"} %.9f\n"
+        "vision_stage_duration_seconds_count{stage=\"%s\"} %" PRIu64 "\n",
+        stage_name[i], count,
+        stage_name[i], (double) atomic_load(&histogram->sum) / 1e9,
+        stage_name[i], count);
+  }
+}
+
+size_t trace_bucket(uint64_t duration) {
+  uint64_t us = duration / 1000;
+
+  size_t bucket = 0;
+  while (us > 0 && bucket < TRACE_BUCKET_COUNT - 1) {
+    us >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+uint64_t trace_rank(const trace_histogram_t *histogram, uint64_t rank) {
+  uint64_t max = atomic_load(&histogram->max);
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < TRACE_BUCKET_COUNT - 1; i++) {
+    if ((seen += atomic_load(&histogram->bucket[i])) >= rank) {
+      uint64_t bound = ((uint64_t) 1 << i) * 1000;
+      return bound < max ? bound : max;
+    }
+  }
+  return max;
+}
@@ -0,0 +1,78 @@
+#ifndef VS_TRACE_H
+#define VS_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/// A stage of event handling that's timed with a span
+typedef enum vs_stage_t {
+  VS_STAGE_UDEV_RECEIVE,    ///< The receipt of an event from the udev monitor
+  VS_STAGE_DETECT,          ///< The assignment of an added udev device
+  VS_STAGE_REMOVE,          ///< The unassignment of a removed udev device
+  VS_STAGE_PREBIND,         ///< The binding of a detected device to vfio-pci
+  VS_STAGE_METADATA_FETCH,  ///< A virDomainGetMetadata() call
+  VS_STAGE_METADATA_PARSE,  ///< The load of a domain's vision metadata
+  VS_STAGE_DESCRIBE,        ///< The fetch of a domain's description
+  VS_STAGE_PLAN,            ///< The plan of a domain's reconciliation
+  VS_STAGE_DETACH,          ///< A virDomainDetachDeviceFlags() call
+  VS_STAGE_ATTACH,          ///< A virDomainAttachDeviceFlags() call
+  VS_STAGE_METADATA_WRITE,  ///< A virDomainSetMetadata() call
+  VS_STAGE_REDEFINE,        ///< A virDomainDefineXML() call
+  VS_STAGE_RECONCILE,       ///< A pass of reconciliation
+  VS_STAGE_COUNT,           ///< The number of stages
+} vs_stage_t;
+
+/// A timed span of a stage. This is started with vs_span_begin() and recorded
+/// with vs_span_end().
+typedef struct vs_span_t {
+  /// The stage that the span times
+  vs_stage_t stage;
+
+  /// The name of the domain that the span is for or @c NULL
+  const char *domain;
+
+  /// The name (or symbol) of the device that the span is for or @c NULL
+  const char *device;
+
+  /// The time (from vs_monotonic_ns()) when the span was started
+  uint64_t start;
+} vs_span_t;
+
+/// Whether each span is logged to @c stderr when it's recorded
+extern bool vs_trace_verbose;
+
+/// Return the time of the monotonic clock in nanoseconds
+uint64_t vs_monotonic_ns(void);
+
+/// Return the time of the monotonic clock in milliseconds
+long vs_monotonic_ms(void);
+
+/**
+ * Start a span of the @a stage for the @a domain and @a device
+ *
+ * Either tag may be @c NULL. Each tag is borrowed and must be valid until the
+ * span is recorded.
+ */
+vs_span_t vs_span_begin(
+    vs_stage_t stage, const char *domain, const char *device);
+
+/**
+ * Record the @a span in the histogram of its stage and return its duration in
+ * nanoseconds
+ *
+ * This may be called on any thread. If @c vs_trace_verbose then the @a span is
+ * also logged to @c stderr with its tags.
+ */
+uint64_t vs_span_end(const vs_span_t *span) __attribute__((nonnull));
+
+/// Print the count, mean, maximum, and 50th, 90th, and 99th percentile latency
+/// of each stage to the @a file
+void vs_trace_dump(FILE *file) __attribute__((nonnull));
+
+/// Write the latency histogram of each stage to the @a file as the
+/// @c vision_stage_duration_seconds histogram in the Prometheus text exposition
+/// format
+void vs_trace_expose(FILE *file) __attribute__((nonnull));
+
+#endif /* VS_TRACE_H */
@@ -0,0 +1,173 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <libudev.h>
+
+#include "device.h"
+#include "status.h"
+#include "trace.h"
+#include "vfio.h"
+
+/// The directory of each PCI device in sysfs
+#define VFIO_DEVICE_PATH "/sys/bus/pci/devices"
+
+/// The file that a PCI device's name is written to to probe it for a driver
+#define VFIO_PROBE_PATH "/sys/bus/pci/drivers_probe"
+
+/**
+ * Read the name of the driver of the PCI device at @a path into @a buffer
+ *
+ * Return the @a buffer or @c NULL if the device isn't bound to a driver. The
+ * @a buffer's size must be at least @c NAME_MAX + 1.
+ */
+static const char *vfio_driver(const char *path, char *buffer)
+  __attribute__((nonnull));
+
+/**
+ * Wait until the PCI device at @a path is bound to the @a driver (or to no
+ * driver if @a driver is @c NULL)
+ *
+ * The device's @c driver link is checked again on each event from the
+ * @a monitor until @a deadline (from vs_monotonic_ms()). On timeout this will
+ * return @c -1.
+ */
+static int vfio_wait(struct udev_monitor *monitor, const char *path,
+    const char *driver, long deadline)
+  __attribute__((nonnull(1, 2)));
+
+/// Write the @a text to the file at @a path. On failure this will log to
+/// @c stderr and return @c -1.
+static int vfio_write(const char *path, const char *text)
+  __attribute__((nonnull));
+
+int vs_vfio_bind(struct udev *udev, const vs_symbol_t *symbol) {
+  if (symbol->subsystem != VS_SUBSYSTEM_PCI)
+    vs_return(-1, "Can't bind a non-PCI device to \"" VS_VFIO_DRIVER "\"\n");
+
+  // The PCI symbol's serialization is "PCI-" followed by the PCI_SLOT_NAME
+  char buffer[VS_SYMBOL_BUFFER_SIZE];
+  vs_symbol_dump(symbol, buffer);
+  const char *name = buffer + strlen("PCI-");
+
+  char path[sizeof(VFIO_DEVICE_PATH "/") + VS_SYMBOL_BUFFER_SIZE];
+  snprintf(path, sizeof(path), VFIO_DEVICE_PATH "/%s", name);
+  if (access(path, F_OK) == -1)
+    vs_return(1, "No PCI device %s available at %s\n", name, path);
+
+  char driver_buffer[NAME_MAX + 1];
+  const char *driver = vfio_driver(path, driver_buffer);
+  if (driver != NULL && !strcmp(driver, VS_VFIO_DRIVER))
+    return 0;
+
+  // Receive each kernel uevent on the PCI bus before the driver is changed so
+  // that the unbind and bind events aren't missed
+  struct udev_monitor *monitor;
+  if ((monitor = udev_monitor_new_from_netlink(udev, "kernel")) == NULL)
+    vs_return(-1, "Can't create kernel uevent monitor\n");
+  if (udev_monitor_filter_add_match_subsystem_devtype(monitor, "pci", NULL) < 0)
+    vs_except(monitor, "Can't filter kernel uevent monitor\n");
+  if (udev_monitor_enable_receiving(monitor) < 0)
+    vs_except(monitor, "Can't enable kernel uevent monitor\n");
+
+  long deadline = vs_monotonic_ms() + VS_VFIO_TIMEOUT;
+  char file[PATH_MAX];
+
+  if (driver != NULL) {
+    snprintf(file, sizeof(file), "%s/driver/unbind", path);
+    if (vfio_write(file, name) == -1)
+      goto except_monitor;
+    if (vfio_wait(monitor, path, NULL, deadline) == -1)
+      vs_except(monitor, "Unable to unbind driver \"%s\" from device %s\n",
+          driver, name);
+  }
+
+  snprintf(file, sizeof(file), "%s/driver_override", path);
+  if (vfio_write(file, VS_VFIO_DRIVER) == -1)
+    goto except_monitor;
+  if (vfio_write(VFIO_PROBE_PATH, name) == -1)
+    goto except_monitor;
+  if (vfio_wait(monitor, path, VS_VFIO_DRIVER, deadline) == -1) {
+    driver = vfio_driver(path, driver_buffer);
+    vs_except(monitor, "Expected device %s's driver \"%s\" to be \""
+        VS_VFIO_DRIVER "\"\n", name, driver != NULL ? driver : "");
+  }
+
+  udev_monitor_unref(monitor);
+  return 0;
+
+except_monitor:
+  udev_monitor_unref(monitor);
+  return -1;
+}
+
+const char *vfio_driver(const char *path, char *buffer) {
+  char file[PATH_MAX];
+  snprintf(file, sizeof(file), "%s/driver", path);
+
+  char target[PATH_MAX];
+  ssize_t length;
+  if ((length = readlink(file, target, sizeof(target) - 1)) == -1)
+    return NULL;
+  target[length] = '\0';
+
+  const char *base = strrchr(target, '/');
+  base = base != NULL ? base + 1 : target;
+  snprintf(buffer, NAME_MAX + 1, "%.*s", NAME_MAX, base);
+  return buffer;
+}
+
+int vfio_wait(struct udev_monitor *monitor, const char *path,
+    const char *driver, long deadline) {
+  struct pollfd pollfd = {
+    .fd = udev_monitor_get_fd(monitor),
+    .events = POLLIN,
+  };
+
+  // Unbinding and probing usually finish within the write() so the driver link
+  // is checked before any event is awaited
+  while (true) {
+    char buffer[NAME_MAX + 1];
+    const char *actual = vfio_driver(path, buffer);
+    if (driver == NULL ? actual == NULL
+        : actual != NULL && !strcmp(actual, driver))
+      return 0;
+
+    long timeout = deadline - vs_monotonic_ms();
+    if (timeout <= 0)
+      return -1;
+    if (poll(&pollfd, 1, timeout) == -1 && errno != EINTR)
+      vs_return(-1, "poll(): %s\n", strerror(errno));
+
+    // The events themselves are discarded since the driver link is the truth
+    struct udev_device *device;
+    while ((device = udev_monitor_receive_device(monitor)) != NULL)
+      udev_device_unref(device);
+  }
+}
+
+int vfio_write(const char *path, const char *text) {
+  int fd;
+  if ((fd = open(path, O_WRONLY | O_CLOEXEC)) == -1)
+    vs_return(-1, "open(\"%s\"): %s\n", path, strerror(errno));
+
+  size_t size = strlen(text);
+  if (write(fd, text, size) != (ssize_t) size) {
+    fprintf(stderr, "write(\"%s\"): %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  if (close(fd) == -1)
+    vs_return(-1, "close(\"%s\"): %s\n", path, strerror(errno));
+  return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef VS_VFIO_H
+#define VS_VFIO_H
+
+#include <libudev.h>
+
+#include "device.h"
+
+/// The name of the driver that a PCI device is bound to for passthrough
+#define VS_VFIO_DRIVER "vfio-pci"
+
+/// The longest time (in milliseconds) to wait for the kernel to unbind or bind
+/// a PCI device's driver
+#define VS_VFIO_TIMEOUT 10000
+
+/**
+ * Bind the PCI device with the @a symbol to the @c vfio-pci driver
+ *
+ * If the device is bound to another driver then it's unbound first. The
+ * device's @c driver_override is set to @c vfio-pci so that it's only bound to
+ * @c vfio-pci afterward. Each unbind and bind is awaited with a kernel uevent
+ * monitor on @a udev (and the device's @c driver link in sysfs) rather than for
+ * a fixed time. If the device is already bound to @c vfio-pci then this will
+ * return at once.
+ *
+ * If there's no such device then this will log to @c stderr and return @c 1
+ * so that libvirt can deal with the absent device. On failure (or if the
+ * @a symbol isn't a PCI symbol) this will log to @c stderr and return @c -1.
+ */
+int vs_vfio_bind(struct udev *udev, const vs_symbol_t *symbol)
+  __attribute__((nonnull));
+
+#endif /* VS_VFIO_H */
@@ -0,0 +1,222 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "device.h"
+#include "domain.h"
+#include "status.h"
+#include "view.h"
+
+vs_view_t **vs_view_list = NULL;
+
+/// Return the view in @c vs_view_list with the @a name and create it if it
+/// doesn't exist. On failure this will log to @c stderr and return @c NULL.
+static vs_view_t *view_intern(const char *name, size_t *length)
+  __attribute__((nonnull));
+
+/// Append the @a device to the @a view's member list. On failure this will log
+/// to @c stderr and return @c -1.
+static int view_member(vs_view_t *view, vs_device_t *device)
+  __attribute__((nonnull));
+
+/// Rebuild the @a view's active list from its member list
+static void view_build(vs_view_t *view) __attribute__((nonnull));
+
+int vs_view_index(void) {
+  size_t length = 0;
+
+  if ((vs_view_list = calloc(1, sizeof(vs_view_t *))) == NULL)
+    vs_return(-1, "calloc(): %s\n", strerror(errno));
+
+  for (size_t i = 0; vs_device_list[i] != NULL; i++) {
+    vs_device_t *device = vs_device_list[i];
+
+    size_t count = 0;
+    while (device->view_list[count] != NULL)
+      count++;
+
+    device->view_index = calloc(count + 1, sizeof(vs_view_t *));
+    if (device->view_index == NULL)
+      vs_except(index, "calloc(): %s\n", strerror(errno));
+
+    for (size_t j = 0; j < count; j++) {
+      vs_view_t *view = view_intern(device->view_list[j], &length);
+      if (view == NULL || view_member(view, device) == -1)
+        goto except_index;
+      device->view_index[j] = view;
+    }
+  }
+
+  // A device may already be assigned when the views are reconstructed
+  for (size_t i = 0; i < length; i++) {
+    vs_view_t *view = vs_view_list[i];
+    view->active_list = calloc(view->member_list_length + 1,
+        sizeof(vs_device_t *));
+    if (view->active_list == NULL)
+      vs_except(index, "calloc(): %s\n", strerror(errno));
+    view_build(view);
+  }
+
+  // Set each domain to the view in its current metadata again. There are only
+  // domains here when the views are reconstructed after a layout reload.
+  for (vs_domain_t *domain = vs_domain_list; domain; domain = domain->next) {
+    vs_metadata_t *current = domain->current;
+    vs_view_set(domain, current != NULL ? current->view : NULL);
+  }
+
+  return 0;
+
+except_index:
+  vs_view_raze();
+  return -1;
+}
+
+void vs_view_raze(void) {
+  for (size_t i = 0; vs_device_list[i] != NULL; i++) {
+    free(vs_device_list[i]->view_index);
+    vs_device_list[i]->view_index = NULL;
+  }
+
+  for (vs_domain_t *domain = vs_domain_list; domain; domain = domain->next)
+    domain->view = NULL;
+
+  if (vs_view_list == NULL)
+    return;
+
+  for (size_t i = 0; vs_view_list[i] != NULL; i++) {
+    free(vs_view_list[i]->domain_list);
+    free(vs_view_list[i]->member_list);
+    free(vs_view_list[i]->active_list);
+    free(vs_view_list[i]);
+  }
+  free(vs_view_list);
+  vs_view_list = NULL;
+}
+
+vs_view_t *vs_view_find(const char *name) {
+  if (name == NULL)
+    return NULL;
+
+  for (size_t i = 0; vs_view_list[i] != NULL; i++) {
+    if (!strcmp(vs_view_list[i]->name, name))
+      return vs_view_list[i];
+  }
+
+  return NULL;
+}
+
+int vs_view_set(vs_domain_t *domain, const char *name) {
+  vs_view_t *view = vs_view_find(name);
+
+  if (domain->view == view)
+    return 0;
+
+  // Remove the domain from its current view's domain list
+  if (domain->view != NULL) {
+    vs_view_t *prior = domain->view;
+    for (size_t i = 0; i < prior->domain_list_length; i++) {
+      if (prior->domain_list[i] != domain)
+        continue;
+      prior->domain_list[i] = prior->domain_list[--prior->domain_list_length];
+      break;
+    }
+    domain->view = NULL;
+  }
+
+  if (view == NULL)
+    return 0;
+
+  if (view->domain_list_length == view->domain_list_size) {
+    size_t size = view->domain_list_size ? view->domain_list_size * 2 : 4;
+    vs_domain_t **domain_list;
+    domain_list = realloc(view->domain_list, size * sizeof(vs_domain_t *));
+    if (domain_list == NULL)
+      vs_return(-1, "realloc(): %s\n", strerror(errno));
+    view->domain_list = domain_list;
+    view->domain_list_size = size;
+  }
+
+  view->domain_list[view->domain_list_length++] = domain;
+  domain->view = view;
+
+  return 0;
+}
+
+void vs_view_update(const vs_device_t *device) {
+  // The views may not be indexed yet
+  if (device->view_index == NULL)
+    return;
+
+  for (size_t i = 0; device->view_index[i] != NULL; i++)
+    view_build(device->view_index[i]);
+}
+
+bool vs_view_mark(const vs_device_t *device) {
+  bool mark = false;
+
+  for (size_t i = 0; device->view_index[i] != NULL; i++) {
+    vs_view_t *view = device->view_index[i];
+    for (size_t j = 0; j < view->domain_list_length; j++) {
+      view->domain_list[j]->pending = true;
+      mark = true;
+    }
+  }
+
+  return mark;
+}
+
+vs_view_t *view_intern(const char *name, size_t *length) {
+  for (size_t i = 0; i < *length; i++) {
+    if (!strcmp(vs_view_list[i]->name, name))
+      return vs_view_list[i];
+  }
+
+  vs_view_t **view_list;
+  view_list = realloc(vs_view_list, (*length + 2) * sizeof(vs_view_t *));
+  if (view_list == NULL)
+    vs_return(NULL, "realloc(): %s\n", strerror(errno));
+  vs_view_list = view_list;
+
+  vs_view_t *view;
+  if ((view = calloc(1, sizeof(vs_view_t))) == NULL)
+    vs_return(NULL, "calloc(): %s\n", strerror(errno));
+  view->name = name;
+
+  vs_view_list[(*length)++] = view;
+  vs_view_list[*length] = NULL;
+
+  return view;
+}
+
+int view_member(vs_view_t *view, vs_device_t *device) {
+  // A view that's repeated in a device's view list is a single membership
+  if (view->member_list_length > 0
+      && view->member_list[view->member_list_length - 1] == device)
+    return 0;
+
+  vs_device_t **member_list = realloc(view->member_list,
+      (view->member_list_length + 1) * sizeof(vs_device_t *));
+  if (member_list == NULL)
+    vs_return(-1, "realloc(): %s\n", strerror(errno));
+
+  view->member_list = member_list;
+  view->member_list[view->member_list_length++] = device;
+  return 0;
+}
+
+void view_build(vs_view_t *view) {
+  // The active list isn't allocated until each member is known
+  if (view->active_list == NULL)
+    return;
+
+  view->active_list_length = 0;
+  for (size_t i = 0; i < view->member_list_length; i++) {
+    if (view->member_list[i]->actual != NULL
+        && view->member_list[i]->prebind_job == NULL)
+      view->active_list[view->active_list_length++] = view->member_list[i];
+  }
+  view->active_list[view->active_list_length] = NULL;
+}
@@ -0,0 +1,96 @@
+#ifndef VS_VIEW_H
+#define VS_VIEW_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "device.h"
+#include "domain.h"
+
+/**
+ * A view in the vision system
+ *
+ * A view is identified by its name in the view list of each vision device.
+ * Each view tracks the domains that are currently set to it so that a change
+ * to a vision device can be traced to just the domains that it affects.
+ *
+ * Each view also keeps the assigned devices in it with their manifests. This is
+ * the target of each domain set to the view whatever view the domain was set to
+ * before, so a plan reads it instead of a scan of @c vs_device_list. It's only
+ * rebuilt (with vs_view_update()) for the views of a device that's assigned or
+ * unassigned.
+ */
+typedef struct vs_view_t {
+  /// The view's unique name in the vision system
+  const char *name;
+
+  /// The domains that are set to this view
+  vs_domain_t **domain_list;
+
+  /// The number of domains in the @a domain_list
+  size_t domain_list_length;
+
+  /// The number of domains that the @a domain_list has room for
+  size_t domain_list_size;
+
+  /// Each device with the view in its view list (in the order of
+  /// @c vs_device_list)
+  vs_device_t **member_list;
+
+  /// The number of devices in the @a member_list
+  size_t member_list_length;
+
+  /// Each device in the @a member_list that's assigned an actual udev device
+  /// and isn't being prebound (in the same order). This has room for each
+  /// member and is protected by @c vs_device_lock like the devices themselves.
+  vs_device_t **active_list;
+
+  /// The number of devices in the @a active_list
+  size_t active_list_length;
+} vs_view_t;
+
+/// The global view list (terminated by @c NULL)
+extern vs_view_t **vs_view_list;
+
+/**
+ * Construct @c vs_view_list from the view list of each device in
+ * @c vs_device_list and set each device's @a view_index
+ *
+ * Each domain in @c vs_domain_list is then set to the view in its current
+ * metadata. On failure this will log to @c stderr and return @c -1.
+ */
+int vs_view_index(void);
+
+/// Free @c vs_view_list and each device's @a view_index and set the view of
+/// each domain in @c vs_domain_list to @c NULL
+void vs_view_raze(void);
+
+/// Rebuild the @a active_list of each view of the @a device. This must be
+/// called with @c vs_device_lock held for writing whenever the @a device is
+/// assigned or unassigned.
+void vs_view_update(const vs_device_t *device) __attribute__((nonnull));
+
+/// Return the view in @c vs_view_list with the @a name or @c NULL if there's no
+/// such view. If @a name is @c NULL then return @c NULL.
+vs_view_t *vs_view_find(const char *name);
+
+/**
+ * Set the @a domain's view to the view with the @a name
+ *
+ * This will remove the @a domain from its current view's domain list and add it
+ * to the domain list of the view with the @a name. If there's no such view (or
+ * @a name is @c NULL) then the @a domain's view is set to @c NULL. On failure
+ * this will log to @c stderr and return @c -1 with the @a domain in no view.
+ */
+int vs_view_set(vs_domain_t *domain, const char *name)
+  __attribute__((nonnull(1)));
+
+/**
+ * Mark each domain that's set to a view of the @a device as pending
+ *
+ * This should be called whenever the @a device's actual udev device is
+ * assigned or unassigned. Return whether any domain was marked.
+ */
+bool vs_view_mark(const vs_device_t *device) __attribute__((nonnull));
+
+#endif /* VS_VIEW_H */